@@ -2,6 +2,8 @@
 #define __NANONET_H__
 
 #include <linux/types.h>
+#include <linux/version.h>
+#include <linux/netdevice.h>
 #include <linux/skbuff.h>
 #include <linux/ip.h>
 #include <linux/tcp.h>
@@ -9,90 +11,526 @@
 #include <linux/if_ether.h>
 #include <linux/jhash.h>
 #include <linux/atomic.h>
+#include <linux/refcount.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/rhashtable-types.h>
+#include <linux/timer.h>
+#include <linux/seqlock.h>
+#include "nanonet_pipeline.h"
+#include <linux/bitops.h>
 
 #define ATOMIC64_INIT(i) { (i) }
 
-// Ethernet header
-struct ull_ethhdr {
-    unsigned char h_dest[ETH_ALEN];
-    unsigned char h_source[ETH_ALEN];
-    __be16 h_proto;
-} __packed;
-
-// IP header (simplified)
-struct ull_iphdr {
-    __u8 version_ihl;
-    __u8 tos;
-    __be16 tot_len;
-    __be16 id;
-    __be16 frag_off;
-    __u8 ttl;
-    __u8 protocol;
-    __sum16 check;
-    __be32 saddr;
-    __be32 daddr;
-} __packed;
-
-// TCP header (simplified)
-struct ull_tcphdr {
-    __be16 source;
-    __be16 dest;
-    __be32 seq;
-    __be32 ack_seq;
-    __u16 res1:4, doff:4, fin:1, syn:1, rst:1, psh:1, ack:1, urg:1, ece:1, cwr:1;
-    __be16 window;
-    __sum16 check;
-    __be16 urg_ptr;
-} __packed;
-
-// UDP header
-struct ull_udphdr {
-    __be16 source;
-    __be16 dest;
-    __be16 len;
-    __sum16 check;
-} __packed;
-
-// TCP connection state
-struct ull_tcp_conn {
+struct seq_file;
+struct file;
+struct vm_area_struct;
+struct poll_table_struct;
+struct nanonet_strategy;
+
+// TCP connection tracking (conntrack.c)
+#define NANONET_CONN_MAX 65536
+#define NANONET_CONN_TIMEOUT_SYN (30 * HZ)
+#define NANONET_CONN_TIMEOUT_ESTABLISHED (300 * HZ)
+#define NANONET_CONN_TIMEOUT_CLOSING (10 * HZ)
+
+struct nanonet_conn_key {
     __be32 src_ip;
     __be32 dst_ip;
     __be16 src_port;
     __be16 dst_port;
-    __be32 seq_num;
-    __be32 ack_num;
-    u8 state;               // 0: Closed, 1: Syn-Sent, 2: Established, etc.
-    u64 last_seen;
-    struct hlist_node hash_node;
 };
 
-// Configuration structure
+struct ull_tcp_conn {
+    struct rhash_head node;
+    struct nanonet_conn_key key;
+    u32 seq_num;
+    u32 ack_num;
+    u8 state;               // 0: Closed, 1: Syn-Sent, 2: Established, 3: Closing
+    bool dead;              // Unlinked; the expiry timer must not re-arm
+    unsigned long last_seen;
+    struct timer_list timer;
+    struct ull_tcp_conn *reap_next;
+    struct rcu_head rcu;
+};
+
+// Configuration structure (NANONET_IOC_SET_CONFIG / GET_CONFIG). The layout
+// is shared with the user-space tools, so only fixed-size fields.
 struct ull_config {
-    bool enabled;
+    __u32 enabled;
     __be32 target_ip;
     __be16 target_port;
     __u8 protocol;          // IPPROTO_TCP or IPPROTO_UDP
     __be32 response_ip;
     __be16 response_port;
-    __be32 seq_num;
     __u8 application_logic_type;
-    bool multicast;
+    __u32 multicast;
     __be32 multicast_group;
+    __u32 ingress_ifindex;  // Only ticks received on this device; 0 = any
+    __u32 egress_ifindex;   // Device orders leave from; 0 = the ifname parameter
+};
+
+// Flow classification rule (NANONET_IOC_ADD_FLOW / DEL_FLOW). Ticks are
+// matched on (dst_ip, dst_port, protocol); dst_ip may be a multicast group.
+// Orders go from response_ip:response_port to order_ip:order_port, or back to
+// dst_ip:dst_port when order_ip is 0. ingress_ifindex and egress_ifindex
+// bind the rule to NICs as in ull_config. Layout shared with the tools.
+struct nanonet_flow_rule {
+    __be32 dst_ip;
+    __be16 dst_port;
+    __u8 protocol;
+    __u8 application_logic_type;
+    __be32 response_ip;
+    __be16 response_port;
+    __be16 order_port;
+    __be32 order_ip;
+    __u8 decoder;           // NANONET_DECODER_*
+    __u8 channel;           // Arbitration channel, 0 = none (MoldUDP64 only)
+    __u8 line;              // NANONET_LINE_A or NANONET_LINE_B within the channel
+    __u8 reserved;
+    __u32 ingress_ifindex;
+    __u32 egress_ifindex;
+};
+
+// Payload framing of a flow
+#define NANONET_DECODER_RAW 0          // One struct market_data per packet
+#define NANONET_DECODER_MOLDUDP64 1    // MoldUDP64 bundle of ITCH-style messages
+#define NANONET_DECODER_MAX 2
+
+// A/B line arbitration: rules sharing a channel carry the same sequenced
+// feed. The first copy of each sequence number is decoded and later copies
+// are dropped, even when one line fills in behind the other. Sequence
+// numbers neither line delivered within the last NANONET_ARB_WINDOW are
+// counted as gaps.
+#define NANONET_MAX_CHANNELS 64
+#define NANONET_ARB_WINDOW 2048        // Power of two
+#define NANONET_ARB_BATCH 64           // Messages claimed per channel lock
+#define NANONET_LINE_A 0
+#define NANONET_LINE_B 1
+
+#define NANONET_FLOW_HASH_BITS 10
+#define NANONET_MAX_FLOWS 4096
+
+// Per-symbol strategy parameters (NANONET_IOC_SET_SYMBOL). Layout shared
+// with the tools.
+struct nanonet_symbol_params {
+    char symbol[8];
+    __u32 price_threshold;  // Cents; buy below it, or sell above it
+    __u32 quantity;
+    __u8 side;              // 0 = buy, 1 = sell
+    __u8 enabled;
+    __u16 reserved;
+    __u32 max_position;     // Risk limits; 0 uses the global default
+    __u64 max_notional;
+};
+
+// Pre-trade risk limits (NANONET_IOC_SET_RISK / GET_RISK); 0 disables a
+// limit. Position and notional count every order sent as filled, and apply
+// to each symbol unless the symbol has its own. Orders that reduce the
+// position are exempt from both. Layout shared with the tools.
+struct nanonet_risk_limits {
+    __u32 max_order_quantity;   // Per order
+    __u32 max_orders_per_sec;   // Per flow rule
+    __u32 order_burst;          // Orders a rule may send back to back
+    __u32 max_position;         // Net shares per symbol
+    __u64 max_notional;         // Gross cents per symbol
+};
+
+// Reasons an order is rejected, in the order they are checked
+#define NANONET_RISK_KILLED 0
+#define NANONET_RISK_FORMAT 1
+#define NANONET_RISK_QUANTITY 2
+#define NANONET_RISK_UNKNOWN_SYMBOL 3
+#define NANONET_RISK_POSITION 4
+#define NANONET_RISK_NOTIONAL 5
+#define NANONET_RISK_THROTTLE 6
+#define NANONET_RISK_REASONS 7
+
+// Returned by NANONET_IOC_GET_RISK
+struct nanonet_risk_status {
+    struct nanonet_risk_limits limits;
+    __u32 killed;
+    __u32 reserved;
+    __u64 accepted;
+    __u64 rejected[NANONET_RISK_REASONS];
+};
+
+// Symbol table: open addressing with linear probing over a table sized at
+// load time to stay at most half full, keyed by the 8 symbol bytes as one
+// u64 (0 marks a free slot). One cache line per symbol for the lookup and
+// parameters, which change under the seqlock and are otherwise read-only.
+// The live state and the risk exposure each get a line of their own: any
+// CPU that receives a tick or sends an order for the symbol writes them.
+#define NANONET_SYMBOL_TABLE_BITS 15
+#define NANONET_MAX_SYMBOLS (1 << (NANONET_SYMBOL_TABLE_BITS - 1))
+
+// L2 order book: the best NANONET_BOOK_DEPTH price levels of each side,
+// best first, one cache line per side. Updates come from the tick path on
+// any CPU and serialize on the seqlock; readers copy and retry.
+#define NANONET_BOOK_DEPTH 8
+#define NANONET_BOOK_BID 0
+#define NANONET_BOOK_ASK 1
+
+struct nanonet_book_level {
+    u32 price;
+    u32 quantity;
+};
+
+struct nanonet_book {
+    seqlock_t lock;
+    u8 levels[2];
+    u64 updates;
+    struct nanonet_book_level side[2][NANONET_BOOK_DEPTH] ____cacheline_aligned;
+} ____cacheline_aligned;
+
+// Read-only copy of a book handed to strategies
+struct nanonet_book_view {
+    u8 levels[2];
+    struct nanonet_book_level side[2][NANONET_BOOK_DEPTH];
+};
+
+struct nanonet_symbol {
+    u64 key;
+    seqlock_t lock;
+    u32 price_threshold;
+    u32 quantity;
+    u8 side;
+    u8 enabled;
+
+    struct nanonet_book *book;
+    // Live state. Last price and timestamp are whichever tick was stored
+    // last, and may come from two different ticks under concurrency.
+    u32 last_price ____cacheline_aligned;
+    u64 last_timestamp;
+    atomic64_t ticks;
+    atomic64_t orders;
+    // Risk: limits change under the seqlock, exposure is written by the
+    // order path on any CPU.
+    u32 max_position ____cacheline_aligned;
+    u64 max_notional;
+    atomic64_t position;
+    atomic64_t notional;
+} ____cacheline_aligned;
+
+// Next-hop MAC for one (egress device, next-hop IP), shared by every rule
+// routed through it. Filled from the kernel neighbour table by neighbour
+// events and a background resolver; the send path only reads it.
+#define NANONET_NEIGH_HASH_BITS 8
+#define NANONET_NEIGH_MAX 1024
+
+struct nanonet_neigh {
+    seqlock_t lock;
+    u8 mac[ETH_ALEN];
+    bool valid;
+    u64 updates;
+    __be32 nexthop;
+    u32 ifindex;
+    struct hlist_node node;
+} ____cacheline_aligned;
+
+// Copies the cached MAC into mac. False if the next hop is not resolved.
+static inline bool nanonet_neigh_read(const struct nanonet_neigh *neigh, u8 *mac) {
+    unsigned int seq;
+    bool valid;
+
+    do {
+        seq = read_seqbegin(&neigh->lock);
+        valid = neigh->valid;
+        memcpy(mac, neigh->mac, ETH_ALEN);
+    } while (read_seqretry(&neigh->lock, seq));
+    return valid;
+}
+
+// Ethernet + IP + UDP/TCP headers of every order for one destination,
+// prebuilt when the rule or config changes. The send path copies it and
+// patches tot_len, id and the transport length/sequence, updating the IP
+// checksum incrementally, and the destination MAC from neigh unless the
+// template already carries it (multicast). len is 0 when the rule cannot
+// send.
+#define NANONET_TX_TEMPLATE_SIZE 64
+
+struct nanonet_tx_template {
+    u8 data[NANONET_TX_TEMPLATE_SIZE];
+    u16 len;
+    struct nanonet_neigh *neigh;
+} ____cacheline_aligned;
+
+// Send-side state of one flow rule, written by every CPU that sends on
+// it. The order rate limit is a token bucket in GCRA form: tat is the time
+// (ns) at which the bucket will be full again. tx_seq is the TCP sequence
+// number of the rule's next order; its low 32 bits go on the wire. A
+// rebuilt or replaced rule shares the throttle of the one it replaces,
+// which readers may still be sending on, so it is reference counted.
+struct nanonet_throttle {
+    atomic64_t tat;
+    atomic64_t tx_seq;
+    refcount_t refs;
+} ____cacheline_aligned;
+
+// A device reference held by a published flow or config, and dropped one
+// grace period after it is replaced.
+struct nanonet_dev_ref {
+    struct net_device *dev;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+    netdevice_tracker tracker;
+#endif
+};
+
+// A rule as the packet path uses it. The flow itself is read-only to the
+// packet path; the throttle it points to is not. out is resolved when the
+// flow is built; NULL means its egress device is gone.
+struct nanonet_flow {
+    struct nanonet_flow_rule rule;
+    struct nanonet_throttle *throttle;
+    struct nanonet_tx_template tmpl;
+    struct nanonet_dev_ref out;
+};
+
+// A rule bound to an ingress device only matches ticks received on it.
+static inline bool nanonet_ingress_match(u32 ifindex, const struct sk_buff *skb) {
+    return !ifindex || ifindex == skb->skb_iif;
+}
+
+// Published configuration; immutable once visible to readers. The
+// single-target ull_config doubles as an implicit flow rule.
+struct nanonet_config_snapshot {
+    struct ull_config config;
+    struct nanonet_flow flow;
+    struct rcu_head rcu;
+};
+
+extern struct nanonet_config_snapshot __rcu *nanonet_active_config;
+
+// Packet path only: callers must be inside an RCU read-side section (the
+// netfilter hook is) and must not keep the pointer beyond it.
+static inline const struct nanonet_config_snapshot *nanonet_config_snapshot(void) {
+    return rcu_dereference(nanonet_active_config);
+}
+
+static inline const struct ull_config *nanonet_config(void) {
+    return &nanonet_config_snapshot()->config;
+}
+
+// mmap offsets of the regions of /dev/nanonet
+#define NANONET_MMAP_STATS 0x0ULL             // One read-only page
+#define NANONET_MMAP_INJECT 0x10000000ULL      // Order injection ring
+#define NANONET_MMAP_EVENTS 0x100000000ULL    // + cpu * NANONET_MMAP_EVENT_STRIDE
+#define NANONET_MMAP_EVENT_STRIDE 0x1000000ULL
+#define NANONET_EVENT_RING_MAX 131072          // Records; must fit the stride
+
+// Event rings: one single-producer/single-consumer ring per possible CPU,
+// written by the packet path on that CPU and read by one consumer through
+// mmap. The consumer advances consumer after reading; an event that finds
+// the ring full is counted in dropped and lost. To sleep, the consumer sets
+// NANONET_RING_NEED_WAKEUP, re-checks the ring, then waits in poll() or on
+// the eventfd given with NANONET_IOC_SET_EVENTFD; the next event clears
+// the flag and wakes it. A busy-polling consumer never sets it, and then
+// no event costs a wakeup. Layouts shared with the tools.
+#define NANONET_RING_NEED_WAKEUP 0x1
+
+struct nanonet_event_ring_hdr {
+    __u64 producer;             // Written by the module
+    __u64 dropped;
+    __u32 size;                 // Records, a power of two
+    __u32 cpu;
+    __u32 nr_rings;
+    __u32 reserved[9];
+    __u64 consumer;             // Written by the consumer, own cache line
+    __u32 flags;                // NANONET_RING_NEED_WAKEUP
+    __u32 reserved2[13];
+};
+
+#define NANONET_EVENT_TICK 1        // Decoded market data tick
+#define NANONET_EVENT_ORDER 2       // Order passed risk and was queued
+#define NANONET_EVENT_REJECT 3      // Order rejected; reason is NANONET_RISK_*
+#define NANONET_EVENT_ERROR 4       // Packet path error; reason is the errno
+
+// One cache line. Records follow the header in the mapping.
+struct nanonet_event {
+    __u64 timestamp;            // CLOCK_REALTIME ns when published
+    __u8 type;
+    __u8 side;                  // Orders: 0 = buy, 1 = sell
+    __u16 reason;
+    __u32 quantity;
+    char symbol[8];
+    __u32 price;
+    __be32 flow_ip;             // Feed the event came from
+    __u64 feed_timestamp;       // Ticks: the feed's own timestamp
+    char clOrdId[16];           // Orders
+    __be16 flow_port;
+    __u8 flow_protocol;
+    __u8 reserved[5];
+};
+
+// Order injection ring: the reverse of an event ring. A user-space
+// strategy writes order records and advances producer; the module sends
+// each through the flow it names, with the same risk checks and prebuilt
+// headers as an in-kernel strategy, then advances consumer. The records
+// are drained by a polling kthread (inject_poll) or by the caller of
+// NANONET_IOC_INJECT_KICK. While NANONET_RING_NEED_WAKEUP is set in flags
+// the producer must kick after writing; a busy poller clears it, so orders
+// then cost no syscall. Single producer: writers must serialize in user
+// space. Layouts shared with the tools.
+struct nanonet_inject_ring_hdr {
+    __u64 producer;             // Written by user space
+    __u32 reserved[14];
+    __u64 consumer;             // Written by the module, own cache line
+    __u64 sent;                 // Orders queued for transmit
+    __u64 rejected;             // Refused by the risk checks
+    __u64 failed;               // No such flow, or no skb
+    __u32 size;                 // Records, a power of two
+    __u32 flags;                // NANONET_RING_NEED_WAKEUP
+    __u32 reserved2[6];
+};
+
+// One cache line. The flow is looked up like a received packet's: by the
+// destination of the feed whose order route and limits apply.
+struct nanonet_inject_order {
+    __be32 flow_ip;
+    __be16 flow_port;
+    __u8 flow_protocol;
+    __u8 reserved;
+    struct trading_order order;
+    __u8 reserved2[64 - 8 - sizeof(struct trading_order)];
 };
 
-// Statistics structure
+extern atomic_t nanonet_event_maps;
+extern unsigned int nanonet_event_ring_size;
+extern unsigned int nanonet_inject_ring_size;
+extern bool nanonet_inject_poll;
+extern int nanonet_inject_cpu;
+extern unsigned int nanonet_stats_refresh_ms;
+extern int nanonet_numa_node;
+
+// Ingress attach modes (NANONET_IOC_SET_INGRESS_MODE)
+#define NANONET_INGRESS_NONE 0
+#define NANONET_INGRESS_NETFILTER 1
+#define NANONET_INGRESS_XDP 2
+
+extern char *nanonet_ifname;
+extern int nanonet_ifindex;
+extern bool nanonet_tx_direct;
+
+// Most orders one tick may queue before they are sent as a burst
+#define NANONET_TX_BURST 16
+
+// Statistics snapshot returned by NANONET_IOC_GET_STATS (merged from per-CPU counters)
 struct ull_stats {
-    atomic64_t packets_processed;
-    atomic64_t packets_bypassed;
-    atomic64_t responses_sent;
-    atomic64_t errors;
+    __u64 packets_processed;
+    __u64 packets_bypassed;
+    __u64 responses_sent;
+    __u64 errors;
+    __u64 last_process_time_ns;
+    __u64 min_process_time_ns;
+    __u64 max_process_time_ns;
+    __u64 avg_process_time_ns;
+    __s64 connections_active;
+    __u64 connections_dropped;
+    __u64 connections_evicted;
+};
+
+// Statistics page: the aggregated counters and latency summary, rewritten
+// by the module every refresh_ms while anything has it mapped. seq is odd
+// during a rewrite; a reader copies the page and retries unless seq was
+// even and unchanged on both sides of the copy.
+struct nanonet_stats_page {
+    __u32 seq;
+    __u32 refresh_ms;
+    __u64 updated_ns;           // CLOCK_REALTIME of the last rewrite
+    struct ull_stats stats;
+    __u64 latency_count;
+    __u64 latency_p50_ns;
+    __u64 latency_p99_ns;
+    __u64 latency_p999_ns;
+    __u64 orders_accepted;
+    __u64 orders_rejected;
+    __u32 killed;
+    __u32 reserved;
+};
+
+// Log-linear latency histogram: 16 linear sub-buckets per power of two,
+// so every bucket is within 6.25% of the recorded value up to ~68 s.
+#define NANONET_HIST_SUB_BITS 4
+#define NANONET_HIST_SUB_COUNT (1 << NANONET_HIST_SUB_BITS)
+#define NANONET_HIST_MAX_EXP 35
+#define NANONET_HIST_BUCKETS ((NANONET_HIST_MAX_EXP - NANONET_HIST_SUB_BITS + 2) << NANONET_HIST_SUB_BITS)
+
+// Returned by NANONET_IOC_GET_HISTOGRAM
+struct ull_latency_histogram {
+    __u64 count;
+    __u64 min_ns;
+    __u64 max_ns;
+    __u64 avg_ns;
+    __u64 p50_ns;
+    __u64 p99_ns;
+    __u64 p999_ns;
+    __u64 buckets[NANONET_HIST_BUCKETS];
+};
+
+// Per-CPU counters, written only by the owning CPU from the packet path.
+// NANONET_IOC_RESET_STATS bumps nanonet_stats_epoch and each CPU clears its
+// own counters the next time it records; readers skip CPUs still on an old
+// epoch and redo a pass that a reset overlapped.
+struct nanonet_cpu_stats {
+    unsigned int epoch;
+    u64 packets_processed;
+    u64 packets_bypassed;
+    u64 responses_sent;
+    u64 errors;
     u64 last_process_time_ns;
     u64 min_process_time_ns;
     u64 max_process_time_ns;
-    u64 avg_process_time_ns;
-    atomic64_t connections_active;
-    atomic64_t connections_dropped;
-};
+    u64 total_process_time_ns;
+    u64 latency_hist[NANONET_HIST_BUCKETS];
+    // Gauges survive a reset; inc and dec may land on different CPUs.
+    s64 connections_active;
+    u64 connections_dropped;
+    u64 connections_evicted;
+} ____cacheline_aligned;
+
+DECLARE_PER_CPU_ALIGNED(struct nanonet_cpu_stats, nanonet_cpu_stats);
+extern unsigned int nanonet_stats_epoch;
+
+void nanonet_stats_reset_local(struct nanonet_cpu_stats *st);
+
+// Callers run with BHs disabled (softirq or local_bh_disable()).
+static inline struct nanonet_cpu_stats *nanonet_stats_this_cpu(void) {
+    struct nanonet_cpu_stats *st = this_cpu_ptr(&nanonet_cpu_stats);
+
+    if (unlikely(st->epoch != READ_ONCE(nanonet_stats_epoch))) {
+        nanonet_stats_reset_local(st);
+    }
+    return st;
+}
+
+static inline unsigned int nanonet_hist_index(u64 ns) {
+    unsigned int exp;
+
+    if (ns < NANONET_HIST_SUB_COUNT) {
+        return ns;
+    }
+    if (unlikely(ns >> (NANONET_HIST_MAX_EXP + 1))) {
+        return NANONET_HIST_BUCKETS - 1;
+    }
+
+    exp = fls64(ns) - 1;
+    return ((exp - NANONET_HIST_SUB_BITS + 1) << NANONET_HIST_SUB_BITS) +
+           ((ns >> (exp - NANONET_HIST_SUB_BITS)) & (NANONET_HIST_SUB_COUNT - 1));
+}
+
+static inline void nanonet_stats_record_latency(struct nanonet_cpu_stats *st, u64 ns) {
+    st->last_process_time_ns = ns;
+    st->total_process_time_ns += ns;
+    if (ns < st->min_process_time_ns) {
+        st->min_process_time_ns = ns;
+    }
+    if (ns > st->max_process_time_ns) {
+        st->max_process_time_ns = ns;
+    }
+    st->latency_hist[nanonet_hist_index(ns)]++;
+}
+
+#define NANONET_STAT_INC(field) (nanonet_stats_this_cpu()->field++)
 
 // Function prototypes
 int ull_parse_packet(struct sk_buff *skb, struct ull_iphdr **ip_hdr, struct ull_tcphdr **tcp_hdr, struct ull_udphdr **udp_hdr,
@@ -100,20 +538,174 @@ int ull_parse_packet(struct sk_buff *skb, struct ull_iphdr **ip_hdr, struct ull_
 __sum16 nanonet_compute_checksum(void *data, int len);
 int nanonet_validate_packet(struct sk_buff *skb, struct ull_iphdr *ip_hdr);
 int nanonet_check_permissions(void);
-int nanonet_validate_config(struct ull_config *config);
+int nanonet_validate_config(const struct ull_config *config);
+int nanonet_validate_flow_rule(const struct nanonet_flow_rule *rule);
 int nanonet_track_tcp_connection(struct ull_iphdr *ip_hdr, struct ull_tcphdr *tcp_hdr);
 void nanonet_clear_tcp_connections(void);
+int nanonet_conn_init(void);
+void nanonet_conn_cleanup(void);
+void nanonet_conn_show(struct seq_file *m);
 void nanonet_log_error(const char *fmt, ...);
-int nanonet_process_application_logic(void *payload, int payload_len, struct ull_config *config);
-int nanonet_send_response(struct sk_buff *orig_skb, void *response_data, int response_len,
-                         struct ull_config *config);
-void nanonet_set_cpu_affinity(void);
+int nanonet_process_application_logic(void *payload, int payload_len, const struct nanonet_flow *flow);
+int nanonet_send_response(void *response_data, int response_len, const struct nanonet_flow *flow);
+struct sk_buff *nanonet_response_begin(int response_len, const struct nanonet_flow *flow, void **payload);
+int nanonet_response_finish(struct sk_buff *skb, int response_len, const struct nanonet_flow *flow);
+void nanonet_tx_template_build(struct nanonet_tx_template *tmpl, const struct nanonet_flow_rule *rule,
+                               struct net_device *dev);
+extern unsigned long long nanonet_order_id_seed;
+void nanonet_order_ids_init(void);
+struct nanonet_strategy *nanonet_strategy_get(u8 id);
+int nanonet_feed_decode(void *payload, int payload_len, const struct nanonet_flow *flow);
+void nanonet_feed_show(struct seq_file *m);
+u64 nanonet_arb_claim(const struct nanonet_flow_rule *rule, const char *session, u64 seq, u16 count);
+int nanonet_arb_init(void);
+void nanonet_arb_cleanup(void);
+void nanonet_arb_show(struct seq_file *m);
+int nanonet_risk_check(const void *order, int order_len, const struct nanonet_flow *flow);
+void nanonet_risk_set_limits(const struct nanonet_risk_limits *limits);
+void nanonet_risk_get_status(struct nanonet_risk_status *status);
+void nanonet_risk_kill(bool killed);
+void nanonet_risk_reset(void);
+void nanonet_risk_show(struct seq_file *m);
+int nanonet_throttle_init(struct nanonet_flow *flow);
+void nanonet_throttle_inherit(struct nanonet_flow *to, const struct nanonet_flow *from);
+void nanonet_throttle_release(struct nanonet_flow *flow);
+void nanonet_symbols_reset_exposure(void);
+int nanonet_events_init(void);
+void nanonet_events_cleanup(void);
+void nanonet_event_publish(u8 type, u16 reason, const void *data, const struct nanonet_flow *flow);
+int nanonet_events_mmap(struct vm_area_struct *vma, unsigned long ring);
+__poll_t nanonet_events_poll(struct file *file, struct poll_table_struct *wait);
+int nanonet_events_set_eventfd(int fd);
+void nanonet_events_show(struct seq_file *m);
+int nanonet_inject_init(void);
+void nanonet_inject_cleanup(void);
+int nanonet_inject_mmap(struct vm_area_struct *vma);
+int nanonet_inject_kick(void);
+void nanonet_inject_show(struct seq_file *m);
+int nanonet_stats_page_init(void);
+void nanonet_stats_page_cleanup(void);
+int nanonet_stats_page_mmap(struct vm_area_struct *vma);
+
+// Publishing costs one atomic_read while no consumer has the rings mapped.
+static inline void nanonet_event(u8 type, u16 reason, const void *data, const struct nanonet_flow *flow) {
+    if (unlikely(atomic_read(&nanonet_event_maps))) {
+        nanonet_event_publish(type, reason, data, flow);
+    }
+}
+
+// RX workers (rx_worker_cpus): the hook queues each classified tick on its
+// CPU's ring and returns; kthreads pinned to the listed CPUs poll the rings
+// and run nanonet_process_packet(). Each ring has exactly one worker.
+#define NANONET_RX_RING_SIZE 1024
+
+extern bool nanonet_rx_workers;
+extern char *nanonet_rx_worker_cpus;
+
+static inline bool nanonet_rx_workers_active(void) {
+    return READ_ONCE(nanonet_rx_workers);
+}
+
+unsigned int nanonet_process_packet(struct sk_buff *skb, const struct nanonet_flow *flow, u64 start_time);
+void nanonet_rx_enqueue(struct sk_buff *skb, u64 start_time);
+int nanonet_rx_workers_init(void);
+void nanonet_rx_workers_cleanup(void);
+void nanonet_rx_workers_show(struct seq_file *m);
+
+// NAPI busy polling (busy_poll_cpu). While the poller is idle the hook
+// wakes it with the first tick it sees.
+#define NANONET_BUSY_POLL_OFF 0
+#define NANONET_BUSY_POLL_IDLE 1
+#define NANONET_BUSY_POLL_BUSY 2
+
+extern int nanonet_busy_poll_state;
+DECLARE_PER_CPU(u64, nanonet_busy_poll_ticks);
+extern int nanonet_busy_poll_cpu;
+extern unsigned int nanonet_busy_poll_idle_us;
+extern unsigned int nanonet_busy_poll_budget;
+
+void nanonet_busy_poll_wake(const struct sk_buff *skb);
+int nanonet_busy_poll_init(void);
+void nanonet_busy_poll_cleanup(void);
+void nanonet_busy_poll_show(struct seq_file *m);
+
+// Every tick the hook accepts, whether it is processed inline or handed
+// to an RX worker, counts as activity for the poller on this CPU.
+static inline void nanonet_busy_poll_note(const struct sk_buff *skb) {
+    int state = READ_ONCE(nanonet_busy_poll_state);
+
+    if (state == NANONET_BUSY_POLL_OFF) {
+        return;
+    }
+    this_cpu_inc(nanonet_busy_poll_ticks);
+    if (unlikely(state == NANONET_BUSY_POLL_IDLE)) {
+        nanonet_busy_poll_wake(skb);
+    }
+}
+
+int nanonet_mc_join(__be32 group, u32 ifindex);
+void nanonet_mc_leave(__be32 group, u32 ifindex);
+void nanonet_mc_rejoin(void);
+void nanonet_strategy_config(const struct nanonet_flow_rule *rule);
+int nanonet_strategy_id(const char *name);
+void nanonet_strategy_show(struct seq_file *m);
+int nanonet_builtin_strategies_init(void);
+void nanonet_builtin_strategies_cleanup(void);
 int nanonet_parse_packet_optimized(struct sk_buff *skb, struct ull_iphdr **ip_hdr,
                                   void **payload, int *payload_len);
+void *nanonet_vmalloc_user_node(size_t size, int node);
+void nanonet_numa_show(struct seq_file *m);
 int nanonet_init_response_pool(void);
 void nanonet_cleanup_response_pool(void);
-struct sk_buff *nanonet_get_response_skb(void);
+struct sk_buff *nanonet_get_response_skb(unsigned int len);
+void nanonet_track_response_skb(struct sk_buff *skb);
+void nanonet_response_pool_show(struct seq_file *m);
 int nanonet_raw_send(struct sk_buff *skb, struct net_device *dev);
+void nanonet_tx_queue(struct sk_buff *skb);
+void nanonet_tx_flush(void);
+void nanonet_tx_show(struct seq_file *m);
+extern struct mutex nanonet_ingress_mode_lock;
+u32 nanonet_get_ingress_mode(void);
+int nanonet_set_ingress_mode(u32 mode);
+int nanonet_config_init(void);
+void nanonet_config_cleanup(void);
+int nanonet_config_publish(const struct ull_config *config);
+void nanonet_config_copy(struct ull_config *out);
+const struct nanonet_flow *nanonet_flow_lookup(__be32 dst_ip, __be16 dst_port, __u8 protocol);
+const struct nanonet_flow *nanonet_flow_classify(struct sk_buff *skb,
+                                                 const struct nanonet_config_snapshot *snap);
+int nanonet_flow_add(const struct nanonet_flow_rule *rule);
+int nanonet_flow_del(const struct nanonet_flow_rule *rule);
+void nanonet_flow_clear(void);
+void nanonet_flow_show(struct seq_file *m);
+void nanonet_flow_refresh(void);
+void nanonet_config_refresh(void);
+int nanonet_dev_hold(struct nanonet_dev_ref *ref, u32 ifindex);
+void nanonet_dev_release(struct nanonet_dev_ref *ref);
+bool nanonet_dev_stale(const struct nanonet_flow *flow);
+int nanonet_dev_check(u32 ifindex);
+void nanonet_dev_name(u32 ifindex, char *name);
+int nanonet_netdev_init(void);
+void nanonet_netdev_cleanup(void);
+struct nanonet_neigh *nanonet_neigh_get(struct net_device *dev, __be32 daddr);
+void nanonet_neigh_miss(void);
+int nanonet_neigh_init(void);
+void nanonet_neigh_cleanup(void);
+void nanonet_neigh_show(struct seq_file *m);
+struct nanonet_book *nanonet_book_alloc(void);
+void nanonet_book_free(struct nanonet_book *book);
+void nanonet_book_show(struct seq_file *m, const struct nanonet_book *book);
+int nanonet_symbols_init(void);
+void nanonet_symbols_cleanup(void);
+int nanonet_symbol_set(const struct nanonet_symbol_params *params);
+void nanonet_symbols_clear(void);
+void nanonet_symbols_show(struct seq_file *m);
+unsigned int nanonet_symbols_count(void);
+void nanonet_flow_for_each(void (*fn)(const struct nanonet_flow_rule *rule, void *arg), void *arg);
+void nanonet_stats_init(void);
+void nanonet_stats_reset(void);
+void nanonet_stats_snapshot(struct ull_stats *out);
+int nanonet_stats_histogram(struct ull_latency_histogram *out);
 int nanonet_control_init(void);
 void nanonet_control_cleanup(void);
 int nanonet_debug_init(void);
@@ -0,0 +1,498 @@
+#ifndef __NANONET_PIPELINE_H__
+#define __NANONET_PIPELINE_H__
+
+/*
+ * Packet pipeline shared by the kernel module, the XDP program and the
+ * user-space tools. Everything here works on a raw Ethernet frame described
+ * by [data, data_end), keeps every bounds check in the form the BPF verifier
+ * accepts, and avoids anything that is not available in all three builds.
+ */
+
+#if defined(__KERNEL__)
+#include <linux/types.h>
+#include <asm/byteorder.h>
+#define nn_htons(x) htons(x)
+#define nn_ntohs(x) ntohs(x)
+#define nn_htonl(x) htonl(x)
+#define nn_ntohl(x) ntohl(x)
+#elif defined(__bpf__)
+#include <linux/types.h>
+#include <bpf/bpf_endian.h>
+#define nn_htons(x) bpf_htons(x)
+#define nn_ntohs(x) bpf_ntohs(x)
+#define nn_htonl(x) bpf_htonl(x)
+#define nn_ntohl(x) bpf_ntohl(x)
+#else
+#include <linux/types.h>
+#include <arpa/inet.h>
+#define nn_htons(x) htons(x)
+#define nn_ntohs(x) ntohs(x)
+#define nn_htonl(x) htonl(x)
+#define nn_ntohl(x) ntohl(x)
+#endif
+
+#define NN_INLINE static inline __attribute__((always_inline))
+#define NN_PACKED __attribute__((packed))
+#ifdef __clang__
+#define NN_UNROLL _Pragma("unroll")
+#else
+#define NN_UNROLL _Pragma("GCC unroll 16")
+#endif
+
+#define NANONET_ETH_ALEN 6
+#define NANONET_ETH_P_IP 0x0800
+#define NANONET_IPPROTO_TCP 6
+#define NANONET_IPPROTO_UDP 17
+#define NANONET_IP_DF 0x4000
+
+// Ethernet header
+struct ull_ethhdr {
+    unsigned char h_dest[NANONET_ETH_ALEN];
+    unsigned char h_source[NANONET_ETH_ALEN];
+    __be16 h_proto;
+} NN_PACKED;
+
+// IP header (simplified)
+struct ull_iphdr {
+    __u8 version_ihl;
+    __u8 tos;
+    __be16 tot_len;
+    __be16 id;
+    __be16 frag_off;
+    __u8 ttl;
+    __u8 protocol;
+    __sum16 check;
+    __be32 saddr;
+    __be32 daddr;
+} NN_PACKED;
+
+// TCP header (simplified)
+struct ull_tcphdr {
+    __be16 source;
+    __be16 dest;
+    __be32 seq;
+    __be32 ack_seq;
+    __u16 res1:4, doff:4, fin:1, syn:1, rst:1, psh:1, ack:1, urg:1, ece:1, cwr:1;
+    __be16 window;
+    __sum16 check;
+    __be16 urg_ptr;
+} NN_PACKED;
+
+// UDP header
+struct ull_udphdr {
+    __be16 source;
+    __be16 dest;
+    __be16 len;
+    __sum16 check;
+} NN_PACKED;
+
+// Market data tick as published by the feed
+struct market_data {
+    char symbol[8];
+    __u32 price;        // Price in cents
+    __u32 quantity;
+    __u64 timestamp;
+} NN_PACKED;
+
+// MoldUDP64 downstream packet: this header, then msg_count messages, each
+// a big-endian 16-bit length followed by that many bytes. msg_count 0 is a
+// heartbeat and 0xFFFF marks the end of the session.
+struct nanonet_moldudp64_hdr {
+    char session[10];
+    __be64 seq;         // Sequence number of the first message
+    __be16 msg_count;
+} NN_PACKED;
+
+#define NANONET_MOLDUDP64_END_OF_SESSION 0xFFFF
+
+// ITCH-style message types carried in MoldUDP64 bundles. The first byte of
+// each message is the type; the body follows, little-endian like the
+// single-tick feed.
+#define NANONET_MSG_TICK 'T'      // Body: struct market_data
+#define NANONET_MSG_LEVEL 'L'     // Body: struct nanonet_level_msg
+
+// L2 price level update: set the level to quantity, 0 deletes it
+struct nanonet_level_msg {
+    char symbol[8];
+    __u8 side;          // 'B' bid or 'S' ask
+    __u32 price;
+    __u32 quantity;
+} NN_PACKED;
+
+// Order emitted in response to a tick
+struct trading_order {
+    char symbol[8];
+    __u32 price;
+    __u32 quantity;
+    __u8 side;          // 0 = buy, 1 = sell
+    __u64 timestamp;
+    char clOrdId[16];   // Client order ID
+} NN_PACKED;
+
+#define NANONET_ORDER_PRICE_THRESHOLD 10000   // $100.00
+#define NANONET_ORDER_QUANTITY 100
+#define NANONET_ORDER_ID_DIGITS 12
+
+enum nanonet_parse_result {
+    NANONET_PARSE_OK = 0,
+    NANONET_PARSE_TRUNCATED = 1,
+    NANONET_PARSE_NOT_IPV4 = 2,
+    NANONET_PARSE_BAD_HEADER = 3,
+    NANONET_PARSE_UNSUPPORTED_L4 = 4,
+};
+
+struct nanonet_frame {
+    struct ull_ethhdr *eth;
+    struct ull_iphdr *ip;
+    struct ull_tcphdr *tcp;
+    struct ull_udphdr *udp;
+    void *payload;
+    int payload_len;
+    int ip_hdr_len;
+};
+
+// Returns 0 or a negative enum nanonet_parse_result.
+NN_INLINE int nanonet_parse_frame(void *data, void *data_end, struct nanonet_frame *f) {
+    struct ull_ethhdr *eth = data;
+    struct ull_iphdr *ip;
+    void *l4;
+    int ip_hdr_len, l4_hdr_len, ip_payload_len;
+
+    f->tcp = 0;
+    f->udp = 0;
+    f->payload = 0;
+    f->payload_len = 0;
+
+    if ((void *)(eth + 1) > data_end) {
+        return -NANONET_PARSE_TRUNCATED;
+    }
+    f->eth = eth;
+    if (eth->h_proto != nn_htons(NANONET_ETH_P_IP)) {
+        return -NANONET_PARSE_NOT_IPV4;
+    }
+
+    ip = (void *)(eth + 1);
+    if ((void *)(ip + 1) > data_end) {
+        return -NANONET_PARSE_TRUNCATED;
+    }
+    f->ip = ip;
+    if ((ip->version_ihl >> 4) != 4) {
+        return -NANONET_PARSE_NOT_IPV4;
+    }
+
+    ip_hdr_len = (ip->version_ihl & 0x0F) * 4;
+    if (ip_hdr_len < (int)sizeof(struct ull_iphdr)) {
+        return -NANONET_PARSE_BAD_HEADER;
+    }
+    f->ip_hdr_len = ip_hdr_len;
+    l4 = (void *)ip + ip_hdr_len;
+
+    switch (ip->protocol) {
+        case NANONET_IPPROTO_TCP:
+            f->tcp = l4;
+            if ((void *)(f->tcp + 1) > data_end) {
+                return -NANONET_PARSE_TRUNCATED;
+            }
+            l4_hdr_len = f->tcp->doff * 4;
+            if (l4_hdr_len < (int)sizeof(struct ull_tcphdr)) {
+                return -NANONET_PARSE_BAD_HEADER;
+            }
+            break;
+
+        case NANONET_IPPROTO_UDP:
+            f->udp = l4;
+            if ((void *)(f->udp + 1) > data_end) {
+                return -NANONET_PARSE_TRUNCATED;
+            }
+            l4_hdr_len = sizeof(struct ull_udphdr);
+            break;
+
+        default:
+            return -NANONET_PARSE_UNSUPPORTED_L4;
+    }
+
+    f->payload = l4 + l4_hdr_len;
+    if (f->payload > data_end) {
+        f->payload = 0;
+        return -NANONET_PARSE_TRUNCATED;
+    }
+
+    // Ethernet pads short frames, so trust tot_len over the frame length.
+    f->payload_len = data_end - f->payload;
+    ip_payload_len = (int)nn_ntohs(ip->tot_len) - ip_hdr_len - l4_hdr_len;
+    if (ip_payload_len >= 0 && ip_payload_len < f->payload_len) {
+        f->payload_len = ip_payload_len;
+    }
+
+    return NANONET_PARSE_OK;
+}
+
+NN_INLINE int nanonet_frame_matches(const struct nanonet_frame *f, __be32 target_ip, __be16 target_port,
+                                    __u8 protocol, int multicast, __be32 multicast_group) {
+    if (f->ip->daddr != target_ip && (!multicast || f->ip->daddr != multicast_group)) {
+        return 0;
+    }
+    if (f->ip->protocol != protocol) {
+        return 0;
+    }
+    if (protocol == NANONET_IPPROTO_TCP) {
+        return f->tcp && f->tcp->dest == target_port;
+    }
+    return f->udp && f->udp->dest == target_port;
+}
+
+// "ORD" + fixed-width decimal + NUL, no printf machinery required
+NN_INLINE void nanonet_format_order_id(char *id, __u64 n) {
+    int i;
+
+    id[0] = 'O';
+    id[1] = 'R';
+    id[2] = 'D';
+    NN_UNROLL
+    for (i = 3 + NANONET_ORDER_ID_DIGITS - 1; i >= 3; i--) {
+        id[i] = '0' + (n % 10);
+        n /= 10;
+    }
+    id[3 + NANONET_ORDER_ID_DIGITS] = '\0';
+}
+
+// Preformatted order ID generator: "ORD" + 3-digit instance (CPU or queue)
+// + 9-digit sequence. Each ID is a 16-byte copy plus a decimal increment in
+// place, so unique IDs cost no division and no formatting. One generator
+// per CPU or thread; instances keep the sequences disjoint.
+//
+// The sequence starts at the seed modulo 10^9. Seeding from the clock in
+// milliseconds (nanonet_order_id_clock_seed) keeps a restarted generator
+// clear of its predecessor's IDs, provided the predecessor averaged fewer
+// than 1000 orders per second per instance and ran less than the 11.5
+// days the sequence takes to wrap. Faster senders need an explicit seed
+// past the last ID they used.
+#define NANONET_ORDER_ID_INSTANCE_DIGITS 3
+
+NN_INLINE __u64 nanonet_order_id_clock_seed(__u64 realtime_ns) {
+    return realtime_ns / 1000000;
+}
+
+struct nanonet_order_id_gen {
+    char id[16];
+};
+
+NN_INLINE void nanonet_order_id_init(struct nanonet_order_id_gen *g, __u32 instance, __u64 seed) {
+    char tmp[16];
+    int i;
+
+    // Instance in the top digits, seed below.
+    nanonet_format_order_id(tmp, instance);
+    nanonet_format_order_id(g->id, seed);
+    for (i = 0; i < NANONET_ORDER_ID_INSTANCE_DIGITS; i++) {
+        g->id[3 + i] = tmp[3 + NANONET_ORDER_ID_DIGITS - NANONET_ORDER_ID_INSTANCE_DIGITS + i];
+    }
+}
+
+NN_INLINE void nanonet_order_id_next(struct nanonet_order_id_gen *g, char *out) {
+    int i;
+
+    __builtin_memcpy(out, g->id, sizeof(g->id));
+    for (i = 3 + NANONET_ORDER_ID_DIGITS - 1; i >= 3 + NANONET_ORDER_ID_INSTANCE_DIGITS; i--) {
+        if (g->id[i] != '9') {
+            g->id[i]++;
+            return;
+        }
+        g->id[i] = '0';
+    }
+}
+
+// Threshold strategy: bid one cent over any tick below $100.00.
+NN_INLINE int nanonet_market_data_triggers(const struct market_data *market) {
+    return market->price < NANONET_ORDER_PRICE_THRESHOLD;
+}
+
+// Fills everything but clOrdId; order may point straight into a TX buffer.
+NN_INLINE void nanonet_market_data_fill(const struct market_data *market, struct trading_order *order,
+                                        __u64 timestamp) {
+    __builtin_memcpy(order->symbol, market->symbol, sizeof(order->symbol));
+    order->price = market->price + 1;   // Bid 1 cent higher
+    order->quantity = NANONET_ORDER_QUANTITY;
+    order->side = 0;                    // Buy
+    order->timestamp = timestamp;
+}
+
+// Strategy + timestamp-derived order ID, for paths without an ID generator.
+NN_INLINE int nanonet_market_data_order(const struct market_data *market, struct trading_order *order,
+                                        __u64 timestamp) {
+    if (!nanonet_market_data_triggers(market)) {
+        return 0;
+    }
+
+    nanonet_market_data_fill(market, order, timestamp);
+    nanonet_format_order_id(order->clOrdId, timestamp);
+    return 1;
+}
+
+NN_INLINE __sum16 nanonet_ip_header_checksum(const void *ip) {
+    const __u16 *p = ip;
+    __u32 sum = 0;
+    int i;
+
+    NN_UNROLL
+    for (i = 0; i < (int)(sizeof(struct ull_iphdr) / 2); i++) {
+        sum += p[i];
+    }
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return (__sum16)~sum;
+}
+
+// Ones'-complement sum of [data, data + len) added to sum, 8 bytes per step.
+// A 64-bit accumulator absorbs the carries of 32-bit words, so the loop has
+// no carry handling; fold the result with nanonet_csum_fold(). For user
+// space; the kernel has csum_partial() and BPF has bpf_csum_diff().
+NN_INLINE __u64 nanonet_csum_add(const void *data, int len, __u64 sum) {
+    const unsigned char *p = data;
+    __u32 w[2];
+    __u16 h;
+
+    while (len >= 8) {
+        __builtin_memcpy(w, p, 8);
+        sum += (__u64)w[0] + w[1];
+        p += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        __builtin_memcpy(w, p, 4);
+        sum += w[0];
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        __builtin_memcpy(&h, p, 2);
+        sum += h;
+        p += 2;
+        len -= 2;
+    }
+    if (len) {
+        // The odd byte is the first of a 16-bit word in network order
+        h = 0;
+        __builtin_memcpy(&h, p, 1);
+        sum += h;
+    }
+    return sum;
+}
+
+NN_INLINE __sum16 nanonet_csum_fold(__u64 sum) {
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (__sum16)~sum;
+}
+
+// Turn a parsed UDP frame around in place so that it carries payload_len
+// bytes back to the sender from response_ip:response_port. The frame must
+// have an option-less IP header. h_source is the MAC of the interface the
+// order leaves on: the tick's own destination MAC may be a multicast one.
+NN_INLINE void nanonet_reflect_udp_headers(struct nanonet_frame *f, const unsigned char *h_source,
+                                           __be32 response_ip, __be16 response_port, int payload_len) {
+    __builtin_memcpy(f->eth->h_dest, f->eth->h_source, NANONET_ETH_ALEN);
+    __builtin_memcpy(f->eth->h_source, h_source, NANONET_ETH_ALEN);
+
+    f->ip->version_ihl = 0x45;
+    f->ip->tos = 0;
+    f->ip->tot_len = nn_htons(sizeof(struct ull_iphdr) + sizeof(struct ull_udphdr) + payload_len);
+    f->ip->id = 0;
+    f->ip->frag_off = nn_htons(NANONET_IP_DF);
+    f->ip->ttl = 64;
+    f->ip->daddr = f->ip->saddr;
+    f->ip->saddr = response_ip;
+    f->ip->check = 0;
+    f->ip->check = nanonet_ip_header_checksum(f->ip);
+
+    f->udp->dest = f->udp->source;
+    f->udp->source = response_port;
+    f->udp->len = nn_htons(sizeof(struct ull_udphdr) + payload_len);
+    f->udp->check = 0;
+}
+
+// XDP program configuration, mirrored from the module by `nanonet_xdp sync`.
+// Orders sent from XDP or AF_XDP never reach nanonet_risk_check(), so the
+// kill switch, order quantity and order rate are mirrored here as well, by
+// `nanonet_xdp sync` and whenever nanonet_control changes them.
+struct nanonet_xdp_config {
+    __u32 enabled;
+    __be32 target_ip;
+    __be32 multicast_group;
+    __be32 response_ip;
+    __be16 target_port;
+    __be16 response_port;
+    __u8 protocol;
+    __u8 multicast;
+    __u8 xsk;                   // Hand matching frames to the AF_XDP engine
+    __u8 pad;
+    __u32 redirect_ifindex;     // 0: XDP_TX back out of the ingress port
+    unsigned char h_source[NANONET_ETH_ALEN];   // MAC of the port orders leave on
+    __u8 pad2[2];
+    __u32 killed;               // Kill switch: matching frames go up the stack
+    __u32 max_order_quantity;   // 0: no limit
+    __u32 pad3;
+    __u64 interval_ns;          // Between orders at max_orders_per_sec, 0: no limit
+    __u64 tolerance_ns;         // How far ahead of that rate a burst may run
+};
+
+// Rate limit as nanonet_risk_set_limits() derives it from the module's
+// limits. For the tools; the XDP program only reads the result.
+NN_INLINE void nanonet_xdp_set_rate(struct nanonet_xdp_config *cfg, __u32 max_orders_per_sec, __u32 order_burst) {
+    cfg->interval_ns = 0;
+    cfg->tolerance_ns = 0;
+    if (max_orders_per_sec) {
+        cfg->interval_ns = 1000000000ULL / max_orders_per_sec;
+        cfg->tolerance_ns = cfg->interval_ns * (order_burst ? order_burst - 1 : 0);
+    }
+}
+
+#define NANONET_XDP_ADMIT_TRIES 4
+
+// Quantity and rate checks for orders sent without the module, with the
+// same arithmetic as nanonet_risk_check(): the rate is one GCRA bucket
+// whose theoretical arrival time *tat is shared by every CPU. The
+// cmpxchg loop is bounded for the verifier; an order that loses it that
+// many times is rejected.
+NN_INLINE int nanonet_xdp_risk_admit(const struct nanonet_xdp_config *cfg, __u64 *tat, __u32 quantity,
+                                     __u64 now) {
+    __u64 old, cur, start;
+    int i;
+
+    if (cfg->max_order_quantity && quantity > cfg->max_order_quantity) {
+        return 0;
+    }
+    if (!cfg->interval_ns) {
+        return 1;
+    }
+
+    old = *(volatile __u64 *)tat;
+    NN_UNROLL
+    for (i = 0; i < NANONET_XDP_ADMIT_TRIES; i++) {
+        start = old > now ? old : now;
+        if (start - now > cfg->tolerance_ns) {
+            return 0;
+        }
+        cur = __sync_val_compare_and_swap(tat, old, start + cfg->interval_ns);
+        if (cur == old) {
+            return 1;
+        }
+        old = cur;
+    }
+    return 0;
+}
+
+#define NANONET_XSK_MAX_QUEUES 64
+
+struct nanonet_xdp_stats {
+    __u64 packets_processed;
+    __u64 packets_bypassed;
+    __u64 responses_sent;
+    __u64 errors;
+    __u64 orders_rejected;      // By nanonet_xdp_risk_admit()
+};
+
+#endif /* __NANONET_PIPELINE_H__ */
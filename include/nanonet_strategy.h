@@ -0,0 +1,103 @@
+#ifndef __NANONET_STRATEGY_H__
+#define __NANONET_STRATEGY_H__
+
+#include "nanonet.h"
+
+// Strategy registry. A strategy is bound to flow rules through the rule's
+// application_logic_type, which is the strategy ID; user space can also
+// resolve a strategy by name (NANONET_IOC_GET_STRATEGY). Strategies may
+// live in separate modules built against this header and the core's
+// Module.symvers, so they can be replaced without reloading nanonet.
+#define NANONET_MAX_STRATEGIES 256
+#define NANONET_STRATEGY_NAME_LEN 16
+
+struct nanonet_strategy {
+    const char *name;
+    u8 id;
+    size_t state_size;    // Zeroed per-CPU state, 0 for none
+
+    // Process context, after the per-CPU state is allocated and before the
+    // first tick. Optional.
+    int (*init)(struct nanonet_strategy *s);
+
+    // Softirq context, under rcu_read_lock(), with this CPU's state. The
+    // on_* callbacks return the number of orders sent, or a negative errno.
+    // payload points into the packet and must not be kept.
+    //
+    // A struct market_data tick: the whole payload of a raw flow, or one
+    // NANONET_MSG_TICK message of a bundle. payload has no alignment: a
+    // bundled tick follows a 2-byte length and a type byte, and a raw one
+    // the 42 bytes of headers. struct market_data is packed, so its fields
+    // read safely; never cast payload or the address of one of its fields
+    // to an aligned type. Use get_unaligned() instead.
+    int (*on_tick)(void *state, void *payload, int payload_len, const struct nanonet_flow *flow);
+
+    // A NANONET_MSG_LEVEL message has just been applied to sym's book.
+    // Optional.
+    int (*on_book)(void *state, struct nanonet_symbol *sym, const struct nanonet_flow *flow);
+
+    // Any other message of a bundle, type byte first. Optional.
+    int (*on_message)(void *state, const void *msg, int len, const struct nanonet_flow *flow);
+
+    // Process context: a rule bound to this strategy was installed or
+    // changed, or the strategy has just been registered. Optional.
+    void (*on_config)(struct nanonet_strategy *s, const struct nanonet_flow_rule *rule);
+
+    // Process context, after the last tick has returned. Optional.
+    void (*teardown)(struct nanonet_strategy *s);
+
+    // Owned by the core
+    void __percpu *state;
+};
+
+static inline void *nanonet_strategy_state(struct nanonet_strategy *s, int cpu) {
+    return s->state ? per_cpu_ptr(s->state, cpu) : NULL;
+}
+
+int nanonet_strategy_register(struct nanonet_strategy *s);
+void nanonet_strategy_unregister(struct nanonet_strategy *s);
+
+// Helpers for on_tick
+void nanonet_next_order_id(char *out);
+
+// Caller holds rcu_read_lock(). NULL when the symbol has no parameters.
+struct nanonet_symbol *nanonet_symbol_lookup(const char *symbol);
+
+// Consistent copy of a symbol's parameters; never blocks.
+static inline void nanonet_symbol_read(const struct nanonet_symbol *sym, struct nanonet_symbol_params *out) {
+    unsigned int seq;
+
+    do {
+        seq = read_seqbegin(&sym->lock);
+        out->price_threshold = sym->price_threshold;
+        out->quantity = sym->quantity;
+        out->side = sym->side;
+        out->enabled = sym->enabled;
+        out->max_position = sym->max_position;
+        out->max_notional = sym->max_notional;
+    } while (read_seqretry(&sym->lock, seq));
+}
+
+// Order book of a symbol. Levels are set to an absolute quantity; 0
+// deletes the level. Softirq context.
+void nanonet_book_set(struct nanonet_book *book, int side, u32 price, u32 quantity);
+void nanonet_book_clear(struct nanonet_book *book);
+void nanonet_book_read(const struct nanonet_book *book, struct nanonet_book_view *view);
+
+static inline void nanonet_book_delete(struct nanonet_book *book, int side, u32 price) {
+    nanonet_book_set(book, side, price, 0);
+}
+
+// Best bid and ask; a side with no levels reads as price and quantity 0.
+static inline void nanonet_book_top(const struct nanonet_book *book, struct nanonet_book_level *bid,
+                                    struct nanonet_book_level *ask) {
+    unsigned int seq;
+
+    do {
+        seq = read_seqbegin(&book->lock);
+        *bid = book->side[NANONET_BOOK_BID][0];
+        *ask = book->side[NANONET_BOOK_ASK][0];
+    } while (read_seqretry(&book->lock, seq));
+}
+
+#endif // __NANONET_STRATEGY_H__
@@ -0,0 +1,93 @@
+#!/bin/bash
+
+# veth_bench.sh
+# Measures tick-to-order latency over a veth pair in netfilter and XDP ingress
+# modes, and through the AF_XDP user-space engine (xsk).
+#
+# The module runs on the host side of the pair (nn0); ticks are sent and orders
+# captured from a network namespace on the peer side (nn1).
+
+set -e
+
+# Configuration
+NETNS="nanonet-peer"
+HOST_IF="nn0"
+PEER_IF="nn1"
+HOST_IP="10.77.0.1"
+PEER_IP="10.77.0.2"
+TARGET_PORT="8080"
+PACKETS="${PACKETS:-1000}"
+XDP_MODE="${XDP_MODE:-native}"      # native or generic
+MODES="${MODES:-netfilter xdp xsk}"
+
+# Check for root privileges
+if [ "$(id -u)" != "0" ]; then
+    echo "Error: This script must be run as root."
+    exit 1
+fi
+
+for artifact in nanonet.ko tools/nanonet_control tools/nanonet_xdp tools/nanonet_xsk src/nanonet_xdp.bpf.o; do
+    if [ ! -e "$artifact" ]; then
+        echo "Error: $artifact not found. Run 'make all xdp' first."
+        exit 1
+    fi
+done
+
+cleanup() {
+    ip link set dev "$HOST_IF" xdp off 2>/dev/null || true
+    rmmod nanonet 2>/dev/null || true
+    ip link del "$HOST_IF" 2>/dev/null || true
+    ip netns del "$NETNS" 2>/dev/null || true
+}
+trap cleanup EXIT
+
+echo "Creating veth pair $HOST_IF <-> $NETNS/$PEER_IF..."
+cleanup
+ip netns add "$NETNS"
+ip link add "$HOST_IF" type veth peer name "$PEER_IF"
+ip link set "$PEER_IF" netns "$NETNS"
+ip addr add "$HOST_IP/24" dev "$HOST_IF"
+ip link set "$HOST_IF" up
+ip netns exec "$NETNS" ip addr add "$PEER_IP/24" dev "$PEER_IF"
+ip netns exec "$NETNS" ip link set "$PEER_IF" up
+# Native XDP_TX on veth needs NAPI on the receiving peer
+ip netns exec "$NETNS" ethtool -K "$PEER_IF" gro on >/dev/null 2>&1 || true
+
+echo "Loading kernel module on $HOST_IF..."
+insmod nanonet.ko ifname="$HOST_IF"
+./tools/nanonet_control config "$HOST_IP" "$TARGET_PORT" udp
+./tools/nanonet_control enable
+
+for MODE in $MODES; do
+    echo ""
+    echo "=== Ingress mode: $MODE ==="
+    if [ "$MODE" = "xdp" ]; then
+        ./tools/nanonet_xdp attach "$HOST_IF" "$XDP_MODE"
+    elif [ "$MODE" = "xsk" ]; then
+        # veth only supports AF_XDP in copy mode; the module stays out of the way
+        ./tools/nanonet_xdp attach "$HOST_IF" generic
+        ./tools/nanonet_xsk -i "$HOST_IF" -t "$HOST_IP" -p "$TARGET_PORT" &
+        XSK_PID=$!
+        sleep 1
+    fi
+
+    ./tools/nanonet_control reset
+    if ! ip netns exec "$NETNS" python3 tests/test_wire_to_order.py --iface "$PEER_IF" \
+            --ip "$HOST_IP" --port "$TARGET_PORT" --packets "$PACKETS"; then
+        echo "Warning: Wire-to-order test failed in $MODE mode."
+    fi
+
+    if [ "$MODE" = "xdp" ]; then
+        ./tools/nanonet_xdp stats
+        ./tools/nanonet_xdp detach "$HOST_IF"
+    elif [ "$MODE" = "xsk" ]; then
+        kill -INT "$XSK_PID"
+        wait "$XSK_PID" || true
+        ./tools/nanonet_xdp detach "$HOST_IF"
+    else
+        ./tools/nanonet_control stats
+    fi
+done
+
+echo ""
+echo "Benchmark completed."
@@ -0,0 +1,195 @@
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/bitmap.h>
+#include <linux/jhash.h>
+#include <linux/timekeeping.h>
+#include <linux/seq_file.h>
+#include "../include/nanonet.h"
+
+// A/B line arbitration. Both lines of a channel may be received on
+// different CPUs, so each channel keeps a window of the last
+// NANONET_ARB_WINDOW sequence numbers behind the highest one seen, with a
+// bit per number that some copy has delivered. The first copy of a number
+// is decoded and later copies are duplicates, whether it arrives ahead of
+// the other line or fills a hole the other line left. A gap is counted
+// only when the window slides past numbers neither line delivered. The
+// window is updated under the channel lock, once per NANONET_ARB_BATCH
+// messages; per-packet counters are per CPU.
+#define NANONET_ARB_MASK (NANONET_ARB_WINDOW - 1)
+
+struct nanonet_channel {
+    spinlock_t lock;
+    u32 session;                // jhash of the MoldUDP64 session name
+    u64 first_seq;              // Lowest sequence number seen this session
+    u64 next_seq;               // One past the highest; 0 before the first packet
+    u64 gaps;
+    u64 gap_messages;
+    u64 last_gap_seq;
+    u64 last_gap_ns;
+    u64 sessions;
+    unsigned long seen[BITS_TO_LONGS(NANONET_ARB_WINDOW)];
+} ____cacheline_aligned;
+
+struct nanonet_arb_stats {
+    u64 first[2];               // Copies that delivered something, per line
+    u64 late;                   // Messages filled in behind the highest seen
+    u64 duplicates;             // Copies that delivered nothing
+};
+
+// Allocated on the NIC's node; every feed packet on a channel writes it
+static struct nanonet_channel *nanonet_channels;
+
+static DEFINE_PER_CPU(struct nanonet_arb_stats, nanonet_arb_stats[NANONET_MAX_CHANNELS]);
+
+// Lowest sequence number the window still tracks when next is the highest
+static inline u64 nanonet_arb_floor(u64 next) {
+    return next > NANONET_ARB_WINDOW ? next - NANONET_ARB_WINDOW : 0;
+}
+
+// A new session restarts sequence numbers at 1. A copy still in flight
+// from the old session may land in the new one's window; it can at worst
+// be dropped as a duplicate or hide one message of the new session.
+static void nanonet_arb_new_session(struct nanonet_channel *ch, u32 session) {
+    ch->session = session;
+    ch->first_seq = 0;
+    ch->next_seq = 0;
+    bitmap_zero(ch->seen, NANONET_ARB_WINDOW);
+    WRITE_ONCE(ch->sessions, ch->sessions + 1);
+}
+
+// Moves the highest sequence number to end. Numbers that leave the window
+// without either line having delivered them are lost for good.
+static void nanonet_arb_advance(struct nanonet_channel *ch, u64 end) {
+    u64 from = nanonet_arb_floor(ch->next_seq);
+    u64 to = nanonet_arb_floor(end);
+    u64 last = min(to, from + NANONET_ARB_WINDOW);
+    u64 seq, missed = 0, first_missed = 0;
+
+    // Each slot at most once: a jump past the whole window clears it all
+    for (seq = from; seq < last; seq++) {
+        if (seq >= ch->first_seq && (seq >= ch->next_seq || !test_bit(seq & NANONET_ARB_MASK, ch->seen))) {
+            if (!missed++) {
+                first_missed = seq;
+            }
+        }
+        __clear_bit(seq & NANONET_ARB_MASK, ch->seen);
+    }
+    // Never entered the window at all
+    seq = max(last, ch->first_seq);
+    if (to > seq) {
+        if (!missed) {
+            first_missed = seq;
+        }
+        missed += to - seq;
+    }
+    ch->next_seq = end;
+
+    if (unlikely(missed)) {
+        WRITE_ONCE(ch->gaps, ch->gaps + 1);
+        WRITE_ONCE(ch->gap_messages, ch->gap_messages + missed);
+        WRITE_ONCE(ch->last_gap_seq, first_missed);
+        WRITE_ONCE(ch->last_gap_ns, ktime_get_real_ns());
+    }
+}
+
+// Claims messages [seq, seq + count) of a MoldUDP64 packet for the rule's
+// channel, count at most NANONET_ARB_BATCH. Returns a mask with bit i set
+// if message seq + i was not delivered before and is to be decoded. A
+// heartbeat (count 0) only moves the highest sequence number forward.
+u64 nanonet_arb_claim(const struct nanonet_flow_rule *rule, const char *session, u64 seq, u16 count) {
+    struct nanonet_channel *ch = &nanonet_channels[rule->channel];
+    struct nanonet_arb_stats *stats = this_cpu_ptr(&nanonet_arb_stats[rule->channel]);
+    u32 hash = jhash(session, 10, 0);
+    u64 end = seq + count, fresh = 0, prev, floor;
+    int i;
+
+    spin_lock(&ch->lock);
+    if (unlikely(ch->session != hash)) {
+        nanonet_arb_new_session(ch, hash);
+    }
+    if (unlikely(!ch->next_seq)) {
+        ch->first_seq = seq;
+        ch->next_seq = seq;
+    }
+
+    prev = ch->next_seq;
+    if (end > prev) {
+        nanonet_arb_advance(ch, end);
+    }
+    floor = nanonet_arb_floor(ch->next_seq);
+    for (i = 0; i < count; i++) {
+        // Behind the window: already counted as lost, or delivered
+        if (seq + i < floor || __test_and_set_bit((seq + i) & NANONET_ARB_MASK, ch->seen)) {
+            continue;
+        }
+        fresh |= 1ULL << i;
+        if (seq + i < prev) {
+            stats->late++;
+        }
+        if (seq + i < ch->first_seq) {
+            ch->first_seq = seq + i;
+        }
+    }
+    spin_unlock(&ch->lock);
+
+    if (fresh) {
+        stats->first[rule->line]++;
+    } else if (count) {
+        stats->duplicates++;
+    }
+    return fresh;
+}
+
+void nanonet_arb_show(struct seq_file *m) {
+    struct nanonet_channel *ch;
+    struct nanonet_arb_stats *stats, total;
+    int id, cpu;
+
+    seq_printf(m, "\nLine Arbitration:\n");
+    for (id = 1; id < NANONET_MAX_CHANNELS; id++) {
+        ch = &nanonet_channels[id];
+        if (!READ_ONCE(ch->sessions)) {
+            continue;
+        }
+
+        memset(&total, 0, sizeof(total));
+        for_each_possible_cpu(cpu) {
+            stats = per_cpu_ptr(&nanonet_arb_stats[id], cpu);
+            total.first[NANONET_LINE_A] += READ_ONCE(stats->first[NANONET_LINE_A]);
+            total.first[NANONET_LINE_B] += READ_ONCE(stats->first[NANONET_LINE_B]);
+            total.late += READ_ONCE(stats->late);
+            total.duplicates += READ_ONCE(stats->duplicates);
+        }
+
+        seq_printf(m, "Channel %d: next seq %llu, first A %llu, first B %llu, late fills %llu, duplicates %llu, "
+                   "gaps %llu (%llu messages)", id, READ_ONCE(ch->next_seq),
+                   total.first[NANONET_LINE_A], total.first[NANONET_LINE_B], total.late, total.duplicates,
+                   READ_ONCE(ch->gaps), READ_ONCE(ch->gap_messages));
+        if (READ_ONCE(ch->gaps)) {
+            seq_printf(m, ", last at seq %llu (%llu ns)", READ_ONCE(ch->last_gap_seq),
+                       READ_ONCE(ch->last_gap_ns));
+        }
+        seq_putc(m, '\n');
+    }
+}
+
+int nanonet_arb_init(void) {
+    int id;
+
+    nanonet_channels = kcalloc_node(NANONET_MAX_CHANNELS, sizeof(*nanonet_channels), GFP_KERNEL, nanonet_numa_node);
+    if (!nanonet_channels) {
+        return -ENOMEM;
+    }
+    for (id = 0; id < NANONET_MAX_CHANNELS; id++) {
+        spin_lock_init(&nanonet_channels[id].lock);
+    }
+    return 0;
+}
+
+// Flows are gone by now, so no decoder still claims against a channel.
+void nanonet_arb_cleanup(void) {
+    kfree(nanonet_channels);
+    nanonet_channels = NULL;
+}
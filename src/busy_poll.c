@@ -0,0 +1,176 @@
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/seq_file.h>
+#include <net/busy_poll.h>
+#include "../include/nanonet.h"
+
+// NAPI busy polling. A kthread pinned to busy_poll_cpu calls
+// napi_busy_loop() on the RX queue the feed arrives on, so the driver's
+// poll runs back to back on that core and ticks reach the hook without an
+// IRQ or softirq being scheduled. The queue is learned from the NAPI ID of
+// the ticks themselves. After busy_poll_idle_us without a packet the
+// thread hands the queue back to interrupts and sleeps; the next tick the
+// hook sees wakes it again.
+struct nanonet_busy_poller {
+    struct task_struct *task;
+    unsigned int napi_id;
+    u64 last_seen;              // Hook calls on the poll CPU at the last check
+    u64 last_active_ns;
+    u64 polls;
+    u64 empty_polls;
+    u64 to_busy;
+    u64 to_idle;
+};
+
+int nanonet_busy_poll_state = NANONET_BUSY_POLL_OFF;
+DEFINE_PER_CPU(u64, nanonet_busy_poll_ticks);
+static struct nanonet_busy_poller nanonet_busy_poller;
+static DECLARE_WAIT_QUEUE_HEAD(nanonet_busy_poll_wait);
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+
+// Everything that reaches the hook on this CPU is either bypassed or
+// noted as a tick, so a change means the last poll delivered something.
+// Ticks are noted before they are handed to RX workers, which count them
+// as processed on their own CPUs.
+static u64 nanonet_busy_poll_seen(void) {
+    struct nanonet_cpu_stats *st = per_cpu_ptr(&nanonet_cpu_stats, nanonet_busy_poll_cpu);
+
+    return READ_ONCE(*per_cpu_ptr(&nanonet_busy_poll_ticks, nanonet_busy_poll_cpu)) +
+           READ_ONCE(st->packets_bypassed);
+}
+
+// Called by napi_busy_loop() after each poll; true ends the loop.
+static bool nanonet_busy_poll_end(void *arg, unsigned long start_time) {
+    struct nanonet_busy_poller *p = arg;
+    u64 seen = nanonet_busy_poll_seen();
+    u64 now = local_clock();
+
+    WRITE_ONCE(p->polls, p->polls + 1);
+    if (seen != p->last_seen) {
+        p->last_seen = seen;
+        p->last_active_ns = now;
+        return kthread_should_stop();
+    }
+
+    WRITE_ONCE(p->empty_polls, p->empty_polls + 1);
+    return now - p->last_active_ns > (u64)nanonet_busy_poll_idle_us * NSEC_PER_USEC || kthread_should_stop();
+}
+
+static int nanonet_busy_poll_thread(void *data) {
+    struct nanonet_busy_poller *p = data;
+
+    while (!kthread_should_stop()) {
+        wait_event_interruptible(nanonet_busy_poll_wait, kthread_should_stop() ||
+                                 READ_ONCE(nanonet_busy_poll_state) == NANONET_BUSY_POLL_BUSY);
+        if (kthread_should_stop()) {
+            break;
+        }
+
+        p->last_seen = nanonet_busy_poll_seen();
+        p->last_active_ns = local_clock();
+        while (!kthread_should_stop() &&
+               local_clock() - p->last_active_ns <= (u64)nanonet_busy_poll_idle_us * NSEC_PER_USEC) {
+            // Returns on idle, or early when the scheduler wants the CPU
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+            napi_busy_loop(READ_ONCE(p->napi_id), nanonet_busy_poll_end, p, true, nanonet_busy_poll_budget);
+#else
+            napi_busy_loop(READ_ONCE(p->napi_id), nanonet_busy_poll_end, p);
+#endif
+            cond_resched();
+        }
+
+        // Back to interrupts until the hook sees the next tick
+        if (cmpxchg(&nanonet_busy_poll_state, NANONET_BUSY_POLL_BUSY, NANONET_BUSY_POLL_IDLE) ==
+            NANONET_BUSY_POLL_BUSY) {
+            WRITE_ONCE(p->to_idle, p->to_idle + 1);
+        }
+    }
+    return 0;
+}
+
+// Hook path, on whichever CPU took the interrupt: the poller is idle and a
+// tick arrived. Remember its queue and restart polling.
+void nanonet_busy_poll_wake(const struct sk_buff *skb) {
+    struct nanonet_busy_poller *p = &nanonet_busy_poller;
+
+    if (skb->napi_id < MIN_NAPI_ID) {
+        return;     // Not received through NAPI
+    }
+    if (cmpxchg(&nanonet_busy_poll_state, NANONET_BUSY_POLL_IDLE, NANONET_BUSY_POLL_BUSY) !=
+        NANONET_BUSY_POLL_IDLE) {
+        return;
+    }
+    WRITE_ONCE(p->napi_id, skb->napi_id);
+    WRITE_ONCE(p->to_busy, p->to_busy + 1);
+    wake_up_interruptible(&nanonet_busy_poll_wait);
+}
+
+int nanonet_busy_poll_init(void) {
+    struct nanonet_busy_poller *p = &nanonet_busy_poller;
+    struct task_struct *task;
+
+    if (nanonet_busy_poll_cpu < 0) {
+        return 0;
+    }
+    if (nanonet_busy_poll_cpu >= nr_cpu_ids || !cpu_online(nanonet_busy_poll_cpu)) {
+        printk(KERN_ERR "NANONET: busy_poll_cpu %d is not online\n", nanonet_busy_poll_cpu);
+        return -EINVAL;
+    }
+    nanonet_busy_poll_idle_us = max(nanonet_busy_poll_idle_us, 1U);
+    nanonet_busy_poll_budget = clamp_t(unsigned int, nanonet_busy_poll_budget, 1, NAPI_POLL_WEIGHT);
+
+    task = kthread_create(nanonet_busy_poll_thread, p, "nanonet_napi/%d", nanonet_busy_poll_cpu);
+    if (IS_ERR(task)) {
+        return PTR_ERR(task);
+    }
+    kthread_bind(task, nanonet_busy_poll_cpu);
+    p->task = task;
+    WRITE_ONCE(nanonet_busy_poll_state, NANONET_BUSY_POLL_IDLE);
+    wake_up_process(task);
+    return 0;
+}
+
+#else
+
+void nanonet_busy_poll_wake(const struct sk_buff *skb) {
+}
+
+int nanonet_busy_poll_init(void) {
+    if (nanonet_busy_poll_cpu >= 0) {
+        printk(KERN_ERR "NANONET: busy_poll_cpu needs a kernel built with CONFIG_NET_RX_BUSY_POLL\n");
+        return -EOPNOTSUPP;
+    }
+    return 0;
+}
+
+#endif
+
+// Ingress is stopped by now, so the hook can no longer wake the poller.
+void nanonet_busy_poll_cleanup(void) {
+    struct nanonet_busy_poller *p = &nanonet_busy_poller;
+
+    if (p->task) {
+        kthread_stop(p->task);
+        p->task = NULL;
+    }
+    WRITE_ONCE(nanonet_busy_poll_state, NANONET_BUSY_POLL_OFF);
+}
+
+void nanonet_busy_poll_show(struct seq_file *m) {
+    struct nanonet_busy_poller *p = &nanonet_busy_poller;
+    int state = READ_ONCE(nanonet_busy_poll_state);
+
+    if (state == NANONET_BUSY_POLL_OFF) {
+        return;
+    }
+    seq_printf(m, "\nNAPI Busy Poll (CPU %d):\n", nanonet_busy_poll_cpu);
+    seq_printf(m, "State: %s, NAPI ID %u\n", state == NANONET_BUSY_POLL_BUSY ? "polling" : "interrupts",
+               READ_ONCE(p->napi_id));
+    seq_printf(m, "Polls: %llu (empty %llu)\n", READ_ONCE(p->polls), READ_ONCE(p->empty_polls));
+    seq_printf(m, "Idle -> Busy: %llu\n", READ_ONCE(p->to_busy));
+    seq_printf(m, "Busy -> Idle: %llu\n", READ_ONCE(p->to_idle));
+}
@@ -0,0 +1,183 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include "../include/nanonet.h"
+
+// The active configuration is an immutable snapshot. The packet path reads
+// it with a single rcu_dereference(); updates build a new snapshot off to
+// the side, validate it, swap the pointer and free the old one after a
+// grace period, so readers never see a half-written config. Each snapshot
+// holds its egress device until then.
+struct nanonet_config_snapshot __rcu *nanonet_active_config;
+static DEFINE_MUTEX(nanonet_config_lock);
+
+static const struct ull_config nanonet_default_config = {
+    .enabled = 0,
+    .target_ip = 0,
+    .target_port = 0,
+    .protocol = IPPROTO_UDP,
+    .response_ip = 0,
+    .response_port = 0,
+    .application_logic_type = 0,
+    .multicast = 0,
+    .multicast_group = 0,
+};
+
+// The configured target behaves like a flow rule whose orders go back to
+// the target address, as before flow rules existed.
+static void nanonet_config_rule(struct nanonet_flow_rule *rule, const struct ull_config *config) {
+    memset(rule, 0, sizeof(*rule));
+    rule->dst_ip = config->target_ip;
+    rule->dst_port = config->target_port;
+    rule->protocol = config->protocol;
+    rule->application_logic_type = config->application_logic_type;
+    rule->response_ip = config->response_ip;
+    rule->response_port = config->response_port;
+    rule->ingress_ifindex = config->ingress_ifindex;
+    rule->egress_ifindex = config->egress_ifindex;
+}
+
+// Builds an unpublished snapshot of config. Its egress device is left NULL
+// if it cannot be resolved; the caller decides whether that is an error.
+static struct nanonet_config_snapshot *nanonet_config_alloc(const struct ull_config *config) {
+    struct nanonet_config_snapshot *snap;
+
+    snap = kmalloc_node(sizeof(*snap), GFP_KERNEL, nanonet_numa_node);
+    if (!snap) {
+        return NULL;
+    }
+    snap->config = *config;
+    nanonet_config_rule(&snap->flow.rule, config);
+    if (nanonet_throttle_init(&snap->flow) < 0) {
+        kfree(snap);
+        return NULL;
+    }
+    nanonet_dev_hold(&snap->flow.out, config->egress_ifindex);
+    nanonet_tx_template_build(&snap->flow.tmpl, &snap->flow.rule, snap->flow.out.dev);
+    return snap;
+}
+
+static void nanonet_config_free(struct nanonet_config_snapshot *snap) {
+    nanonet_throttle_release(&snap->flow);
+    nanonet_dev_release(&snap->flow.out);
+    kfree(snap);
+}
+
+static void nanonet_config_free_rcu(struct rcu_head *head) {
+    nanonet_config_free(container_of(head, struct nanonet_config_snapshot, rcu));
+}
+
+static void nanonet_config_swap(struct nanonet_config_snapshot *snap) {
+    struct nanonet_config_snapshot *old;
+
+    old = rcu_dereference_protected(nanonet_active_config, lockdep_is_held(&nanonet_config_lock));
+    if (old) {
+        nanonet_throttle_inherit(&snap->flow, &old->flow);
+    }
+    rcu_assign_pointer(nanonet_active_config, snap);
+    if (old) {
+        call_rcu(&old->rcu, nanonet_config_free_rcu);
+    }
+}
+
+int nanonet_config_publish(const struct ull_config *config) {
+    struct nanonet_config_snapshot *snap;
+    int ret;
+
+    // A disabled config may still be incomplete (e.g. "disable" before
+    // "config"), and with flow rules the single target is optional.
+    ret = config->enabled && config->target_ip ? nanonet_validate_config(config) : 0;
+    if (ret < 0) {
+        return ret;
+    }
+    ret = nanonet_dev_check(config->ingress_ifindex);
+    if (ret < 0) {
+        return ret;
+    }
+
+    snap = nanonet_config_alloc(config);
+    if (!snap) {
+        return -ENOMEM;
+    }
+    // Disabling must work even after the device is gone
+    if (config->enabled && !snap->flow.out.dev) {
+        nanonet_config_free(snap);
+        nanonet_log_error("Egress device %u not found", config->egress_ifindex);
+        return -ENODEV;
+    }
+
+    // The XDP program reflects UDP only; TCP needs the connection tracker.
+    // The mode cannot change until the new config is in place.
+    mutex_lock(&nanonet_ingress_mode_lock);
+    if (nanonet_get_ingress_mode() == NANONET_INGRESS_XDP && config->protocol == IPPROTO_TCP) {
+        mutex_unlock(&nanonet_ingress_mode_lock);
+        nanonet_config_free(snap);
+        nanonet_log_error("XDP ingress mode supports UDP only");
+        return -EOPNOTSUPP;
+    }
+    mutex_lock(&nanonet_config_lock);
+    nanonet_config_swap(snap);
+    mutex_unlock(&nanonet_config_lock);
+    mutex_unlock(&nanonet_ingress_mode_lock);
+
+    if (config->target_ip) {
+        struct nanonet_flow_rule rule;
+
+        nanonet_config_rule(&rule, config);
+        nanonet_strategy_config(&rule);
+    }
+    return 0;
+}
+
+// Rebuilds the active snapshot if its egress device went away, came back
+// or changed address. The old one keeps its device until readers are done.
+void nanonet_config_refresh(void) {
+    struct nanonet_config_snapshot *snap, *old;
+
+    mutex_lock(&nanonet_config_lock);
+    old = rcu_dereference_protected(nanonet_active_config, lockdep_is_held(&nanonet_config_lock));
+    if (old && nanonet_dev_stale(&old->flow)) {
+        snap = nanonet_config_alloc(&old->config);
+        if (snap) {
+            nanonet_config_swap(snap);
+        } else {
+            nanonet_log_error("Failed to rebuild configuration for device change");
+        }
+    }
+    mutex_unlock(&nanonet_config_lock);
+}
+
+void nanonet_config_copy(struct ull_config *out) {
+    rcu_read_lock();
+    *out = rcu_dereference(nanonet_active_config)->config;
+    rcu_read_unlock();
+}
+
+int nanonet_config_init(void) {
+    struct nanonet_config_snapshot *snap;
+
+    snap = nanonet_config_alloc(&nanonet_default_config);
+    if (!snap) {
+        return -ENOMEM;
+    }
+    RCU_INIT_POINTER(nanonet_active_config, snap);
+    return 0;
+}
+
+// Called after the ingress hooks are gone, so no reader can still hold it.
+void nanonet_config_cleanup(void) {
+    struct nanonet_config_snapshot *snap;
+
+    mutex_lock(&nanonet_config_lock);
+    snap = rcu_replace_pointer(nanonet_active_config, NULL, lockdep_is_held(&nanonet_config_lock));
+    mutex_unlock(&nanonet_config_lock);
+
+    synchronize_rcu();
+    if (snap) {
+        nanonet_config_free(snap);
+    }
+    // Replaced snapshots and flow rules still hold devices in pending
+    // callbacks, which must run before the module text goes away.
+    rcu_barrier();
+}
@@ -0,0 +1,212 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/rhashtable.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/seq_file.h>
+#include "../include/nanonet.h"
+
+// TCP connection tracker. Lookups are lock-free under RCU; inserts and
+// removals take only the rhashtable bucket lock, and the table grows and
+// shrinks with the number of connections. Each connection carries a timer
+// on the kernel timer wheel. The packet path only refreshes last_seen; the
+// timer re-arms itself lazily and unlinks the entry once it has been idle
+// for the state's timeout.
+//
+// Whoever wins rhashtable_remove_fast() owns the entry and frees it after
+// a grace period, so the timer and nanonet_clear_tcp_connections() never
+// free the same connection twice.
+
+static struct kmem_cache *nanonet_conn_cache;
+static struct rhashtable nanonet_conn_table;
+static atomic_t nanonet_conn_count = ATOMIC_INIT(0);
+
+static const struct rhashtable_params nanonet_conn_params = {
+    .head_offset = offsetof(struct ull_tcp_conn, node),
+    .key_offset = offsetof(struct ull_tcp_conn, key),
+    .key_len = sizeof(struct nanonet_conn_key),
+    .min_size = 1024,
+    .automatic_shrinking = true,
+};
+
+static inline unsigned long nanonet_conn_timeout(const struct ull_tcp_conn *conn) {
+    switch (READ_ONCE(conn->state)) {
+        case 2:
+            return NANONET_CONN_TIMEOUT_ESTABLISHED;
+        case 3:
+            return NANONET_CONN_TIMEOUT_CLOSING;
+        default:
+            return NANONET_CONN_TIMEOUT_SYN;
+    }
+}
+
+static void nanonet_conn_free_rcu(struct rcu_head *head) {
+    kmem_cache_free(nanonet_conn_cache, container_of(head, struct ull_tcp_conn, rcu));
+}
+
+// Caller has just unlinked conn from the table.
+static void nanonet_conn_release(struct ull_tcp_conn *conn) {
+    atomic_dec(&nanonet_conn_count);
+    this_cpu_dec(nanonet_cpu_stats.connections_active);
+    call_rcu(&conn->rcu, nanonet_conn_free_rcu);
+}
+
+static void nanonet_conn_expire(struct timer_list *t) {
+    struct ull_tcp_conn *conn = from_timer(conn, t, timer);
+    unsigned long expires;
+
+    if (READ_ONCE(conn->dead)) {
+        return;
+    }
+
+    expires = READ_ONCE(conn->last_seen) + nanonet_conn_timeout(conn);
+    if (time_before(jiffies, expires)) {
+        mod_timer(&conn->timer, expires);
+        return;
+    }
+
+    if (rhashtable_remove_fast(&nanonet_conn_table, &conn->node, nanonet_conn_params) == 0) {
+        WRITE_ONCE(conn->dead, true);
+        this_cpu_inc(nanonet_cpu_stats.connections_evicted);
+        nanonet_conn_release(conn);
+    }
+}
+
+static struct ull_tcp_conn *nanonet_conn_create(const struct nanonet_conn_key *key, u32 seq) {
+    struct ull_tcp_conn *conn, *old;
+
+    if (atomic_read(&nanonet_conn_count) >= NANONET_CONN_MAX) {
+        this_cpu_inc(nanonet_cpu_stats.connections_dropped);
+        return ERR_PTR(-ENOSPC);
+    }
+
+    conn = kmem_cache_alloc_node(nanonet_conn_cache, GFP_ATOMIC | __GFP_ZERO, nanonet_numa_node);
+    if (!conn) {
+        nanonet_log_error("Failed to allocate memory for TCP connection");
+        return ERR_PTR(-ENOMEM);
+    }
+    conn->key = *key;
+    conn->state = 1;
+    conn->seq_num = seq;
+    conn->last_seen = jiffies;
+
+    // Arm before publishing: once the entry is visible it may be unlinked
+    // and freed by someone else, so it must not be touched afterwards.
+    timer_setup(&conn->timer, nanonet_conn_expire, 0);
+    mod_timer(&conn->timer, conn->last_seen + NANONET_CONN_TIMEOUT_SYN);
+
+    old = rhashtable_lookup_get_insert_fast(&nanonet_conn_table, &conn->node, nanonet_conn_params);
+    if (old) {
+        // Lost a race with another CPU (old is valid), or the insert failed.
+        // The timer cannot have fired yet, so a plain del_timer() suffices.
+        del_timer(&conn->timer);
+        kmem_cache_free(nanonet_conn_cache, conn);
+        return old;
+    }
+
+    atomic_inc(&nanonet_conn_count);
+    this_cpu_inc(nanonet_cpu_stats.connections_active);
+    return conn;
+}
+
+// Called from the netfilter hook, inside its RCU read-side section.
+int nanonet_track_tcp_connection(struct ull_iphdr *ip_hdr, struct ull_tcphdr *tcp_hdr) {
+    struct nanonet_conn_key key = {
+        .src_ip = ip_hdr->saddr,
+        .dst_ip = ip_hdr->daddr,
+        .src_port = tcp_hdr->source,
+        .dst_port = tcp_hdr->dest,
+    };
+    struct ull_tcp_conn *conn;
+
+    conn = rhashtable_lookup(&nanonet_conn_table, &key, nanonet_conn_params);
+    if (!conn) {
+        if (!tcp_hdr->syn || tcp_hdr->ack) {
+            return -EINVAL;
+        }
+        conn = nanonet_conn_create(&key, ntohl(tcp_hdr->seq));
+        if (IS_ERR(conn)) {
+            return PTR_ERR(conn);
+        }
+    }
+
+    // Avoid dirtying the line when the timestamp has not moved.
+    if (READ_ONCE(conn->last_seen) != jiffies) {
+        WRITE_ONCE(conn->last_seen, jiffies);
+    }
+
+    if (tcp_hdr->rst || tcp_hdr->fin) {
+        WRITE_ONCE(conn->state, 3);  // Closing
+    } else if (tcp_hdr->syn && tcp_hdr->ack) {
+        conn->seq_num = ntohl(tcp_hdr->seq);
+        conn->ack_num = ntohl(tcp_hdr->ack_seq);
+        WRITE_ONCE(conn->state, 2);  // Established
+    } else if (tcp_hdr->syn) {
+        WRITE_ONCE(conn->state, 1);  // Syn-Sent
+    }
+
+    return 0;
+}
+
+void nanonet_clear_tcp_connections(void) {
+    struct rhashtable_iter iter;
+    struct ull_tcp_conn *conn, *reap = NULL;
+
+    rhashtable_walk_enter(&nanonet_conn_table, &iter);
+    rhashtable_walk_start(&iter);
+    while ((conn = rhashtable_walk_next(&iter)) != NULL) {
+        if (IS_ERR(conn)) {
+            if (PTR_ERR(conn) == -EAGAIN) {
+                continue;
+            }
+            break;
+        }
+        if (rhashtable_remove_fast(&nanonet_conn_table, &conn->node, nanonet_conn_params) == 0) {
+            WRITE_ONCE(conn->dead, true);
+            conn->reap_next = reap;
+            reap = conn;
+        }
+    }
+    rhashtable_walk_stop(&iter);
+    rhashtable_walk_exit(&iter);
+
+    // Only we can free these now; stop their timers outside the walk.
+    while (reap) {
+        conn = reap;
+        reap = conn->reap_next;
+        del_timer_sync(&conn->timer);
+        this_cpu_inc(nanonet_cpu_stats.connections_dropped);
+        nanonet_conn_release(conn);
+    }
+}
+
+void nanonet_conn_show(struct seq_file *m) {
+    seq_printf(m, "Connection Table: %d entries (max %d)\n",
+               atomic_read(&nanonet_conn_count), NANONET_CONN_MAX);
+}
+
+int nanonet_conn_init(void) {
+    int ret;
+
+    nanonet_conn_cache = kmem_cache_create("nanonet_conn", sizeof(struct ull_tcp_conn), 0,
+                                           SLAB_HWCACHE_ALIGN, NULL);
+    if (!nanonet_conn_cache) {
+        return -ENOMEM;
+    }
+
+    ret = rhashtable_init(&nanonet_conn_table, &nanonet_conn_params);
+    if (ret < 0) {
+        kmem_cache_destroy(nanonet_conn_cache);
+        return ret;
+    }
+
+    return 0;
+}
+
+// Called after the ingress hook is gone, so nothing inserts concurrently.
+void nanonet_conn_cleanup(void) {
+    nanonet_clear_tcp_connections();
+    rhashtable_destroy(&nanonet_conn_table);
+    rcu_barrier();
+    kmem_cache_destroy(nanonet_conn_cache);
+}
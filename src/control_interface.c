@@ -5,10 +5,9 @@
 #include <linux/uaccess.h>
 #include <linux/device.h>
 #include <linux/cdev.h>
-#include "../include/nanonet.h"
-
-extern struct ull_config global_config;
-extern struct ull_stats global_stats;
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include "../include/nanonet_strategy.h"
 
 static dev_t nanonet_dev_number;
 static struct cdev nanonet_cdev;
@@ -22,6 +21,27 @@ static struct device *nanonet_device = NULL;
 #define NANONET_IOC_GET_STATS  _IOR(NANONET_IOC_MAGIC, 3, struct ull_stats)
 #define NANONET_IOC_RESET_STATS _IO(NANONET_IOC_MAGIC, 4)
 #define NANONET_IOC_CLEAR_CONNECTIONS _IO(NANONET_IOC_MAGIC, 5)
+#define NANONET_IOC_GET_HISTOGRAM _IOR(NANONET_IOC_MAGIC, 6, struct ull_latency_histogram)
+#define NANONET_IOC_SET_INGRESS_MODE _IOW(NANONET_IOC_MAGIC, 7, __u32)
+#define NANONET_IOC_GET_INGRESS_MODE _IOR(NANONET_IOC_MAGIC, 8, __u32)
+#define NANONET_IOC_ADD_FLOW _IOW(NANONET_IOC_MAGIC, 9, struct nanonet_flow_rule)
+#define NANONET_IOC_DEL_FLOW _IOW(NANONET_IOC_MAGIC, 10, struct nanonet_flow_rule)
+#define NANONET_IOC_CLEAR_FLOWS _IO(NANONET_IOC_MAGIC, 11)
+#define NANONET_IOC_GET_STRATEGY _IOWR(NANONET_IOC_MAGIC, 12, struct nanonet_strategy_info)
+#define NANONET_IOC_SET_SYMBOL _IOW(NANONET_IOC_MAGIC, 13, struct nanonet_symbol_params)
+#define NANONET_IOC_CLEAR_SYMBOLS _IO(NANONET_IOC_MAGIC, 14)
+#define NANONET_IOC_SET_RISK _IOW(NANONET_IOC_MAGIC, 15, struct nanonet_risk_limits)
+#define NANONET_IOC_GET_RISK _IOR(NANONET_IOC_MAGIC, 16, struct nanonet_risk_status)
+#define NANONET_IOC_KILL_SWITCH _IOW(NANONET_IOC_MAGIC, 17, __u32)
+#define NANONET_IOC_RESET_RISK _IO(NANONET_IOC_MAGIC, 18)
+#define NANONET_IOC_SET_EVENTFD _IOW(NANONET_IOC_MAGIC, 19, __s32)
+#define NANONET_IOC_INJECT_KICK _IO(NANONET_IOC_MAGIC, 20)
+
+// Name -> ID resolution for binding rules to strategies by name
+struct nanonet_strategy_info {
+    char name[NANONET_STRATEGY_NAME_LEN];
+    __u32 id;
+};
 
 static int nanonet_open(struct inode *inode, struct file *file) {
     return nanonet_check_permissions();
@@ -35,48 +55,207 @@ static long nanonet_ioctl(struct file *file, unsigned int cmd, unsigned long arg
     int ret = 0;
 
     switch (cmd) {
-        case NANONET_IOC_SET_CONFIG:
-            if (copy_from_user(&global_config, (void __user *)arg, sizeof(struct ull_config))) {
+        case NANONET_IOC_SET_CONFIG: {
+            struct ull_config config;
+
+            // Built and validated off to the side, then published as a whole.
+            if (copy_from_user(&config, (void __user *)arg, sizeof(struct ull_config))) {
                 ret = -EFAULT;
                 nanonet_log_error("Failed to copy config from user");
                 break;
             }
-            ret = nanonet_validate_config(&global_config);
+            ret = nanonet_config_publish(&config);
             if (ret < 0) {
                 nanonet_log_error("Invalid configuration: %d", ret);
                 break;
             }
             printk(KERN_INFO "NANONET: Configuration updated\n");
             break;
+        }
+
+        case NANONET_IOC_GET_CONFIG: {
+            struct ull_config config;
 
-        case NANONET_IOC_GET_CONFIG:
-            if (copy_to_user((void __user *)arg, &global_config, sizeof(struct ull_config))) {
+            nanonet_config_copy(&config);
+            if (copy_to_user((void __user *)arg, &config, sizeof(struct ull_config))) {
                 ret = -EFAULT;
                 nanonet_log_error("Failed to copy config to user");
             }
             break;
+        }
+
+        case NANONET_IOC_GET_STATS: {
+            struct ull_stats stats;
 
-        case NANONET_IOC_GET_STATS:
-            if (copy_to_user((void __user *)arg, &global_stats, sizeof(struct ull_stats))) {
+            nanonet_stats_snapshot(&stats);
+            if (copy_to_user((void __user *)arg, &stats, sizeof(struct ull_stats))) {
                 ret = -EFAULT;
                 nanonet_log_error("Failed to copy stats to user");
             }
             break;
+        }
+
+        case NANONET_IOC_GET_HISTOGRAM: {
+            struct ull_latency_histogram *hist = kmalloc(sizeof(*hist), GFP_KERNEL);
+
+            if (!hist) {
+                ret = -ENOMEM;
+                break;
+            }
+            nanonet_stats_histogram(hist);
+            if (copy_to_user((void __user *)arg, hist, sizeof(struct ull_latency_histogram))) {
+                ret = -EFAULT;
+                nanonet_log_error("Failed to copy histogram to user");
+            }
+            kfree(hist);
+            break;
+        }
 
         case NANONET_IOC_RESET_STATS:
-            atomic64_set(&global_stats.packets_processed, 0);
-            atomic64_set(&global_stats.packets_bypassed, 0);
-            atomic64_set(&global_stats.responses_sent, 0);
-            atomic64_set(&global_stats.errors, 0);
-            atomic64_set(&global_stats.connections_active, 0);
-            atomic64_set(&global_stats.connections_dropped, 0);
-            global_stats.last_process_time_ns = 0;
-            global_stats.min_process_time_ns = UINT64_MAX;
-            global_stats.max_process_time_ns = 0;
-            global_stats.avg_process_time_ns = 0;
+            nanonet_stats_reset();
             printk(KERN_INFO "NANONET: Statistics reset\n");
             break;
 
+        case NANONET_IOC_SET_INGRESS_MODE: {
+            __u32 mode;
+
+            if (copy_from_user(&mode, (void __user *)arg, sizeof(mode))) {
+                ret = -EFAULT;
+                nanonet_log_error("Failed to copy ingress mode from user");
+                break;
+            }
+            ret = nanonet_set_ingress_mode(mode);
+            break;
+        }
+
+        case NANONET_IOC_GET_INGRESS_MODE: {
+            __u32 mode = nanonet_get_ingress_mode();
+
+            if (copy_to_user((void __user *)arg, &mode, sizeof(mode))) {
+                ret = -EFAULT;
+                nanonet_log_error("Failed to copy ingress mode to user");
+            }
+            break;
+        }
+
+        case NANONET_IOC_ADD_FLOW:
+        case NANONET_IOC_DEL_FLOW: {
+            struct nanonet_flow_rule rule;
+
+            if (copy_from_user(&rule, (void __user *)arg, sizeof(rule))) {
+                ret = -EFAULT;
+                nanonet_log_error("Failed to copy flow rule from user");
+                break;
+            }
+            ret = cmd == NANONET_IOC_ADD_FLOW ? nanonet_flow_add(&rule) : nanonet_flow_del(&rule);
+            if (ret < 0) {
+                nanonet_log_error("Flow rule update failed: %d", ret);
+            }
+            break;
+        }
+
+        case NANONET_IOC_CLEAR_FLOWS:
+            nanonet_flow_clear();
+            printk(KERN_INFO "NANONET: Flow rules cleared\n");
+            break;
+
+        case NANONET_IOC_GET_STRATEGY: {
+            struct nanonet_strategy_info info;
+
+            if (copy_from_user(&info, (void __user *)arg, sizeof(info))) {
+                ret = -EFAULT;
+                break;
+            }
+            info.name[sizeof(info.name) - 1] = '\0';
+            ret = nanonet_strategy_id(info.name);
+            if (ret < 0) {
+                break;
+            }
+            info.id = ret;
+            ret = 0;
+            if (copy_to_user((void __user *)arg, &info, sizeof(info))) {
+                ret = -EFAULT;
+            }
+            break;
+        }
+
+        case NANONET_IOC_SET_SYMBOL: {
+            struct nanonet_symbol_params params;
+
+            if (copy_from_user(&params, (void __user *)arg, sizeof(params))) {
+                ret = -EFAULT;
+                nanonet_log_error("Failed to copy symbol parameters from user");
+                break;
+            }
+            ret = nanonet_symbol_set(&params);
+            if (ret < 0) {
+                nanonet_log_error("Symbol update failed: %d", ret);
+            }
+            break;
+        }
+
+        case NANONET_IOC_CLEAR_SYMBOLS:
+            nanonet_symbols_clear();
+            printk(KERN_INFO "NANONET: Symbol table cleared\n");
+            break;
+
+        case NANONET_IOC_SET_RISK: {
+            struct nanonet_risk_limits limits;
+
+            if (copy_from_user(&limits, (void __user *)arg, sizeof(limits))) {
+                ret = -EFAULT;
+                nanonet_log_error("Failed to copy risk limits from user");
+                break;
+            }
+            nanonet_risk_set_limits(&limits);
+            printk(KERN_INFO "NANONET: Risk limits updated\n");
+            break;
+        }
+
+        case NANONET_IOC_GET_RISK: {
+            struct nanonet_risk_status status;
+
+            nanonet_risk_get_status(&status);
+            if (copy_to_user((void __user *)arg, &status, sizeof(status))) {
+                ret = -EFAULT;
+                nanonet_log_error("Failed to copy risk status to user");
+            }
+            break;
+        }
+
+        case NANONET_IOC_KILL_SWITCH: {
+            __u32 killed;
+
+            if (copy_from_user(&killed, (void __user *)arg, sizeof(killed))) {
+                ret = -EFAULT;
+                nanonet_log_error("Failed to copy kill switch from user");
+                break;
+            }
+            nanonet_risk_kill(killed != 0);
+            break;
+        }
+
+        case NANONET_IOC_RESET_RISK:
+            nanonet_risk_reset();
+            printk(KERN_INFO "NANONET: Risk exposure and counters reset\n");
+            break;
+
+        case NANONET_IOC_SET_EVENTFD: {
+            __s32 fd;
+
+            if (copy_from_user(&fd, (void __user *)arg, sizeof(fd))) {
+                ret = -EFAULT;
+                nanonet_log_error("Failed to copy eventfd from user");
+                break;
+            }
+            ret = nanonet_events_set_eventfd(fd);
+            break;
+        }
+
+        case NANONET_IOC_INJECT_KICK:
+            ret = nanonet_inject_kick();
+            break;
+
         case NANONET_IOC_CLEAR_CONNECTIONS:
             nanonet_clear_tcp_connections();
             printk(KERN_INFO "NANONET: TCP connections cleared\n");
@@ -91,34 +270,99 @@ static long nanonet_ioctl(struct file *file, unsigned int cmd, unsigned long arg
     return ret;
 }
 
+// The mmap offset selects the region; see NANONET_MMAP_* in nanonet.h.
+static int nanonet_mmap(struct file *file, struct vm_area_struct *vma) {
+    u64 offset = (u64)vma->vm_pgoff << PAGE_SHIFT;
+
+    if (offset >= NANONET_MMAP_EVENTS) {
+        offset -= NANONET_MMAP_EVENTS;
+        if (offset % NANONET_MMAP_EVENT_STRIDE) {
+            return -EINVAL;
+        }
+        return nanonet_events_mmap(vma, offset / NANONET_MMAP_EVENT_STRIDE);
+    }
+    if (offset == NANONET_MMAP_STATS) {
+        return nanonet_stats_page_mmap(vma);
+    }
+    if (offset == NANONET_MMAP_INJECT) {
+        return nanonet_inject_mmap(vma);
+    }
+    return -EINVAL;
+}
+
 static const struct file_operations nanonet_fops = {
     .owner = THIS_MODULE,
     .open = nanonet_open,
     .release = nanonet_release,
     .unlocked_ioctl = nanonet_ioctl,
+    .mmap = nanonet_mmap,
+    .poll = nanonet_events_poll,
 };
 
 static int nanonet_proc_show(struct seq_file *m, void *v) {
+    struct ull_config config;
+    struct ull_stats stats;
+    struct ull_latency_histogram *hist;
+    char name[IFNAMSIZ];
+
+    nanonet_config_copy(&config);
+
     seq_printf(m, "NanoNet Module Status\n");
     seq_printf(m, "========================================\n");
-    seq_printf(m, "Enabled: %s\n", global_config.enabled ? "Yes" : "No");
-    seq_printf(m, "Target IP: %pI4\n", &global_config.target_ip);
-    seq_printf(m, "Target Port: %u\n", ntohs(global_config.target_port));
-    seq_printf(m, "Protocol: %s\n", global_config.protocol == IPPROTO_TCP ? "TCP" : "UDP");
-    seq_printf(m, "Multicast: %s\n", global_config.multicast ? "Yes" : "No");
-    if (global_config.multicast) {
-        seq_printf(m, "Multicast Group: %pI4\n", &global_config.multicast_group);
+    seq_printf(m, "Enabled: %s\n", config.enabled ? "Yes" : "No");
+    seq_printf(m, "Interface: %s\n", nanonet_ifname);
+    if (config.ingress_ifindex) {
+        nanonet_dev_name(config.ingress_ifindex, name);
+        seq_printf(m, "Ingress Device: %s\n", name);
     }
+    nanonet_dev_name(config.egress_ifindex, name);
+    seq_printf(m, "Egress Device: %s\n", name);
+    seq_printf(m, "Ingress Mode: %s\n", nanonet_get_ingress_mode() == NANONET_INGRESS_XDP ? "xdp" : "netfilter");
+    seq_printf(m, "Target IP: %pI4\n", &config.target_ip);
+    seq_printf(m, "Target Port: %u\n", ntohs(config.target_port));
+    seq_printf(m, "Protocol: %s\n", config.protocol == IPPROTO_TCP ? "TCP" : "UDP");
+    seq_printf(m, "Multicast: %s\n", config.multicast ? "Yes" : "No");
+    if (config.multicast) {
+        seq_printf(m, "Multicast Group: %pI4\n", &config.multicast_group);
+    }
+    nanonet_flow_show(m);
+    nanonet_neigh_show(m);
+    nanonet_strategy_show(m);
+    seq_printf(m, "Symbols: %u (max %u)\n", nanonet_symbols_count(), NANONET_MAX_SYMBOLS);
+
+    nanonet_feed_show(m);
+    nanonet_arb_show(m);
+    nanonet_risk_show(m);
+    nanonet_events_show(m);
+    nanonet_inject_show(m);
+    nanonet_rx_workers_show(m);
+    nanonet_busy_poll_show(m);
+    nanonet_numa_show(m);
+
+    nanonet_stats_snapshot(&stats);
     seq_printf(m, "\nStatistics:\n");
-    seq_printf(m, "Packets Processed: %llu\n", atomic64_read(&global_stats.packets_processed));
-    seq_printf(m, "Packets Bypassed: %llu\n", atomic64_read(&global_stats.packets_bypassed));
-    seq_printf(m, "Responses Sent: %llu\n", atomic64_read(&global_stats.responses_sent));
-    seq_printf(m, "Errors: %llu\n", atomic64_read(&global_stats.errors));
-    seq_printf(m, "Active Connections: %llu\n", atomic64_read(&global_stats.connections_active));
-    seq_printf(m, "Dropped Connections: %llu\n", atomic64_read(&global_stats.connections_dropped));
-    seq_printf(m, "Min Process Time: %llu ns\n", global_stats.min_process_time_ns);
-    seq_printf(m, "Max Process Time: %llu ns\n", global_stats.max_process_time_ns);
-    seq_printf(m, "Avg Process Time: %llu ns\n", global_stats.avg_process_time_ns);
+    seq_printf(m, "Packets Processed: %llu\n", stats.packets_processed);
+    seq_printf(m, "Packets Bypassed: %llu\n", stats.packets_bypassed);
+    seq_printf(m, "Responses Sent: %llu\n", stats.responses_sent);
+    seq_printf(m, "Errors: %llu\n", stats.errors);
+    seq_printf(m, "Active Connections: %lld\n", stats.connections_active);
+    seq_printf(m, "Dropped Connections: %llu\n", stats.connections_dropped);
+    seq_printf(m, "Evicted Connections: %llu\n", stats.connections_evicted);
+    nanonet_conn_show(m);
+    seq_printf(m, "Min Process Time: %llu ns\n", stats.min_process_time_ns);
+    seq_printf(m, "Max Process Time: %llu ns\n", stats.max_process_time_ns);
+    seq_printf(m, "Avg Process Time: %llu ns\n", stats.avg_process_time_ns);
+
+    hist = kmalloc(sizeof(*hist), GFP_KERNEL);
+    if (hist) {
+        nanonet_stats_histogram(hist);
+        seq_printf(m, "\nLatency Percentiles (%llu samples):\n", hist->count);
+        seq_printf(m, "p50: %llu ns\n", hist->p50_ns);
+        seq_printf(m, "p99: %llu ns\n", hist->p99_ns);
+        seq_printf(m, "p99.9: %llu ns\n", hist->p999_ns);
+        seq_printf(m, "max: %llu ns\n", hist->max_ns);
+        kfree(hist);
+    }
 
     return 0;
 }
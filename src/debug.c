@@ -1,4 +1,5 @@
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
 #include <linux/trace_events.h>
@@ -8,6 +9,8 @@
 
 static struct dentry *nanonet_debug_dir;
 static struct dentry *nanonet_debug_stats;
+static struct dentry *nanonet_debug_pool;
+static struct dentry *nanonet_debug_symbols;
 
 struct ull_debug_stats {
     u64 total_interrupts;
@@ -69,6 +72,45 @@ static const struct file_operations nanonet_debug_stats_fops = {
     .release = single_release,
 };
 
+static int nanonet_debug_pool_show(struct seq_file *m, void *v) {
+    seq_printf(m, "NanoNet Response Pool\n");
+    seq_printf(m, "============================\n");
+    nanonet_response_pool_show(m);
+    nanonet_tx_show(m);
+
+    return 0;
+}
+
+static int nanonet_debug_pool_open(struct inode *inode, struct file *file) {
+    return single_open(file, nanonet_debug_pool_show, NULL);
+}
+
+static const struct file_operations nanonet_debug_pool_fops = {
+    .open = nanonet_debug_pool_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static int nanonet_debug_symbols_show(struct seq_file *m, void *v) {
+    seq_printf(m, "NanoNet Symbols\n");
+    seq_printf(m, "============================\n");
+    nanonet_symbols_show(m);
+
+    return 0;
+}
+
+static int nanonet_debug_symbols_open(struct inode *inode, struct file *file) {
+    return single_open(file, nanonet_debug_symbols_show, NULL);
+}
+
+static const struct file_operations nanonet_debug_symbols_fops = {
+    .open = nanonet_debug_symbols_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
 int nanonet_debug_init(void) {
     nanonet_debug_dir = debugfs_create_dir("nanonet", NULL);
     if (!nanonet_debug_dir) {
@@ -84,6 +126,22 @@ int nanonet_debug_init(void) {
         return -ENOMEM;
     }
 
+    nanonet_debug_pool = debugfs_create_file("response_pool", 0444, nanonet_debug_dir, NULL, &nanonet_debug_pool_fops);
+
+    if (!nanonet_debug_pool) {
+        debugfs_remove_recursive(nanonet_debug_dir);
+        printk(KERN_ERR "NANONET: Failed to create debugfs response_pool file\n");
+        return -ENOMEM;
+    }
+
+    nanonet_debug_symbols = debugfs_create_file("symbols", 0444, nanonet_debug_dir, NULL, &nanonet_debug_symbols_fops);
+
+    if (!nanonet_debug_symbols) {
+        debugfs_remove_recursive(nanonet_debug_dir);
+        printk(KERN_ERR "NANONET: Failed to create debugfs symbols file\n");
+        return -ENOMEM;
+    }
+
     return 0;
 }
 
@@ -106,4 +164,5 @@ void nanonet_log_error(const char *fmt, ...) {
 
     snprintf(debug_stats.last_error, sizeof(debug_stats.last_error), "[%llu ns] %s", ts, buffer);
     printk(KERN_ERR "NANONET: %s\n", debug_stats.last_error);
-}
\ No newline at end of file
+}
+EXPORT_SYMBOL_GPL(nanonet_log_error);
\ No newline at end of file
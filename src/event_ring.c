@@ -0,0 +1,265 @@
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/log2.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/eventfd.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include "../include/nanonet.h"
+
+// Event rings. The header and records share one vmalloc_user() area per
+// CPU, mapped read-write so the consumer can advance its index. Nothing the
+// consumer writes is trusted: the producer keeps its own index and only
+// reads consumer to compute free space, and every slot is masked.
+struct nanonet_event_ring {
+    struct nanonet_event_ring_hdr *hdr;
+    struct nanonet_event *records;
+    u64 producer;
+    u32 mask;
+    size_t bytes;
+};
+
+static DEFINE_PER_CPU(struct nanonet_event_ring, nanonet_event_rings);
+static DECLARE_WAIT_QUEUE_HEAD(nanonet_event_wait);
+static struct eventfd_ctx __rcu *nanonet_event_eventfd;
+static DEFINE_MUTEX(nanonet_event_lock);
+
+// Number of live mappings of any ring; events are only published while a
+// consumer has one.
+atomic_t nanonet_event_maps = ATOMIC_INIT(0);
+
+static void nanonet_event_wakeup(struct nanonet_event_ring_hdr *hdr) {
+    struct eventfd_ctx *ctx;
+
+    WRITE_ONCE(hdr->flags, READ_ONCE(hdr->flags) & ~NANONET_RING_NEED_WAKEUP);
+    wake_up_interruptible(&nanonet_event_wait);
+
+    rcu_read_lock();
+    ctx = rcu_dereference(nanonet_event_eventfd);
+    if (ctx) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+        eventfd_signal(ctx);
+#else
+        eventfd_signal(ctx, 1);
+#endif
+    }
+    rcu_read_unlock();
+}
+
+static void nanonet_event_fill_flow(struct nanonet_event *ev, const struct nanonet_flow *flow) {
+    if (flow) {
+        ev->flow_ip = flow->rule.dst_ip;
+        ev->flow_port = flow->rule.dst_port;
+        ev->flow_protocol = flow->rule.protocol;
+    } else {
+        ev->flow_ip = 0;
+        ev->flow_port = 0;
+        ev->flow_protocol = 0;
+    }
+}
+
+// Writes one record into this CPU's ring. data is the tick (struct
+// market_data) or the order (struct trading_order) the event is about, or
+// NULL. Softirq context, or BHs disabled: the CPU is the only producer.
+void nanonet_event_publish(u8 type, u16 reason, const void *data, const struct nanonet_flow *flow) {
+    struct nanonet_event_ring *ring = this_cpu_ptr(&nanonet_event_rings);
+    struct nanonet_event_ring_hdr *hdr = ring->hdr;
+    struct nanonet_event *ev;
+
+    if (unlikely(!hdr)) {
+        return;
+    }
+
+    if (ring->producer - smp_load_acquire(&hdr->consumer) > ring->mask) {
+        WRITE_ONCE(hdr->dropped, hdr->dropped + 1);
+        return;
+    }
+
+    ev = &ring->records[ring->producer & ring->mask];
+    memset(ev, 0, sizeof(*ev));
+    ev->timestamp = ktime_get_real_ns();
+    ev->type = type;
+    ev->reason = reason;
+    nanonet_event_fill_flow(ev, flow);
+
+    if (type == NANONET_EVENT_TICK && data) {
+        const struct market_data *market = data;
+
+        memcpy(ev->symbol, market->symbol, sizeof(ev->symbol));
+        ev->price = market->price;
+        ev->quantity = market->quantity;
+        ev->feed_timestamp = market->timestamp;
+    } else if ((type == NANONET_EVENT_ORDER || type == NANONET_EVENT_REJECT) && data) {
+        const struct trading_order *order = data;
+
+        memcpy(ev->symbol, order->symbol, sizeof(ev->symbol));
+        ev->price = order->price;
+        ev->quantity = order->quantity;
+        ev->side = order->side;
+        memcpy(ev->clOrdId, order->clOrdId, sizeof(ev->clOrdId));
+    }
+
+    // The record is complete before the consumer can see it.
+    smp_store_release(&hdr->producer, ++ring->producer);
+
+    // Pairs with the barrier in nanonet_events_poll(): either the poller
+    // sees the new producer index, or we see its NEED_WAKEUP. A release
+    // store does not order the flags load after it.
+    smp_mb();
+    if (unlikely(READ_ONCE(hdr->flags) & NANONET_RING_NEED_WAKEUP)) {
+        nanonet_event_wakeup(hdr);
+    }
+}
+
+static void nanonet_events_vm_open(struct vm_area_struct *vma) {
+    atomic_inc(&nanonet_event_maps);
+}
+
+static void nanonet_events_vm_close(struct vm_area_struct *vma) {
+    atomic_dec(&nanonet_event_maps);
+}
+
+static const struct vm_operations_struct nanonet_events_vm_ops = {
+    .open = nanonet_events_vm_open,
+    .close = nanonet_events_vm_close,
+};
+
+// Maps the ring of the ring'th possible CPU.
+int nanonet_events_mmap(struct vm_area_struct *vma, unsigned long ring) {
+    struct nanonet_event_ring *r;
+    int cpu, ret;
+
+    if (ring >= nr_cpu_ids || !cpu_possible(ring)) {
+        return -ENXIO;
+    }
+    cpu = ring;
+    r = per_cpu_ptr(&nanonet_event_rings, cpu);
+    if (!r->hdr) {
+        return -ENODEV;
+    }
+    if (vma->vm_end - vma->vm_start > PAGE_ALIGN(r->bytes)) {
+        return -EINVAL;
+    }
+
+    ret = remap_vmalloc_range(vma, r->hdr, 0);
+    if (ret < 0) {
+        return ret;
+    }
+    vma->vm_ops = &nanonet_events_vm_ops;
+    nanonet_events_vm_open(vma);
+    return 0;
+}
+
+// Readable when any ring has events. Sets NANONET_RING_NEED_WAKEUP on
+// every ring first, so an event published after the check wakes us.
+__poll_t nanonet_events_poll(struct file *file, struct poll_table_struct *wait) {
+    struct nanonet_event_ring_hdr *hdr;
+    __poll_t mask = 0;
+    int cpu;
+
+    poll_wait(file, &nanonet_event_wait, wait);
+
+    for_each_possible_cpu(cpu) {
+        hdr = per_cpu_ptr(&nanonet_event_rings, cpu)->hdr;
+        if (!hdr) {
+            continue;
+        }
+        WRITE_ONCE(hdr->flags, READ_ONCE(hdr->flags) | NANONET_RING_NEED_WAKEUP);
+    }
+    smp_mb();
+
+    for_each_possible_cpu(cpu) {
+        hdr = per_cpu_ptr(&nanonet_event_rings, cpu)->hdr;
+        if (hdr && READ_ONCE(hdr->producer) != READ_ONCE(hdr->consumer)) {
+            mask |= EPOLLIN | EPOLLRDNORM;
+        }
+    }
+    return mask;
+}
+
+// Replaces the eventfd signalled on wakeups; a negative fd removes it.
+int nanonet_events_set_eventfd(int fd) {
+    struct eventfd_ctx *ctx = NULL, *old;
+
+    if (fd >= 0) {
+        ctx = eventfd_ctx_fdget(fd);
+        if (IS_ERR(ctx)) {
+            return PTR_ERR(ctx);
+        }
+    }
+
+    mutex_lock(&nanonet_event_lock);
+    old = rcu_replace_pointer(nanonet_event_eventfd, ctx, lockdep_is_held(&nanonet_event_lock));
+    mutex_unlock(&nanonet_event_lock);
+
+    if (old) {
+        synchronize_rcu();
+        eventfd_ctx_put(old);
+    }
+    return 0;
+}
+
+void nanonet_events_show(struct seq_file *m) {
+    struct nanonet_event_ring *ring;
+    u64 published = 0, dropped = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&nanonet_event_rings, cpu);
+        if (ring->hdr) {
+            published += READ_ONCE(ring->producer);
+            dropped += READ_ONCE(ring->hdr->dropped);
+        }
+    }
+
+    seq_printf(m, "\nEvent Rings:\n");
+    seq_printf(m, "Ring Size: %u records\n", nanonet_event_ring_size);
+    seq_printf(m, "Mappings: %d\n", atomic_read(&nanonet_event_maps));
+    seq_printf(m, "Events Published: %llu\n", published);
+    seq_printf(m, "Events Dropped: %llu\n", dropped);
+}
+
+int nanonet_events_init(void) {
+    struct nanonet_event_ring *ring;
+    int cpu;
+
+    if (!nanonet_event_ring_size) {
+        return 0;
+    }
+    nanonet_event_ring_size = roundup_pow_of_two(clamp_t(unsigned int, nanonet_event_ring_size, 64, NANONET_EVENT_RING_MAX));
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&nanonet_event_rings, cpu);
+        ring->bytes = sizeof(*ring->hdr) + (size_t)nanonet_event_ring_size * sizeof(struct nanonet_event);
+        ring->hdr = nanonet_vmalloc_user_node(ring->bytes, cpu_to_node(cpu));
+        if (!ring->hdr) {
+            nanonet_events_cleanup();
+            return -ENOMEM;
+        }
+        ring->records = (struct nanonet_event *)(ring->hdr + 1);
+        ring->mask = nanonet_event_ring_size - 1;
+        ring->producer = 0;
+        ring->hdr->size = nanonet_event_ring_size;
+        ring->hdr->cpu = cpu;
+        ring->hdr->nr_rings = nr_cpu_ids;
+    }
+    return 0;
+}
+
+// The device is gone by now, so nothing can still have a ring mapped.
+void nanonet_events_cleanup(void) {
+    struct nanonet_event_ring *ring;
+    int cpu;
+
+    nanonet_events_set_eventfd(-1);
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&nanonet_event_rings, cpu);
+        vfree(ring->hdr);
+        ring->hdr = NULL;
+    }
+}
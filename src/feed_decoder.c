@@ -0,0 +1,186 @@
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/prefetch.h>
+#include <linux/seq_file.h>
+#include <asm/unaligned.h>
+#include "../include/nanonet_strategy.h"
+
+// Feed decoders. A flow's decoder turns its payload into strategy
+// callbacks in one pass over the packet, handing out pointers into the
+// payload rather than copies. Each flow picks its decoder in its rule.
+
+struct nanonet_feed_stats {
+    u64 packets;
+    u64 messages;
+    u64 unknown;
+    u64 truncated;
+};
+
+static DEFINE_PER_CPU(struct nanonet_feed_stats, nanonet_feed_stats);
+
+static int nanonet_decode_level(struct nanonet_strategy *s, void *state, const struct nanonet_level_msg *msg,
+                                const struct nanonet_flow *flow) {
+    struct nanonet_symbol *sym = nanonet_symbol_lookup(msg->symbol);
+
+    if (!sym) {
+        return 0;    // Not a symbol we track
+    }
+    nanonet_book_set(sym->book, msg->side == 'S' ? NANONET_BOOK_ASK : NANONET_BOOK_BID,
+                     get_unaligned(&msg->price), get_unaligned(&msg->quantity));
+
+    return s->on_book ? s->on_book(state, sym, flow) : 0;
+}
+
+static int nanonet_decode_message(struct nanonet_strategy *s, void *state, u8 *msg, int len,
+                                  const struct nanonet_flow *flow) {
+    switch (msg[0]) {
+        case NANONET_MSG_TICK:
+            if (unlikely(len < 1 + (int)sizeof(struct market_data))) {
+                break;
+            }
+            // Unaligned, as on_tick is documented to expect
+            nanonet_event(NANONET_EVENT_TICK, 0, msg + 1, flow);
+            return s->on_tick(state, msg + 1, len - 1, flow);
+
+        case NANONET_MSG_LEVEL:
+            if (unlikely(len < 1 + (int)sizeof(struct nanonet_level_msg))) {
+                break;
+            }
+            return nanonet_decode_level(s, state, (const struct nanonet_level_msg *)(msg + 1), flow);
+
+        default:
+            if (s->on_message) {
+                return s->on_message(state, msg, len, flow);
+            }
+            this_cpu_inc(nanonet_feed_stats.unknown);
+            return 0;
+    }
+
+    this_cpu_inc(nanonet_feed_stats.truncated);
+    return -EINVAL;
+}
+
+// Walks every message of a MoldUDP64 packet. The next message is
+// prefetched while the current one is handled. A message that fails does
+// not stop the rest of the bundle.
+static int nanonet_decode_moldudp64(struct nanonet_strategy *s, void *state, u8 *payload, int payload_len,
+                                    const struct nanonet_flow *flow) {
+    const struct nanonet_moldudp64_hdr *hdr = (const struct nanonet_moldudp64_hdr *)payload;
+    u8 *p = payload + sizeof(*hdr);
+    u8 *end = payload + payload_len;
+    u8 *msg, *q;
+    u64 seq = 0, fresh = ~0ULL;
+    int count, len, result, i, j, batch, valid, orders = 0, handled = 0;
+
+    if (unlikely(payload_len < (int)sizeof(*hdr))) {
+        this_cpu_inc(nanonet_feed_stats.truncated);
+        return -EINVAL;
+    }
+
+    count = get_unaligned_be16(&hdr->msg_count);
+    if (count == NANONET_MOLDUDP64_END_OF_SESSION) {
+        return 0;
+    }
+
+    // On an A/B channel, only messages no other copy has delivered yet
+    if (flow->rule.channel) {
+        seq = get_unaligned_be64(&hdr->seq);
+        if (!count) {
+            nanonet_arb_claim(&flow->rule, hdr->session, seq, 0);
+            return 0;
+        }
+    }
+
+    for (i = 0; i < count; i += batch) {
+        // Length-check the batch before claiming it: messages a truncated
+        // bundle does not carry must stay unclaimed for the other copy.
+        batch = min(count - i, NANONET_ARB_BATCH);
+        q = p;
+        for (valid = 0; valid < batch; valid++) {
+            if (unlikely(end - q < 2)) {
+                break;
+            }
+            len = get_unaligned_be16(q);
+            if (unlikely(len == 0 || len > end - (q + 2))) {
+                break;
+            }
+            q += 2 + len;
+        }
+
+        if (flow->rule.channel && valid) {
+            fresh = nanonet_arb_claim(&flow->rule, hdr->session, seq + i, valid);
+        }
+
+        for (j = 0; j < valid; j++) {
+            len = get_unaligned_be16(p);
+            msg = p + 2;
+            p = msg + len;
+            prefetch(p);
+
+            if (flow->rule.channel && !(fresh & (1ULL << j))) {
+                continue;
+            }
+
+            result = nanonet_decode_message(s, state, msg, len, flow);
+            if (result > 0) {
+                orders += result;
+            }
+            handled++;
+        }
+
+        if (unlikely(valid < batch)) {
+            goto truncated;
+        }
+    }
+    this_cpu_add(nanonet_feed_stats.messages, handled);
+    return orders;
+
+truncated:
+    this_cpu_add(nanonet_feed_stats.messages, handled);
+    this_cpu_inc(nanonet_feed_stats.truncated);
+    return orders ? orders : -EINVAL;
+}
+
+// Decodes payload with the flow's decoder and runs its strategy. Returns
+// the number of orders sent. Caller holds rcu_read_lock().
+int nanonet_feed_decode(void *payload, int payload_len, const struct nanonet_flow *flow) {
+    struct nanonet_strategy *s = nanonet_strategy_get(flow->rule.application_logic_type);
+    void *state;
+
+    if (unlikely(!s)) {
+        return -ENOENT;
+    }
+    state = s->state ? this_cpu_ptr(s->state) : NULL;
+    this_cpu_inc(nanonet_feed_stats.packets);
+
+    switch (flow->rule.decoder) {
+        case NANONET_DECODER_MOLDUDP64:
+            return nanonet_decode_moldudp64(s, state, payload, payload_len, flow);
+
+        default:
+            this_cpu_inc(nanonet_feed_stats.messages);
+            if (payload_len >= (int)sizeof(struct market_data)) {
+                nanonet_event(NANONET_EVENT_TICK, 0, payload, flow);
+            }
+            return s->on_tick(state, payload, payload_len, flow);
+    }
+}
+
+void nanonet_feed_show(struct seq_file *m) {
+    struct nanonet_feed_stats *stats, total = {0};
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        stats = per_cpu_ptr(&nanonet_feed_stats, cpu);
+        total.packets += READ_ONCE(stats->packets);
+        total.messages += READ_ONCE(stats->messages);
+        total.unknown += READ_ONCE(stats->unknown);
+        total.truncated += READ_ONCE(stats->truncated);
+    }
+
+    seq_printf(m, "\nFeed Decoding:\n");
+    seq_printf(m, "Packets Decoded: %llu\n", total.packets);
+    seq_printf(m, "Messages: %llu\n", total.messages);
+    seq_printf(m, "Unknown Messages: %llu\n", total.unknown);
+    seq_printf(m, "Truncated: %llu\n", total.truncated);
+}
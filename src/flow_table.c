@@ -0,0 +1,281 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/seq_file.h>
+#include <linux/rculist.h>
+#include "../include/nanonet.h"
+
+// Flow classification table. Lookups run lock-free under RCU from the
+// netfilter hook; add/del/clear come from ioctl context and serialize on
+// nanonet_flow_lock. The rule key sits right behind the hlist node so a
+// lookup touches one cache line per candidate. An entry holds its egress
+// device until the grace period after it is removed or replaced.
+struct nanonet_flow_entry {
+    struct hlist_node node;
+    struct nanonet_flow flow;
+    struct rcu_head rcu;
+};
+
+static DEFINE_HASHTABLE(nanonet_flow_hash, NANONET_FLOW_HASH_BITS);
+static DEFINE_MUTEX(nanonet_flow_lock);
+static unsigned int nanonet_flow_count;
+
+static void nanonet_flow_entry_free(struct rcu_head *head) {
+    struct nanonet_flow_entry *entry = container_of(head, struct nanonet_flow_entry, rcu);
+
+    nanonet_throttle_release(&entry->flow);
+    nanonet_dev_release(&entry->flow.out);
+    kfree(entry);
+}
+
+// Unpublished entry for rule, with its egress device resolved if it exists.
+static struct nanonet_flow_entry *nanonet_flow_entry_alloc(const struct nanonet_flow_rule *rule) {
+    struct nanonet_flow_entry *entry;
+
+    entry = kzalloc_node(sizeof(*entry), GFP_KERNEL, nanonet_numa_node);
+    if (!entry) {
+        return NULL;
+    }
+    entry->flow.rule = *rule;
+    if (nanonet_throttle_init(&entry->flow) < 0) {
+        kfree(entry);
+        return NULL;
+    }
+    nanonet_dev_hold(&entry->flow.out, rule->egress_ifindex);
+    nanonet_tx_template_build(&entry->flow.tmpl, rule, entry->flow.out.dev);
+    return entry;
+}
+
+static inline u32 nanonet_flow_key(__be32 dst_ip, __be16 dst_port, __u8 protocol) {
+    return jhash_2words((__force u32)dst_ip, ((__force u32)dst_port << 8) | protocol, 0);
+}
+
+static inline bool nanonet_flow_equal(const struct nanonet_flow_rule *rule, __be32 dst_ip,
+                                      __be16 dst_port, __u8 protocol) {
+    return rule->dst_ip == dst_ip && rule->dst_port == dst_port && rule->protocol == protocol;
+}
+
+// Caller holds rcu_read_lock() or nanonet_flow_lock.
+static struct nanonet_flow_entry *nanonet_flow_find(__be32 dst_ip, __be16 dst_port, __u8 protocol) {
+    struct nanonet_flow_entry *entry;
+
+    hash_for_each_possible_rcu(nanonet_flow_hash, entry, node,
+                               nanonet_flow_key(dst_ip, dst_port, protocol)) {
+        if (nanonet_flow_equal(&entry->flow.rule, dst_ip, dst_port, protocol)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+const struct nanonet_flow *nanonet_flow_lookup(__be32 dst_ip, __be16 dst_port, __u8 protocol) {
+    struct nanonet_flow_entry *entry;
+
+    if (!READ_ONCE(nanonet_flow_count)) {
+        return NULL;
+    }
+    entry = nanonet_flow_find(dst_ip, dst_port, protocol);
+    return entry ? &entry->flow : NULL;
+}
+
+// Decide whether a packet is ours from the IP header and the L4 ports alone,
+// before any checksum or validation. ip_rcv() has already
+// checked the IP header; the ports are the first 4 bytes of TCP and UDP.
+const struct nanonet_flow *nanonet_flow_classify(struct sk_buff *skb,
+                                                 const struct nanonet_config_snapshot *snap) {
+    const struct ull_config *config = &snap->config;
+    const struct ull_iphdr *ip = (const struct ull_iphdr *)skb_network_header(skb);
+    const struct nanonet_flow *flow;
+    __be16 _ports[2];
+    const __be16 *ports;
+
+    if (ip->protocol != IPPROTO_UDP && ip->protocol != IPPROTO_TCP) {
+        return NULL;
+    }
+
+    ports = skb_header_pointer(skb, skb_network_offset(skb) + (ip->version_ihl & 0x0F) * 4,
+                               sizeof(_ports), _ports);
+    if (!ports) {
+        return NULL;
+    }
+
+    flow = nanonet_flow_lookup(ip->daddr, ports[1], ip->protocol);
+    if (flow && nanonet_ingress_match(flow->rule.ingress_ifindex, skb)) {
+        return flow;
+    }
+
+    if (config->target_ip && nanonet_ingress_match(config->ingress_ifindex, skb) &&
+        ip->protocol == config->protocol && ports[1] == config->target_port &&
+        (ip->daddr == config->target_ip || (config->multicast && ip->daddr == config->multicast_group))) {
+        return &snap->flow;
+    }
+    return NULL;
+}
+
+int nanonet_flow_add(const struct nanonet_flow_rule *rule) {
+    struct nanonet_flow_entry *entry, *old;
+    int ret;
+
+    ret = nanonet_validate_flow_rule(rule);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = nanonet_dev_check(rule->ingress_ifindex);
+    if (ret < 0) {
+        return ret;
+    }
+
+    entry = nanonet_flow_entry_alloc(rule);
+    if (!entry) {
+        return -ENOMEM;
+    }
+    if (!entry->flow.out.dev) {
+        nanonet_flow_entry_free(&entry->rcu);
+        nanonet_log_error("Egress device %u not found", rule->egress_ifindex);
+        return -ENODEV;
+    }
+
+    mutex_lock(&nanonet_flow_lock);
+    old = nanonet_flow_find(rule->dst_ip, rule->dst_port, rule->protocol);
+    if (old) {
+        // The join moves with the rule if it now listens on another NIC
+        if (old->flow.rule.ingress_ifindex != rule->ingress_ifindex) {
+            ret = nanonet_mc_join(rule->dst_ip, rule->ingress_ifindex);
+            if (ret < 0) {
+                mutex_unlock(&nanonet_flow_lock);
+                nanonet_flow_entry_free(&entry->rcu);
+                nanonet_log_error("Failed to join %pI4: %d", &rule->dst_ip, ret);
+                return ret;
+            }
+            nanonet_mc_leave(old->flow.rule.dst_ip, old->flow.rule.ingress_ifindex);
+        }
+        // Same key: swap in the new rule so readers see either one whole.
+        // It shares the old rule's throttle, so a replace is no refill
+        // and the TCP sequence numbers carry on.
+        nanonet_throttle_inherit(&entry->flow, &old->flow);
+        hlist_replace_rcu(&old->node, &entry->node);
+        call_rcu(&old->rcu, nanonet_flow_entry_free);
+    } else if (nanonet_flow_count >= NANONET_MAX_FLOWS) {
+        mutex_unlock(&nanonet_flow_lock);
+        nanonet_flow_entry_free(&entry->rcu);
+        nanonet_log_error("Flow table full (%d rules)", NANONET_MAX_FLOWS);
+        return -ENOSPC;
+    } else {
+        // Each new multicast rule holds a join, so both lines of an A/B
+        // channel are received.
+        ret = nanonet_mc_join(rule->dst_ip, rule->ingress_ifindex);
+        if (ret < 0) {
+            mutex_unlock(&nanonet_flow_lock);
+            nanonet_flow_entry_free(&entry->rcu);
+            nanonet_log_error("Failed to join %pI4: %d", &rule->dst_ip, ret);
+            return ret;
+        }
+        hash_add_rcu(nanonet_flow_hash, &entry->node,
+                     nanonet_flow_key(rule->dst_ip, rule->dst_port, rule->protocol));
+        WRITE_ONCE(nanonet_flow_count, nanonet_flow_count + 1);
+    }
+    mutex_unlock(&nanonet_flow_lock);
+
+    nanonet_strategy_config(rule);
+    return 0;
+}
+
+int nanonet_flow_del(const struct nanonet_flow_rule *rule) {
+    struct nanonet_flow_entry *entry;
+
+    mutex_lock(&nanonet_flow_lock);
+    entry = nanonet_flow_find(rule->dst_ip, rule->dst_port, rule->protocol);
+    if (!entry) {
+        mutex_unlock(&nanonet_flow_lock);
+        return -ENOENT;
+    }
+    hash_del_rcu(&entry->node);
+    WRITE_ONCE(nanonet_flow_count, nanonet_flow_count - 1);
+    nanonet_mc_leave(entry->flow.rule.dst_ip, entry->flow.rule.ingress_ifindex);
+    mutex_unlock(&nanonet_flow_lock);
+
+    call_rcu(&entry->rcu, nanonet_flow_entry_free);
+    return 0;
+}
+
+void nanonet_flow_clear(void) {
+    struct nanonet_flow_entry *entry;
+    struct hlist_node *tmp;
+    int bkt;
+
+    mutex_lock(&nanonet_flow_lock);
+    hash_for_each_safe(nanonet_flow_hash, bkt, tmp, entry, node) {
+        hash_del_rcu(&entry->node);
+        nanonet_mc_leave(entry->flow.rule.dst_ip, entry->flow.rule.ingress_ifindex);
+        call_rcu(&entry->rcu, nanonet_flow_entry_free);
+    }
+    WRITE_ONCE(nanonet_flow_count, 0);
+    mutex_unlock(&nanonet_flow_lock);
+}
+
+// Rebuilds the rules whose egress device went away, came back or changed
+// address; a rule without a device stays in place but cannot send.
+void nanonet_flow_refresh(void) {
+    struct nanonet_flow_entry *entry, *fresh;
+    struct hlist_node *tmp;
+    int bkt;
+
+    mutex_lock(&nanonet_flow_lock);
+    hash_for_each_safe(nanonet_flow_hash, bkt, tmp, entry, node) {
+        if (!nanonet_dev_stale(&entry->flow)) {
+            continue;
+        }
+        fresh = nanonet_flow_entry_alloc(&entry->flow.rule);
+        if (!fresh) {
+            nanonet_log_error("Failed to rebuild flow %pI4:%u for device change", &entry->flow.rule.dst_ip,
+                              ntohs(entry->flow.rule.dst_port));
+            continue;
+        }
+        nanonet_throttle_inherit(&fresh->flow, &entry->flow);
+        hlist_replace_rcu(&entry->node, &fresh->node);
+        call_rcu(&entry->rcu, nanonet_flow_entry_free);
+    }
+    mutex_unlock(&nanonet_flow_lock);
+}
+
+void nanonet_flow_for_each(void (*fn)(const struct nanonet_flow_rule *rule, void *arg), void *arg) {
+    struct nanonet_flow_entry *entry;
+    int bkt;
+
+    mutex_lock(&nanonet_flow_lock);
+    hash_for_each(nanonet_flow_hash, bkt, entry, node) {
+        fn(&entry->flow.rule, arg);
+    }
+    mutex_unlock(&nanonet_flow_lock);
+}
+
+void nanonet_flow_show(struct seq_file *m) {
+    struct nanonet_flow_entry *entry;
+    char name[IFNAMSIZ];
+    int bkt;
+
+    mutex_lock(&nanonet_flow_lock);
+    seq_printf(m, "\nFlow Rules (%u):\n", nanonet_flow_count);
+    hash_for_each(nanonet_flow_hash, bkt, entry, node) {
+        const struct nanonet_flow_rule *rule = &entry->flow.rule;
+
+        seq_printf(m, "%s %pI4:%u logic=%u decoder=%s", rule->protocol == IPPROTO_TCP ? "tcp" : "udp",
+                   &rule->dst_ip, ntohs(rule->dst_port), rule->application_logic_type,
+                   rule->decoder == NANONET_DECODER_MOLDUDP64 ? "moldudp64" : "raw");
+        if (rule->channel) {
+            seq_printf(m, " channel=%u%c", rule->channel, rule->line == NANONET_LINE_B ? 'B' : 'A');
+        }
+        seq_printf(m, " from=%pI4:%u to=%pI4:%u",
+                   &rule->response_ip, ntohs(rule->response_port),
+                   rule->order_ip ? &rule->order_ip : &rule->dst_ip,
+                   ntohs(rule->order_ip ? rule->order_port : rule->dst_port));
+        if (rule->ingress_ifindex) {
+            nanonet_dev_name(rule->ingress_ifindex, name);
+            seq_printf(m, " in=%s", name);
+        }
+        seq_printf(m, " out=%s\n", entry->flow.out.dev ? entry->flow.out.dev->name : "(gone)");
+    }
+    mutex_unlock(&nanonet_flow_lock);
+}
@@ -5,6 +5,7 @@
 #include <linux/udp.h>
 #include <linux/if_ether.h>
 #include <linux/time.h>
+#include <net/checksum.h>
 #include "../include/nanonet.h"
 
 static inline u64 get_timestamp_ns(void) {
@@ -13,19 +14,38 @@ static inline u64 get_timestamp_ns(void) {
     return ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
-static inline int validate_checksum(void *data, int len, __sum16 check) {
-    __sum16 calc_check = nanonet_compute_checksum(data, len);
-    return calc_check == check ? 0 : -EINVAL;
+// Verify a TCP or UDP checksum against the pseudo-header. The NIC's verdict
+// is trusted when it has one: CHECKSUM_UNNECESSARY skips the check, and with
+// CHECKSUM_COMPLETE skb->csum already covers the packet from the IP header
+// on (a valid IP header sums to zero), so only the pseudo-header is added.
+// Otherwise fall back to the arch-optimized csum_partial().
+static inline int validate_l4_checksum(struct sk_buff *skb, struct ull_iphdr *ip, void *l4, int len,
+                                       u8 protocol) {
+    if (skb_csum_unnecessary(skb)) {
+        return 0;
+    }
+    if (skb->ip_summed == CHECKSUM_COMPLETE &&
+        !csum_tcpudp_magic(ip->saddr, ip->daddr, len, protocol, skb->csum)) {
+        return 0;
+    }
+    return csum_tcpudp_magic(ip->saddr, ip->daddr, len, protocol,
+                             csum_partial(l4, len, 0)) == 0 ? 0 : -EINVAL;
+}
+
+static inline int nanonet_parse_errno(int result) {
+    switch (-result) {
+        case NANONET_PARSE_NOT_IPV4:
+        case NANONET_PARSE_UNSUPPORTED_L4:
+            return -EPROTONOSUPPORT;
+        default:
+            return -EINVAL;
+    }
 }
 
 int ull_parse_packet(struct sk_buff *skb, struct ull_iphdr **ip_hdr, struct ull_tcphdr **tcp_hdr, struct ull_udphdr **udp_hdr,
                      void **payload, int *payload_len) {
-                        
-    struct ull_ethhdr *eth_hdr;
-    struct ull_iphdr *ip;
-    int ip_hdr_len;
-    void *transport_hdr;
-    int transport_hdr_len = 0;
+    struct nanonet_frame frame;
+    int result;
 
     *ip_hdr = NULL;
     *tcp_hdr = NULL;
@@ -33,91 +53,49 @@ int ull_parse_packet(struct sk_buff *skb, struct ull_iphdr **ip_hdr, struct ull_
     *payload = NULL;
     *payload_len = 0;
 
-    if (unlikely(skb->len < sizeof(struct ull_ethhdr))) {
-        return -EINVAL;
-    }
-
-    eth_hdr = (struct ull_ethhdr *)skb->data;
-    if (unlikely(ntohs(eth_hdr->h_proto) != ETH_P_IP)) {
-        return -EPROTONOSUPPORT;
-    }
-
-    if (unlikely(skb->len < sizeof(struct ull_ethhdr) + sizeof(struct ull_iphdr))) {
-        return -EINVAL;
-    }
-
-    ip = (struct ull_iphdr *)(skb->data + sizeof(struct ull_ethhdr));
-    *ip_hdr = ip;
-
-    if (unlikely((ip->version_ihl >> 4) != 4)) {
-        return -EPROTONOSUPPORT;
-    }
-
-    ip_hdr_len = (ip->version_ihl & 0x0F) * 4;
-    if (unlikely(ip_hdr_len < sizeof(struct ull_iphdr))) {
+    // Netfilter hands us skb->data at the network header; parse from the
+    // MAC header so that the XDP and user-space paths see the same frame.
+    if (unlikely(!skb_mac_header_was_set(skb))) {
         return -EINVAL;
     }
 
-    if (validate_checksum(ip, ip_hdr_len, ip->check) < 0) {
-        return -EINVAL;
+    result = nanonet_parse_frame(skb_mac_header(skb), skb_tail_pointer(skb), &frame);
+    if (unlikely(result < 0)) {
+        return nanonet_parse_errno(result);
     }
 
-    transport_hdr = (void *)ip + ip_hdr_len;
-
-    switch (ip->protocol) {
-        case IPPROTO_TCP:
-            if (unlikely(skb->len < sizeof(struct ull_ethhdr) + ip_hdr_len + sizeof(struct ull_tcphdr))) {
-                return -EINVAL;
-            }
-            *tcp_hdr = (struct ull_tcphdr *)transport_hdr;
-            transport_hdr_len = (*tcp_hdr)->doff * 4;
-            if (unlikely(transport_hdr_len < sizeof(struct ull_tcphdr))) {
-                return -EINVAL;
-            }
-            break;
-
-        case IPPROTO_UDP:
-            if (unlikely(skb->len < sizeof(struct ull_ethhdr) + ip_hdr_len + sizeof(struct ull_udphdr))) {
-                return -EINVAL;
-            }
-            *udp_hdr = (struct ull_udphdr *)transport_hdr;
-            transport_hdr_len = sizeof(struct ull_udphdr);
-            if (udp_hdr->check && validate_checksum(transport_hdr, ntohs(udp_hdr->len), udp_hdr->check) < 0) {
-                return -EINVAL;
-            }
-            break;
-
-        default:
-            return -EPROTONOSUPPORT;
+    // ip_rcv() has verified the IP header checksum before PRE_ROUTING.
+    if (frame.udp && frame.udp->check) {
+        int len = ntohs(frame.udp->len);
+
+        if (unlikely(len < sizeof(struct ull_udphdr) || (void *)frame.udp + len > (void *)skb_tail_pointer(skb))) {
+            return -EINVAL;
+        }
+        if (validate_l4_checksum(skb, frame.ip, frame.udp, len, IPPROTO_UDP) < 0) {
+            return -EINVAL;
+        }
+    } else if (frame.tcp) {
+        int len = ntohs(frame.ip->tot_len) - frame.ip_hdr_len;
+
+        if (unlikely(len < sizeof(struct ull_tcphdr) || (void *)frame.tcp + len > (void *)skb_tail_pointer(skb))) {
+            return -EINVAL;
+        }
+        if (validate_l4_checksum(skb, frame.ip, frame.tcp, len, IPPROTO_TCP) < 0) {
+            return -EINVAL;
+        }
     }
 
-    *payload = transport_hdr + transport_hdr_len;
-    *payload_len = skb->len - sizeof(struct ull_ethhdr) - ip_hdr_len - transport_hdr_len;
-
-    if (unlikely(*payload_len < 0)) {
-        *payload_len = 0;
-        *payload = NULL;
-    }
+    *ip_hdr = frame.ip;
+    *tcp_hdr = frame.tcp;
+    *udp_hdr = frame.udp;
+    *payload = frame.payload;
+    *payload_len = frame.payload_len;
 
     return 0;
 }
 
+// Internet checksum of an arbitrary buffer, using the architecture's
+// csum_partial() (wide loads with add-with-carry) rather than 16-bit steps.
 __sum16 nanonet_compute_checksum(void *data, int len) {
-    u32 sum = 0;
-    u16 *ptr = (u16 *)data;
-
-    while (len > 1) {
-        sum += *ptr++;
-        len -= 2;
-    }
-
-    if (len == 1) {
-        sum += *(u8 *)ptr << 8;
-    }
-
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
-
-    return (__sum16)~sum;
-}
\ No newline at end of file
+    return csum_fold(csum_partial(data, len, 0));
+}
@@ -9,6 +9,13 @@
 #include <linux/udp.h>
 #include <linux/time.h>
 #include <linux/netdevice.h>
+#include <linux/mutex.h>
+#include <linux/string.h>
+#include <linux/inetdevice.h>
+#include <linux/igmp.h>
+#include <linux/rtnetlink.h>
+#include <linux/numa.h>
+#include <linux/nodemask.h>
 #include <net/ip.h>
 #include "../include/nanonet.h"
 
@@ -17,132 +24,318 @@ MODULE_AUTHOR("Nikhil Singh");
 MODULE_DESCRIPTION("NanoNet: Ultra-Low Latency Networking Stack");
 MODULE_VERSION("1.0");
 
-// Global configuration and statistics
-struct ull_config global_config = {
-    .enabled = false,
-    .target_ip = 0,
-    .target_port = 0,
-    .protocol = IPPROTO_UDP,
-    .response_ip = 0,
-    .response_port = 0,
-    .application_logic_type = 0,
-    .multicast = false,
-    .multicast_group = 0,
-};
-
-struct ull_stats global_stats = {
-    .packets_processed = ATOMIC64_INIT(0),
-    .packets_bypassed = ATOMIC64_INIT(0),
-    .responses_sent = ATOMIC64_INIT(0),
-    .errors = ATOMIC64_INIT(0),
-    .min_process_time_ns = UINT64_MAX,
-    .max_process_time_ns = 0,
-    .avg_process_time_ns = 0,
-};
+static char *ingress_mode = "netfilter";
+module_param(ingress_mode, charp, 0444);
+MODULE_PARM_DESC(ingress_mode, "Ingress path at load time: netfilter (default) or xdp");
+
+char *nanonet_ifname = "eth0";
+module_param_named(ifname, nanonet_ifname, charp, 0444);
+MODULE_PARM_DESC(ifname, "Default network device for rules that name no ingress or egress device");
+
+bool nanonet_tx_direct = true;
+module_param_named(tx_direct, nanonet_tx_direct, bool, 0644);
+MODULE_PARM_DESC(tx_direct, "Send orders straight to the driver, bypassing the qdisc (default on)");
+
+unsigned int nanonet_event_ring_size = 4096;
+module_param_named(event_ring_size, nanonet_event_ring_size, uint, 0444);
+MODULE_PARM_DESC(event_ring_size, "Records per CPU in the mmap event rings, a power of two (default 4096, 0 disables)");
+
+unsigned int nanonet_inject_ring_size = 1024;
+module_param_named(inject_ring_size, nanonet_inject_ring_size, uint, 0444);
+MODULE_PARM_DESC(inject_ring_size, "Records in the mmap order injection ring, a power of two (default 1024, 0 disables)");
+
+bool nanonet_inject_poll;
+module_param_named(inject_poll, nanonet_inject_poll, bool, 0444);
+MODULE_PARM_DESC(inject_poll, "Drain the order injection ring from a polling kthread instead of on each kick (default off)");
+
+int nanonet_inject_cpu = -1;
+module_param_named(inject_cpu, nanonet_inject_cpu, int, 0444);
+MODULE_PARM_DESC(inject_cpu, "CPU to bind the injection kthread to (default -1, unbound)");
+
+char *nanonet_rx_worker_cpus = "";
+module_param_named(rx_worker_cpus, nanonet_rx_worker_cpus, charp, 0444);
+MODULE_PARM_DESC(rx_worker_cpus, "CPU list for busy-polling RX worker kthreads, e.g. 2-3 (default empty: process in softirq)");
+
+int nanonet_busy_poll_cpu = -1;
+module_param_named(busy_poll_cpu, nanonet_busy_poll_cpu, int, 0444);
+MODULE_PARM_DESC(busy_poll_cpu, "CPU for the NAPI busy-poll kthread (default -1, interrupt-driven receive)");
+
+unsigned int nanonet_busy_poll_idle_us = 1000;
+module_param_named(busy_poll_idle_us, nanonet_busy_poll_idle_us, uint, 0644);
+MODULE_PARM_DESC(busy_poll_idle_us, "Idle time after which the busy poller falls back to interrupts (default 1000)");
+
+unsigned int nanonet_busy_poll_budget = 8;
+module_param_named(busy_poll_budget, nanonet_busy_poll_budget, uint, 0444);
+MODULE_PARM_DESC(busy_poll_budget, "Packets per NAPI poll while busy polling (default 8)");
+
+int nanonet_numa_node = NUMA_NO_NODE;
+module_param_named(numa_node, nanonet_numa_node, int, 0444);
+MODULE_PARM_DESC(numa_node, "NUMA node for packet-path state (default -1: the node of the network device)");
+
+unsigned int nanonet_stats_refresh_ms = 1;
+module_param_named(stats_refresh_ms, nanonet_stats_refresh_ms, uint, 0444);
+MODULE_PARM_DESC(stats_refresh_ms, "Refresh interval of the mmap statistics page while mapped (default 1, rounded up to a jiffy)");
+
+unsigned long long nanonet_order_id_seed;
+module_param_named(order_id_seed, nanonet_order_id_seed, ullong, 0444);
+MODULE_PARM_DESC(order_id_seed, "Start of each CPU's client order ID sequence (default 0: the clock in milliseconds)");
+
+// Risk limits in force from load until NANONET_IOC_SET_RISK replaces them
+static unsigned int risk_max_order_quantity = 1000;
+module_param(risk_max_order_quantity, uint, 0444);
+MODULE_PARM_DESC(risk_max_order_quantity, "Initial largest quantity of a single order (default 1000, 0: no limit)");
+
+static unsigned int risk_max_orders_per_sec = 100;
+module_param(risk_max_orders_per_sec, uint, 0444);
+MODULE_PARM_DESC(risk_max_orders_per_sec, "Initial order rate limit per flow rule (default 100, 0: no limit)");
+
+static unsigned int risk_order_burst = 20;
+module_param(risk_order_burst, uint, 0444);
+MODULE_PARM_DESC(risk_order_burst, "Initial orders a flow rule may send back to back (default 20)");
 
 static struct nf_hook_ops nfho_in;
-static struct net_device *target_dev = NULL;
+// Serializes ingress mode changes, and config updates against them: both
+// check that XDP mode only ever runs a UDP config. Taken before
+// nanonet_config_lock.
+DEFINE_MUTEX(nanonet_ingress_mode_lock);
+static u32 current_ingress_mode = NANONET_INGRESS_NONE;
+static __be32 multicast_joined;
+static u32 multicast_ifindex;
 
 static inline u64 get_timestamp_ns(void) {
-    struct timespec64 ts;
-    ktime_get_real_ts64(&ts);
-    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    return ktime_get_ns();
+}
+
+static struct in_device *nanonet_mc_dev(u32 ifindex) {
+    struct net_device *dev = __dev_get_by_index(&init_net, ifindex ? ifindex : READ_ONCE(nanonet_ifindex));
+
+    return dev ? __in_dev_get_rtnl(dev) : NULL;
+}
+
+// Joins a multicast group on the ingress device (0 for ifname) so the NIC
+// delivers it. Joins are reference counted per group and device; every
+// join needs a leave with the same device. A device that is gone took its
+// joins with it.
+int nanonet_mc_join(__be32 group, u32 ifindex) {
+    struct in_device *in_dev;
+    int ret = -ENODEV;
+
+    if (!ipv4_is_multicast(group)) {
+        return 0;
+    }
+
+    rtnl_lock();
+    in_dev = nanonet_mc_dev(ifindex);
+    if (in_dev) {
+        ret = ip_mc_inc_group(in_dev, group);
+    }
+    rtnl_unlock();
+
+    return ret;
+}
+
+void nanonet_mc_leave(__be32 group, u32 ifindex) {
+    struct in_device *in_dev;
+
+    if (!ipv4_is_multicast(group)) {
+        return;
+    }
+
+    rtnl_lock();
+    in_dev = nanonet_mc_dev(ifindex);
+    if (in_dev) {
+        ip_mc_dec_group(in_dev, group);
+    }
+    rtnl_unlock();
 }
 
 static int init_multicast(void) {
-    if (!global_config.multicast || !target_dev) {
+    struct ull_config config;
+    int ret;
+
+    nanonet_config_copy(&config);
+    if (!config.multicast) {
         return 0;
     }
 
-    struct ip_mreqn mreq = {0};
-    mreq.imr_multiaddr.s_addr = global_config.multicast_group;
-    mreq.imr_ifindex = target_dev->ifindex;
+    ret = nanonet_mc_join(config.multicast_group, config.ingress_ifindex);
+    if (ret == 0) {
+        multicast_joined = config.multicast_group;
+        multicast_ifindex = config.ingress_ifindex;
+    }
+    return ret;
+}
 
-    return ip_mc_join_group(&init_net, &mreq);
+static void nanonet_mc_rejoin_rule(const struct nanonet_flow_rule *rule, void *arg) {
+    if (!rule->ingress_ifindex) {
+        nanonet_mc_join(rule->dst_ip, 0);
+    }
 }
 
-static unsigned int nanonet_hook(void *priv, struct sk_buff *skb, const struct nf_hook_state *state) {
+// Process context, after the ifname device was re-registered: joins every
+// group that follows ifname again on the new device. The old device's
+// joins went away with it.
+void nanonet_mc_rejoin(void) {
+    if (multicast_joined && !multicast_ifindex) {
+        nanonet_mc_join(multicast_joined, 0);
+    }
+    nanonet_flow_for_each(nanonet_mc_rejoin_rule, NULL);
+}
+
+static void cleanup_multicast(void) {
+    if (multicast_joined) {
+        nanonet_mc_leave(multicast_joined, multicast_ifindex);
+        multicast_joined = 0;
+    }
+}
+
+// Everything after classification: parse, validate, run the strategy and
+// send its orders. Returns NF_STOLEN once the tick has been consumed, or
+// NF_ACCEPT to leave skb to the caller. BHs off, under rcu_read_lock().
+unsigned int nanonet_process_packet(struct sk_buff *skb, const struct nanonet_flow *flow, u64 start_time) {
     struct ull_iphdr *ip_hdr;
     struct ull_tcphdr *tcp_hdr = NULL;
     struct ull_udphdr *udp_hdr = NULL;
     void *payload;
     int payload_len;
-    u64 start_time, end_time, process_time;
+    u64 end_time, process_time;
+    struct nanonet_cpu_stats *stats = nanonet_stats_this_cpu();
     int result;
 
-    if (!global_config.enabled || !skb->dev) {
-        atomic64_inc(&global_stats.packets_bypassed);
-        return NF_ACCEPT;
-    }
-
-    start_time = get_timestamp_ns();
-
     result = ull_parse_packet(skb, &ip_hdr, &tcp_hdr, &udp_hdr, &payload, &payload_len);
     if (result < 0) {
-        atomic64_inc(&global_stats.errors);
+        stats->errors++;
+        nanonet_event(NANONET_EVENT_ERROR, -result, NULL, flow);
         nanonet_log_error("Packet parsing failed: %d", result);
         return NF_ACCEPT;
     }
 
-    if (nanonet_validate_packet(skb, ip_hdr) < 0) {
-        atomic64_inc(&global_stats.errors);
-        return NF_ACCEPT;
-    }
-
-    if (ip_hdr->daddr != global_config.target_ip &&
-        (!global_config.multicast || ip_hdr->daddr != global_config.multicast_group)) {
-        atomic64_inc(&global_stats.packets_bypassed);
+    result = nanonet_validate_packet(skb, ip_hdr);
+    if (result < 0) {
+        stats->errors++;
+        nanonet_event(NANONET_EVENT_ERROR, -result, NULL, flow);
         return NF_ACCEPT;
     }
 
-    if (global_config.protocol == IPPROTO_TCP && tcp_hdr) {
-        if (tcp_hdr->dest != global_config.target_port) {
-            atomic64_inc(&global_stats.packets_bypassed);
-            return NF_ACCEPT;
-        }
+    if (tcp_hdr) {
         result = nanonet_track_tcp_connection(ip_hdr, tcp_hdr);
         if (result < 0) {
-            atomic64_inc(&global_stats.errors);
-            return NF_ACCEPT;
-        }
-    } else if (global_config.protocol == IPPROTO_UDP && udp_hdr) {
-        if (udp_hdr->dest != global_config.target_port) {
-            atomic64_inc(&global_stats.packets_bypassed);
+            stats->errors++;
+            nanonet_event(NANONET_EVENT_ERROR, -result, NULL, flow);
             return NF_ACCEPT;
         }
     }
 
-    result = nanonet_process_application_logic(payload, payload_len, &global_config);
+    result = nanonet_process_application_logic(payload, payload_len, flow);
+    nanonet_tx_flush();
     if (result < 0) {
-        atomic64_inc(&global_stats.errors);
+        stats->errors++;
+        nanonet_event(NANONET_EVENT_ERROR, -result, NULL, flow);
         nanonet_log_error("Application logic failed: %d", result);
     } else if (result > 0) {
-        atomic64_inc(&global_stats.responses_sent);
+        stats->responses_sent++;
     }
 
-    atomic64_inc(&global_stats.packets_processed);
+    stats->packets_processed++;
 
     end_time = get_timestamp_ns();
     process_time = end_time - start_time;
 
-    global_stats.last_process_time_ns = process_time;
-    if (process_time < global_stats.min_process_time_ns) {
-        global_stats.min_process_time_ns = process_time;
-    }
-    if (process_time > global_stats.max_process_time_ns) {
-        global_stats.max_process_time_ns = process_time;
-    }
-    global_stats.avg_process_time_ns =
-        (global_stats.avg_process_time_ns * (atomic64_read(&global_stats.packets_processed) - 1) + process_time) /
-        atomic64_read(&global_stats.packets_processed);
+    nanonet_stats_record_latency(stats, process_time);
 
     trace_nanonet_packet_processed(ip_hdr->saddr, tcp_hdr ? ntohs(tcp_hdr->source) : ntohs(udp_hdr->source),
                                     ip_hdr->daddr, tcp_hdr ? ntohs(tcp_hdr->dest) : ntohs(udp_hdr->dest),
                                     process_time, result );
 
+    // The tick is ours now, same as XDP_DROP on the XDP path.
+    consume_skb(skb);
     return NF_STOLEN;
 }
 
+static unsigned int nanonet_hook(void *priv, struct sk_buff *skb, const struct nf_hook_state *state) {
+    const struct nanonet_config_snapshot *snap = nanonet_config_snapshot();
+    const struct nanonet_flow *flow;
+
+    if (!snap->config.enabled || !skb->dev) {
+        nanonet_stats_this_cpu()->packets_bypassed++;
+        return NF_ACCEPT;
+    }
+
+    // Most traffic is not ours: reject it on the headers alone, before
+    // checksums and validation.
+    flow = nanonet_flow_classify(skb, snap);
+    if (!flow) {
+        nanonet_stats_this_cpu()->packets_bypassed++;
+        return NF_ACCEPT;
+    }
+
+    nanonet_busy_poll_note(skb);
+
+    // With RX workers the softirq only hands the tick over; the worker
+    // classifies it again under its own RCU read section.
+    if (nanonet_rx_workers_active()) {
+        nanonet_rx_enqueue(skb, get_timestamp_ns());
+        return NF_STOLEN;
+    }
+
+    return nanonet_process_packet(skb, flow, get_timestamp_ns());
+}
+
+u32 nanonet_get_ingress_mode(void) {
+    return READ_ONCE(current_ingress_mode);
+}
+
+int nanonet_set_ingress_mode(u32 mode) {
+    struct ull_config config;
+    int result = 0;
+
+    if (mode != NANONET_INGRESS_NETFILTER && mode != NANONET_INGRESS_XDP) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&nanonet_ingress_mode_lock);
+    if (mode == current_ingress_mode) {
+        goto out;
+    }
+
+    // The XDP program reflects UDP only; TCP needs the connection tracker.
+    nanonet_config_copy(&config);
+    if (mode == NANONET_INGRESS_XDP && config.protocol == IPPROTO_TCP) {
+        nanonet_log_error("XDP ingress mode supports UDP only");
+        result = -EOPNOTSUPP;
+        goto out;
+    }
+
+    if (mode == NANONET_INGRESS_NETFILTER) {
+        result = nf_register_net_hook(&init_net, &nfho_in);
+        if (result < 0) {
+            printk(KERN_ERR "NANONET: Failed to register netfilter hook\n");
+            goto out;
+        }
+    } else if (current_ingress_mode == NANONET_INGRESS_NETFILTER) {
+        // Frames now reach the XDP program before the skb exists; packets
+        // it passes must not be processed a second time here.
+        nf_unregister_net_hook(&init_net, &nfho_in);
+    }
+
+    WRITE_ONCE(current_ingress_mode, mode);
+    printk(KERN_INFO "NANONET: Ingress mode set to %s\n",
+           mode == NANONET_INGRESS_XDP ? "xdp" : "netfilter");
+
+out:
+    mutex_unlock(&nanonet_ingress_mode_lock);
+    return result;
+}
+
+static void nanonet_stop_ingress(void) {
+    mutex_lock(&nanonet_ingress_mode_lock);
+    if (current_ingress_mode == NANONET_INGRESS_NETFILTER) {
+        nf_unregister_net_hook(&init_net, &nfho_in);
+    }
+    current_ingress_mode = NANONET_INGRESS_NONE;
+    mutex_unlock(&nanonet_ingress_mode_lock);
+}
+
 extern int nanonet_control_init(void);
 extern void nanonet_control_cleanup(void);
 extern int nanonet_debug_init(void);
@@ -151,48 +344,143 @@ extern int nanonet_init_response_pool(void);
 extern void nanonet_cleanup_response_pool(void);
 
 static int __init nanonet_init(void) {
+    struct nanonet_risk_limits limits = {
+        .max_order_quantity = risk_max_order_quantity,
+        .max_orders_per_sec = risk_max_orders_per_sec,
+        .order_burst = risk_order_burst,
+    };
+    struct net_device *dev;
+    u32 mode;
     int result;
 
     printk(KERN_INFO "NANONET: Initializing ultra-low latency networking module\n");
 
-    target_dev = dev_get_by_name(&init_net, "eth0");
-    if (!target_dev) {
-        printk(KERN_ERR "NANONET: Failed to find network device\n");
+    nanonet_stats_init();
+    nanonet_order_ids_init();
+    nanonet_risk_set_limits(&limits);
+
+    if (strcmp(ingress_mode, "netfilter") == 0) {
+        mode = NANONET_INGRESS_NETFILTER;
+    } else if (strcmp(ingress_mode, "xdp") == 0) {
+        mode = NANONET_INGRESS_XDP;
+    } else {
+        printk(KERN_ERR "NANONET: Unknown ingress_mode '%s'\n", ingress_mode);
+        return -EINVAL;
+    }
+
+    // Rules hold their own device references; the default device is only
+    // remembered by index, so it can still be unregistered while loaded.
+    dev = dev_get_by_name(&init_net, nanonet_ifname);
+    if (!dev) {
+        printk(KERN_ERR "NANONET: Failed to find network device %s\n", nanonet_ifname);
         return -ENODEV;
     }
 
+    // Everything the packet path touches is allocated on the NIC's node
+    if (nanonet_numa_node == NUMA_NO_NODE) {
+        nanonet_numa_node = dev_to_node(&dev->dev);
+    } else if (nanonet_numa_node < 0 || nanonet_numa_node >= nr_node_ids || !node_online(nanonet_numa_node)) {
+        printk(KERN_ERR "NANONET: NUMA node %d is not online\n", nanonet_numa_node);
+        dev_put(dev);
+        return -EINVAL;
+    }
+    nanonet_ifindex = dev->ifindex;
+    dev_put(dev);
+
+    result = nanonet_events_init();
+    if (result < 0) {
+        printk(KERN_ERR "NANONET: Failed to allocate event rings\n");
+        return result;
+    }
+
+    result = nanonet_stats_page_init();
+    if (result < 0) {
+        printk(KERN_ERR "NANONET: Failed to allocate statistics page\n");
+        goto err_events;
+    }
+
+    result = nanonet_neigh_init();
+    if (result < 0) {
+        printk(KERN_ERR "NANONET: Failed to register neighbour event notifier\n");
+        goto err_stats_page;
+    }
+
+    result = nanonet_config_init();
+    if (result < 0) {
+        printk(KERN_ERR "NANONET: Failed to initialize configuration\n");
+        goto err_neigh;
+    }
+
+    result = nanonet_netdev_init();
+    if (result < 0) {
+        printk(KERN_ERR "NANONET: Failed to register netdevice notifier\n");
+        goto err_config;
+    }
+
+    result = nanonet_symbols_init();
+    if (result < 0) {
+        printk(KERN_ERR "NANONET: Failed to allocate symbol table\n");
+        goto err_netdev;
+    }
+
+    result = nanonet_arb_init();
+    if (result < 0) {
+        printk(KERN_ERR "NANONET: Failed to allocate feed arbitration channels\n");
+        goto err_symbols;
+    }
+
+    result = nanonet_builtin_strategies_init();
+    if (result < 0) {
+        printk(KERN_ERR "NANONET: Failed to register built-in strategies\n");
+        goto err_arb;
+    }
+
+    result = nanonet_conn_init();
+    if (result < 0) {
+        printk(KERN_ERR "NANONET: Failed to initialize connection tracker\n");
+        goto err_strategies;
+    }
+
     result = nanonet_init_response_pool();
     if (result < 0) {
         printk(KERN_ERR "NANONET: Failed to initialize response pool\n");
-        dev_put(target_dev);
-        return result;
+        goto err_conn;
+    }
+
+    result = nanonet_inject_init();
+    if (result < 0) {
+        printk(KERN_ERR "NANONET: Failed to set up order injection\n");
+        goto err_pool;
+    }
+
+    result = nanonet_rx_workers_init();
+    if (result < 0) {
+        printk(KERN_ERR "NANONET: Failed to start RX workers\n");
+        goto err_inject;
+    }
+
+    result = nanonet_busy_poll_init();
+    if (result < 0) {
+        printk(KERN_ERR "NANONET: Failed to start NAPI busy poller\n");
+        goto err_rx_workers;
     }
 
     result = nanonet_control_init();
     if (result < 0) {
         printk(KERN_ERR "NANONET: Failed to initialize control interface\n");
-        nanonet_cleanup_response_pool();
-        dev_put(target_dev);
-        return result;
+        goto err_busy_poll;
     }
 
     result = nanonet_debug_init();
     if (result < 0) {
         printk(KERN_ERR "NANONET: Failed to initialize debug interface\n");
-        nanonet_control_cleanup();
-        nanonet_cleanup_response_pool();
-        dev_put(target_dev);
-        return result;
+        goto err_control;
     }
 
     result = init_multicast();
     if (result < 0) {
         printk(KERN_ERR "NANONET: Failed to join multicast group\n");
-        nanonet_debug_cleanup();
-        nanonet_control_cleanup();
-        nanonet_cleanup_response_pool();
-        dev_put(target_dev);
-        return result;
+        goto err_debug;
     }
 
     nfho_in.hook = nanonet_hook;
@@ -200,32 +488,74 @@ static int __init nanonet_init(void) {
     nfho_in.pf = PF_INET;
     nfho_in.priority = NF_IP_PRI_FIRST;
 
-    result = nf_register_net_hook(&init_net, &nfho_in);
+    result = nanonet_set_ingress_mode(mode);
     if (result < 0) {
-        printk(KERN_ERR "NANONET: Failed to register netfilter hook\n");
-        nanonet_debug_cleanup();
-        nanonet_control_cleanup();
-        nanonet_cleanup_response_pool();
-        dev_put(target_dev);
-        return result;
+        goto err_multicast;
     }
 
     printk(KERN_INFO "NANONET: Module loaded successfully\n");
     printk(KERN_INFO "NANONET: Use /dev/nanonet for control or check /proc/nanonet for status\n");
 
     return 0;
+
+err_multicast:
+    cleanup_multicast();
+err_debug:
+    nanonet_debug_cleanup();
+err_control:
+    nanonet_control_cleanup();
+    nanonet_flow_clear();
+err_busy_poll:
+    nanonet_busy_poll_cleanup();
+err_rx_workers:
+    nanonet_rx_workers_cleanup();
+err_inject:
+    nanonet_inject_cleanup();
+err_pool:
+    nanonet_cleanup_response_pool();
+err_conn:
+    nanonet_conn_cleanup();
+err_strategies:
+    nanonet_builtin_strategies_cleanup();
+err_arb:
+    nanonet_arb_cleanup();
+err_symbols:
+    nanonet_symbols_cleanup();
+err_netdev:
+    nanonet_netdev_cleanup();
+err_config:
+    nanonet_config_cleanup();
+err_neigh:
+    nanonet_neigh_cleanup();
+err_stats_page:
+    nanonet_stats_page_cleanup();
+err_events:
+    nanonet_events_cleanup();
+    return result;
 }
 
 static void __exit nanonet_exit(void) {
     printk(KERN_INFO "NANONET: Unloading module\n");
 
-    nf_unregister_net_hook(&init_net, &nfho_in);
+    nanonet_stop_ingress();
+    nanonet_busy_poll_cleanup();
+    nanonet_rx_workers_cleanup();
+    // No device work may rejoin groups once they are being left
+    nanonet_netdev_cleanup();
+    nanonet_flow_clear();
+    cleanup_multicast();
     nanonet_debug_cleanup();
     nanonet_control_cleanup();
+    nanonet_inject_cleanup();
     nanonet_cleanup_response_pool();
-    if (target_dev) {
-        dev_put(target_dev);
-    }
+    nanonet_conn_cleanup();
+    nanonet_builtin_strategies_cleanup();
+    nanonet_arb_cleanup();
+    nanonet_symbols_cleanup();
+    nanonet_config_cleanup();
+    nanonet_neigh_cleanup();
+    nanonet_stats_page_cleanup();
+    nanonet_events_cleanup();
 
     printk(KERN_INFO "NANONET: Module unloaded successfully\n");
 }
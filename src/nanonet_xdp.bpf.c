@@ -0,0 +1,134 @@
+// XDP ingress path for NanoNet.
+//
+// Runs the shared parse/filter/market-data pipeline on raw frames before an
+// skb exists. Orders are written over the tick in place and sent back out
+// with XDP_TX (or XDP_REDIRECT to another port); everything that is not ours
+// goes up the stack with XDP_PASS.
+//
+// With cfg->xsk set, matching frames are redirected to the AF_XDP socket
+// bound to the receive queue instead (see tools/nanonet_xsk.c).
+//
+// The module's risk checks never see these orders. The kill switch sends
+// matching frames up the stack, and the quantity and rate limits are
+// checked here, for the AF_XDP engine too, before a tick that triggers an
+// order goes any further. Position and notional limits are not enforced.
+//
+// Build:  make xdp
+// Attach: ./tools/nanonet_xdp attach <ifname> [native|generic]
+
+#include <linux/bpf.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+#include "../include/nanonet_pipeline.h"
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct nanonet_xdp_config);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} nanonet_xdp_cfg SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct nanonet_xdp_stats);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} nanonet_xdp_stats SEC(".maps");
+
+// Theoretical arrival time of the order rate bucket
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u64);
+} nanonet_xdp_throttle SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_XSKMAP);
+    __uint(max_entries, NANONET_XSK_MAX_QUEUES);
+    __type(key, __u32);
+    __type(value, __u32);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} nanonet_xsks SEC(".maps");
+
+SEC("xdp")
+int nanonet_xdp(struct xdp_md *ctx) {
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+    struct nanonet_xdp_config *cfg;
+    struct nanonet_xdp_stats *stats;
+    struct nanonet_frame frame;
+    struct market_data *market;
+    struct trading_order order;
+    __u64 *tat;
+    __u32 key = 0;
+    int delta;
+
+    cfg = bpf_map_lookup_elem(&nanonet_xdp_cfg, &key);
+    stats = bpf_map_lookup_elem(&nanonet_xdp_stats, &key);
+    tat = bpf_map_lookup_elem(&nanonet_xdp_throttle, &key);
+    if (!cfg || !stats || !tat || !cfg->enabled || cfg->killed) {
+        return XDP_PASS;
+    }
+
+    if (nanonet_parse_frame(data, data_end, &frame) < 0 ||
+        !nanonet_frame_matches(&frame, cfg->target_ip, cfg->target_port, cfg->protocol,
+                               cfg->multicast, cfg->multicast_group)) {
+        stats->packets_bypassed++;
+        return XDP_PASS;
+    }
+
+    market = frame.payload;
+    if (frame.ip_hdr_len != sizeof(struct ull_iphdr) || !frame.udp ||
+        (void *)(market + 1) > data_end || frame.payload_len < (int)sizeof(*market)) {
+        if (cfg->xsk) {
+            // The engine counts it
+            return bpf_redirect_map(&nanonet_xsks, ctx->rx_queue_index, XDP_PASS);
+        }
+        stats->errors++;
+        return XDP_PASS;
+    }
+
+    if (nanonet_market_data_triggers(market) &&
+        !nanonet_xdp_risk_admit(cfg, tat, NANONET_ORDER_QUANTITY, bpf_ktime_get_ns())) {
+        stats->orders_rejected++;
+        return XDP_DROP;
+    }
+
+    if (cfg->xsk) {
+        return bpf_redirect_map(&nanonet_xsks, ctx->rx_queue_index, XDP_PASS);
+    }
+
+    stats->packets_processed++;
+    if (!nanonet_market_data_order(market, &order, bpf_ktime_get_ns())) {
+        return XDP_DROP;
+    }
+
+    // Resize the frame to exactly headers + order and re-derive the pointers.
+    delta = (int)sizeof(order) - (int)(data_end - frame.payload);
+    if (bpf_xdp_adjust_tail(ctx, delta) < 0) {
+        stats->errors++;
+        return XDP_DROP;
+    }
+
+    data = (void *)(long)ctx->data;
+    data_end = (void *)(long)ctx->data_end;
+    if (nanonet_parse_frame(data, data_end, &frame) < 0 || !frame.udp ||
+        frame.payload + sizeof(order) > data_end) {
+        stats->errors++;
+        return XDP_DROP;
+    }
+
+    __builtin_memcpy(frame.payload, &order, sizeof(order));
+    nanonet_reflect_udp_headers(&frame, cfg->h_source, cfg->response_ip, cfg->response_port, sizeof(order));
+    stats->responses_sent++;
+
+    if (cfg->redirect_ifindex) {
+        return bpf_redirect(cfg->redirect_ifindex, 0);
+    }
+    return XDP_TX;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,235 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/seq_file.h>
+#include <linux/netdevice.h>
+#include <net/route.h>
+#include <net/neighbour.h>
+#include <net/netevent.h>
+#include <net/arp.h>
+#include "../include/nanonet.h"
+
+// Next-hop MAC cache. Rules resolve their next hop (gateway or on-link
+// destination) with a route lookup when their headers are built, and keep
+// a pointer to the shared entry for it. The entry mirrors the kernel's ARP
+// entry: neighbour events rewrite it under its seqlock, and a work item
+// creates or re-probes ARP entries that are missing. The send path never
+// calls into the neighbour layer; an unresolved next hop costs the order
+// and a miss, and wakes the resolver.
+//
+// Entries are never freed before unload: there is one per next hop ever
+// used, and rules read them without a reference. Each is re-probed
+// whenever the resolver runs, so a dead ARP entry is replaced while the
+// last known address is still in use.
+static DEFINE_HASHTABLE(nanonet_neigh_hash, NANONET_NEIGH_HASH_BITS);
+static DEFINE_MUTEX(nanonet_neigh_lock);        // Entry creation
+static unsigned int nanonet_neigh_count;
+static unsigned int nanonet_neigh_failed;       // Rules left without an entry
+static DEFINE_PER_CPU(u64, nanonet_neigh_misses);
+
+static void nanonet_neigh_resolve_all(struct work_struct *work);
+static DECLARE_WORK(nanonet_neigh_work, nanonet_neigh_resolve_all);
+
+static inline u32 nanonet_neigh_key(__be32 nexthop, u32 ifindex) {
+    return jhash_2words((__force u32)nexthop, ifindex, 0);
+}
+
+// Caller holds rcu_read_lock() or nanonet_neigh_lock.
+static struct nanonet_neigh *nanonet_neigh_find(__be32 nexthop, u32 ifindex) {
+    struct nanonet_neigh *entry;
+
+    hash_for_each_possible_rcu(nanonet_neigh_hash, entry, node, nanonet_neigh_key(nexthop, ifindex)) {
+        if (entry->nexthop == nexthop && entry->ifindex == ifindex) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void nanonet_neigh_set(struct nanonet_neigh *entry, const u8 *mac, bool valid) {
+    write_seqlock_bh(&entry->lock);
+    if (valid) {
+        memcpy(entry->mac, mac, ETH_ALEN);
+    }
+    entry->valid = valid;
+    entry->updates++;
+    write_sequnlock_bh(&entry->lock);
+}
+
+// Copies n into entry if its address is usable. STALE, DELAY and PROBE
+// still carry the last confirmed address, which the kernel itself keeps
+// sending to while it re-probes.
+static bool nanonet_neigh_copy(struct nanonet_neigh *entry, struct neighbour *n) {
+    u8 mac[ETH_ALEN];
+
+    if (!(READ_ONCE(n->nud_state) & NUD_VALID)) {
+        return false;
+    }
+    neigh_ha_snapshot((char *)mac, n, n->dev);
+    nanonet_neigh_set(entry, mac, true);
+    return true;
+}
+
+// Process context. Looks entry's next hop up in the ARP table, creating it
+// if needed, and starts resolution if it has no usable address. entry keeps
+// what it had until the answer arrives as a neighbour event.
+static void nanonet_neigh_resolve(struct nanonet_neigh *entry, struct net_device *dev) {
+    struct neighbour *n;
+
+    n = __neigh_lookup(&arp_tbl, &entry->nexthop, dev, true);
+    if (IS_ERR_OR_NULL(n)) {
+        return;
+    }
+    if (!nanonet_neigh_copy(entry, n)) {
+        neigh_event_send(n, NULL);
+    }
+    neigh_release(n);
+}
+
+static void nanonet_neigh_resolve_all(struct work_struct *work) {
+    struct nanonet_neigh *entry;
+    struct net_device *dev;
+    int bkt;
+
+    mutex_lock(&nanonet_neigh_lock);
+    hash_for_each(nanonet_neigh_hash, bkt, entry, node) {
+        dev = dev_get_by_index(&init_net, entry->ifindex);
+        if (dev) {
+            nanonet_neigh_resolve(entry, dev);
+            dev_put(dev);
+        }
+    }
+    mutex_unlock(&nanonet_neigh_lock);
+}
+
+// Send path: an order was dropped for an unresolved next hop.
+void nanonet_neigh_miss(void) {
+    this_cpu_inc(nanonet_neigh_misses);
+    schedule_work(&nanonet_neigh_work);
+}
+
+// Returns the cache entry for the next hop towards daddr out of dev,
+// creating it and starting resolution if needed, or NULL if the cache is
+// full or out of memory; the rule then cannot send. Process context, when
+// a rule's headers are built.
+struct nanonet_neigh *nanonet_neigh_get(struct net_device *dev, __be32 daddr) {
+    struct flowi4 fl4 = {
+        .daddr = daddr,
+        .flowi4_oif = dev->ifindex,
+    };
+    struct nanonet_neigh *entry;
+    struct rtable *rt;
+    __be32 nexthop = daddr;
+
+    rt = ip_route_output_key(dev_net(dev), &fl4);
+    if (!IS_ERR(rt)) {
+        nexthop = rt_nexthop(rt, daddr);
+        ip_rt_put(rt);
+    }
+
+    mutex_lock(&nanonet_neigh_lock);
+    entry = nanonet_neigh_find(nexthop, dev->ifindex);
+    if (entry) {
+        goto out;
+    }
+    if (nanonet_neigh_count >= NANONET_NEIGH_MAX) {
+        nanonet_log_error("Neighbour cache full (%d next hops)", NANONET_NEIGH_MAX);
+        goto out;
+    }
+    entry = kzalloc_node(sizeof(*entry), GFP_KERNEL, nanonet_numa_node);
+    if (!entry) {
+        nanonet_log_error("Failed to allocate next hop %pI4", &nexthop);
+        goto out;
+    }
+    seqlock_init(&entry->lock);
+    entry->nexthop = nexthop;
+    entry->ifindex = dev->ifindex;
+    hash_add_rcu(nanonet_neigh_hash, &entry->node, nanonet_neigh_key(nexthop, dev->ifindex));
+    nanonet_neigh_count++;
+
+out:
+    if (!entry) {
+        nanonet_neigh_failed++;
+    } else if (!READ_ONCE(entry->valid)) {
+        nanonet_neigh_resolve(entry, dev);
+    }
+    mutex_unlock(&nanonet_neigh_lock);
+    return entry;
+}
+
+// Atomic notifier chain, often from softirq.
+static int nanonet_neigh_event(struct notifier_block *nb, unsigned long event, void *ptr) {
+    struct neighbour *n = ptr;
+    struct nanonet_neigh *entry;
+
+    if (event != NETEVENT_NEIGH_UPDATE || n->tbl != &arp_tbl || !net_eq(dev_net(n->dev), &init_net)) {
+        return NOTIFY_DONE;
+    }
+
+    rcu_read_lock();
+    entry = nanonet_neigh_find(*(__be32 *)n->primary_key, n->dev->ifindex);
+    if (entry) {
+        if (n->dead) {
+            // Garbage collected: keep sending to the last address while
+            // the resolver puts a live entry back
+            schedule_work(&nanonet_neigh_work);
+        } else if (!nanonet_neigh_copy(entry, n) && (READ_ONCE(n->nud_state) & NUD_FAILED)) {
+            nanonet_neigh_set(entry, NULL, false);
+        }
+    }
+    rcu_read_unlock();
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block nanonet_neigh_notifier = {
+    .notifier_call = nanonet_neigh_event,
+};
+
+void nanonet_neigh_show(struct seq_file *m) {
+    struct nanonet_neigh *entry;
+    u64 misses = 0;
+    u8 mac[ETH_ALEN];
+    bool valid;
+    int bkt, cpu;
+
+    for_each_possible_cpu(cpu) {
+        misses += READ_ONCE(*per_cpu_ptr(&nanonet_neigh_misses, cpu));
+    }
+
+    mutex_lock(&nanonet_neigh_lock);
+    seq_printf(m, "\nNext Hops (%u, %llu misses, %u rules without an entry):\n", nanonet_neigh_count, misses,
+               nanonet_neigh_failed);
+    hash_for_each(nanonet_neigh_hash, bkt, entry, node) {
+        valid = nanonet_neigh_read(entry, mac);
+        seq_printf(m, "%pI4 if%u: %pM%s, %llu updates\n", &entry->nexthop, entry->ifindex, mac,
+                   valid ? "" : " (unresolved)", READ_ONCE(entry->updates));
+    }
+    mutex_unlock(&nanonet_neigh_lock);
+}
+
+int nanonet_neigh_init(void) {
+    return register_netevent_notifier(&nanonet_neigh_notifier);
+}
+
+// Every rule is gone by now, so nothing still points at an entry, and the
+// notifier is past its last call once unregistered.
+void nanonet_neigh_cleanup(void) {
+    struct nanonet_neigh *entry;
+    struct hlist_node *tmp;
+    int bkt;
+
+    unregister_netevent_notifier(&nanonet_neigh_notifier);
+    cancel_work_sync(&nanonet_neigh_work);
+
+    mutex_lock(&nanonet_neigh_lock);
+    hash_for_each_safe(nanonet_neigh_hash, bkt, tmp, entry, node) {
+        hash_del(&entry->node);
+        kfree(entry);
+    }
+    nanonet_neigh_count = 0;
+    mutex_unlock(&nanonet_neigh_lock);
+}
@@ -0,0 +1,150 @@
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/notifier.h>
+#include <linux/workqueue.h>
+#include <net/net_namespace.h>
+#include "../include/nanonet.h"
+
+// Network devices. Every published flow and config resolves its egress
+// device once, when it is built, and holds a (tracked) reference to it for
+// as long as it is visible, so the send path never looks a device up by
+// name or index. A netdevice notifier catches devices that go away or
+// change address; the rules that use them are rebuilt from a work item,
+// since the notifier runs under RTNL and rule updates take RTNL themselves
+// for multicast joins.
+int nanonet_ifindex;            // The ifname device, resolved at load and on re-registration
+static bool nanonet_ifname_moved;
+
+// A re-registered ifname device has a new index and none of the joins the
+// old one took with it.
+static void nanonet_netdev_refresh(struct work_struct *work) {
+    if (xchg(&nanonet_ifname_moved, false)) {
+        nanonet_mc_rejoin();
+    }
+    nanonet_config_refresh();
+    nanonet_flow_refresh();
+}
+
+static DECLARE_WORK(nanonet_netdev_work, nanonet_netdev_refresh);
+
+static inline u32 nanonet_dev_ifindex(u32 ifindex) {
+    return ifindex ? ifindex : READ_ONCE(nanonet_ifindex);
+}
+
+// Resolves ifindex (0 for the ifname device) into ref. Returns -ENODEV and
+// leaves ref empty if no such device is registered.
+int nanonet_dev_hold(struct nanonet_dev_ref *ref, u32 ifindex) {
+    struct net_device *dev;
+
+    rcu_read_lock();
+    dev = dev_get_by_index_rcu(&init_net, nanonet_dev_ifindex(ifindex));
+    if (dev) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+        netdev_hold(dev, &ref->tracker, GFP_ATOMIC);
+#else
+        dev_hold(dev);
+#endif
+    }
+    rcu_read_unlock();
+
+    ref->dev = dev;
+    return dev ? 0 : -ENODEV;
+}
+
+// Process context or RCU callback, once no reader can still see ref.
+void nanonet_dev_release(struct nanonet_dev_ref *ref) {
+    if (!ref->dev) {
+        return;
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+    netdev_put(ref->dev, &ref->tracker);
+#else
+    dev_put(ref->dev);
+#endif
+    ref->dev = NULL;
+}
+
+// True if flow was built for a device that is no longer registered, one
+// that has since appeared, or an address its headers no longer carry.
+bool nanonet_dev_stale(const struct nanonet_flow *flow) {
+    const struct ull_ethhdr *eth = (const struct ull_ethhdr *)flow->tmpl.data;
+    struct net_device *dev;
+    bool stale;
+
+    rcu_read_lock();
+    dev = dev_get_by_index_rcu(&init_net, nanonet_dev_ifindex(flow->rule.egress_ifindex));
+    stale = dev != flow->out.dev ||
+            (dev && flow->tmpl.len && !ether_addr_equal(dev->dev_addr, eth->h_source));
+    rcu_read_unlock();
+    return stale;
+}
+
+// Ingress devices are only compared by index; check the index is real.
+int nanonet_dev_check(u32 ifindex) {
+    int ret = 0;
+
+    if (!ifindex) {
+        return 0;
+    }
+    rcu_read_lock();
+    if (!dev_get_by_index_rcu(&init_net, ifindex)) {
+        ret = -ENODEV;
+    }
+    rcu_read_unlock();
+    return ret;
+}
+
+// name must hold IFNAMSIZ bytes.
+void nanonet_dev_name(u32 ifindex, char *name) {
+    struct net_device *dev;
+
+    rcu_read_lock();
+    dev = dev_get_by_index_rcu(&init_net, nanonet_dev_ifindex(ifindex));
+    if (dev) {
+        strscpy(name, dev->name, IFNAMSIZ);
+    } else {
+        snprintf(name, IFNAMSIZ, "if%u", nanonet_dev_ifindex(ifindex));
+    }
+    rcu_read_unlock();
+}
+
+static int nanonet_netdev_event(struct notifier_block *nb, unsigned long event, void *ptr) {
+    struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+
+    if (!net_eq(dev_net(dev), &init_net)) {
+        return NOTIFY_DONE;
+    }
+
+    switch (event) {
+        case NETDEV_REGISTER:
+            // The ifname device came back, e.g. after a driver reload
+            if (!strcmp(dev->name, nanonet_ifname) && dev->ifindex != READ_ONCE(nanonet_ifindex)) {
+                WRITE_ONCE(nanonet_ifindex, dev->ifindex);
+                WRITE_ONCE(nanonet_ifname_moved, true);
+                printk(KERN_INFO "NANONET: %s re-registered as index %d\n", dev->name, dev->ifindex);
+            }
+            schedule_work(&nanonet_netdev_work);
+            break;
+        case NETDEV_UNREGISTER:
+        case NETDEV_CHANGEADDR:
+            // Unregistration waits for our references to be dropped
+            schedule_work(&nanonet_netdev_work);
+            break;
+    }
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block nanonet_netdev_notifier = {
+    .notifier_call = nanonet_netdev_event,
+};
+
+int nanonet_netdev_init(void) {
+    return register_netdevice_notifier(&nanonet_netdev_notifier);
+}
+
+void nanonet_netdev_cleanup(void) {
+    unregister_netdevice_notifier(&nanonet_netdev_notifier);
+    cancel_work_sync(&nanonet_netdev_work);
+}
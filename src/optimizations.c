@@ -4,26 +4,14 @@
 #include <linux/interrupt.h>
 #include <linux/prefetch.h>
 #include <linux/numa.h>
+#include <linux/workqueue.h>
+#include <linux/delay.h>
+#include <linux/seq_file.h>
+#include <linux/netdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/topology.h>
 #include "../include/nanonet.h"
 
-DEFINE_PER_CPU(struct ull_stats, per_cpu_stats);
-#define RING_BUFFER_SIZE 1024
-
-struct packet_ring_buffer {
-    volatile unsigned long head;
-    volatile unsigned long tail;
-    struct sk_buff *packets[RING_BUFFER_SIZE];
-} ____cacheline_aligned;
-
-static DEFINE_PER_CPU(struct packet_ring_buffer, packet_ring);
-
-void nanonet_set_cpu_affinity(void) {
-    struct cpumask mask;
-    cpumask_clear(&mask);
-    cpumask_set_cpu(0, &mask);
-    set_cpus_allowed_ptr(current, &mask);
-}
-
 static inline int nanonet_parse_packet_optimized(struct sk_buff *skb, struct ull_iphdr **ip_hdr,
                                                 void **payload, int *payload_len) {
 
@@ -91,75 +79,344 @@ static inline int nanonet_parse_packet_optimized(struct sk_buff *skb, struct ull
     return 0;
 }
 
+static long nanonet_vmalloc_user_fn(void *arg) {
+    return (long)vmalloc_user(*(size_t *)arg);
+}
+
+// vmalloc_user() takes no node, but its pages come from the node of the
+// CPU it runs on; so run it on a CPU of node.
+void *nanonet_vmalloc_user_node(size_t size, int node) {
+    unsigned int cpu = nr_cpu_ids;
+
+    if (node != NUMA_NO_NODE) {
+        cpu = cpumask_any_and(cpumask_of_node(node), cpu_online_mask);
+    }
+    if (cpu >= nr_cpu_ids) {
+        return vmalloc_user(size);
+    }
+    return (void *)work_on_cpu(cpu, nanonet_vmalloc_user_fn, &size);
+}
+
+static void nanonet_numa_show_cpu(struct seq_file *m, const char *name, int cpu) {
+    if (cpu < 0 || cpu >= nr_cpu_ids) {
+        return;
+    }
+    seq_printf(m, "%s CPU %d: node %d%s\n", name, cpu, cpu_to_node(cpu),
+               cpu_to_node(cpu) == nanonet_numa_node ? "" : " (remote)");
+}
+
+void nanonet_numa_show(struct seq_file *m) {
+    seq_printf(m, "\nNUMA:\n");
+    seq_printf(m, "Node: %d (%s)\n", nanonet_numa_node, nanonet_ifname);
+    if (nanonet_numa_node != NUMA_NO_NODE) {
+        seq_printf(m, "Node CPUs: %*pbl\n", cpumask_pr_args(cpumask_of_node(nanonet_numa_node)));
+    }
+    nanonet_numa_show_cpu(m, "Busy Poll", nanonet_busy_poll_cpu);
+    if (nanonet_inject_poll) {
+        nanonet_numa_show_cpu(m, "Inject", nanonet_inject_cpu);
+    }
+}
+
 #define RESPONSE_POOL_SIZE 256
-static struct {
-    struct sk_buff *pool[RESPONSE_POOL_SIZE];
-    atomic_t head;
-    atomic_t tail;
-    spinlock_t lock;
-} response_pool __aligned(PAGE_SIZE);
+#define RESPONSE_POOL_LOW_WATERMARK 32
+#define RESPONSE_SKB_SIZE 1500
+
+// Per-CPU response pool. Only the owning CPU touches skbs[]/count, always with
+// BHs disabled, so the fast path needs no lock. Skbs handed out carry a
+// destructor that tops the pool back up once the driver has released them.
+struct response_skb_pool {
+    struct sk_buff *skbs[RESPONSE_POOL_SIZE];
+    unsigned int count;
+    int cpu;
+    bool active;
+    u64 hits;
+    u64 misses;
+    u64 refills;
+    u64 low_watermark_events;
+    long in_flight;
+    struct work_struct refill_work;
+} ____cacheline_aligned;
+
+static DEFINE_PER_CPU(struct response_skb_pool, response_pools);
+
+static struct sk_buff *nanonet_alloc_pool_skb(int cpu, gfp_t gfp) {
+    return __alloc_skb(RESPONSE_SKB_SIZE, gfp, 0, cpu_to_node(cpu));
+}
+
+static void nanonet_response_pool_refill(struct work_struct *work) {
+    struct response_skb_pool *pool = container_of(work, struct response_skb_pool, refill_work);
+    struct sk_buff *skb;
+    bool stored;
+
+    while (READ_ONCE(pool->count) < RESPONSE_POOL_SIZE) {
+        skb = nanonet_alloc_pool_skb(pool->cpu, GFP_KERNEL);
+        if (!skb) {
+            break;
+        }
+
+        stored = false;
+        local_bh_disable();
+        if (smp_processor_id() == pool->cpu && READ_ONCE(pool->active) &&
+            pool->count < RESPONSE_POOL_SIZE) {
+            pool->skbs[pool->count++] = skb;
+            pool->refills++;
+            stored = true;
+        }
+        local_bh_enable();
+
+        if (!stored) {
+            kfree_skb(skb);
+            break;
+        }
+    }
+}
 
 int nanonet_init_response_pool(void) {
-    int i;
-    unsigned long flags;
-
-    spin_lock_init(&response_pool.lock);
-    atomic_set(&response_pool.head, 0);
-    atomic_set(&response_pool.tail, 0);
-
-    for (i = 0; i < RESPONSE_POOL_SIZE; i++) {
-        response_pool.pool[i] = alloc_skb(1500, GFP_KERNEL | __GFP_NUMA);
-        if (!response_pool.pool[i]) {
-            nanonet_log_error("Failed to allocate skb for response pool at index %d", i);
-            while (--i >= 0) {
-                kfree_skb(response_pool.pool[i]);
+    struct response_skb_pool *pool;
+    int cpu;
+
+    // Every pool is set up before any is filled, so that cleanup after a
+    // failed allocation finds an initialised work item on every CPU.
+    for_each_possible_cpu(cpu) {
+        pool = per_cpu_ptr(&response_pools, cpu);
+        memset(pool, 0, sizeof(*pool));
+        pool->cpu = cpu;
+        INIT_WORK(&pool->refill_work, nanonet_response_pool_refill);
+    }
+
+    for_each_possible_cpu(cpu) {
+        pool = per_cpu_ptr(&response_pools, cpu);
+        while (pool->count < RESPONSE_POOL_SIZE) {
+            struct sk_buff *skb = nanonet_alloc_pool_skb(cpu, GFP_KERNEL);
+            if (!skb) {
+                nanonet_log_error("Failed to allocate skb for response pool on CPU %d", cpu);
+                nanonet_cleanup_response_pool();
+                return -ENOMEM;
             }
-            return -ENOMEM;
+            pool->skbs[pool->count++] = skb;
         }
+        WRITE_ONCE(pool->active, true);
     }
 
     return 0;
 }
 
 void nanonet_cleanup_response_pool(void) {
-    int i;
-    unsigned long flags;
+    struct response_skb_pool *pool;
+    long in_flight;
+    int cpu, waited = 0;
+
+    for_each_possible_cpu(cpu) {
+        WRITE_ONCE(per_cpu_ptr(&response_pools, cpu)->active, false);
+    }
 
-    spin_lock_irqsave(&response_pool.lock, flags);
-    for (i = 0; i < RESPONSE_POOL_SIZE; i++) {
-        if (response_pool.pool[i]) {
-            kfree_skb(response_pool.pool[i]);
-            response_pool.pool[i] = NULL;
+    // Destructors of skbs still queued in drivers point into this module,
+    // so unloading waits for every one of them, however long a stalled
+    // queue holds on to its skbs.
+    for (;;) {
+        in_flight = 0;
+        for_each_possible_cpu(cpu) {
+            in_flight += READ_ONCE(per_cpu_ptr(&response_pools, cpu)->in_flight);
         }
+        if (in_flight <= 0) {
+            break;
+        }
+        if (++waited % 1000 == 0) {
+            nanonet_log_error("Waiting for %ld response skbs still in flight", in_flight);
+        }
+        msleep(10);
     }
+    // The last destructor may still be returning; softirqs are RCU readers
+    synchronize_rcu();
 
-    atomic_set(&response_pool.head, 0);
-    atomic_set(&response_pool.tail, 0);
-    spin_unlock_irqrestore(&response_pool.lock, flags);
+    for_each_possible_cpu(cpu) {
+        pool = per_cpu_ptr(&response_pools, cpu);
+        cancel_work_sync(&pool->refill_work);
+        while (pool->count > 0) {
+            kfree_skb(pool->skbs[--pool->count]);
+            pool->skbs[pool->count] = NULL;
+        }
+    }
 }
 
-struct sk_buff *nanonet_get_response_skb(void) {
-    unsigned long flags;
-    int head, tail;
+// Returns a pool skb with at least len bytes of tailroom, or NULL if the
+// pool is empty or its skbs are too small, for the caller to allocate one.
+// Must be called with BHs disabled (the netfilter hook runs in softirq).
+struct sk_buff *nanonet_get_response_skb(unsigned int len) {
+    struct response_skb_pool *pool = this_cpu_ptr(&response_pools);
+    struct sk_buff *skb;
 
-    spin_lock_irqsave(&response_pool.lock, flags);
-    head = atomic_read(&response_pool.head);
-    tail = atomic_read(&response_pool.tail);
+    if (unlikely(pool->count <= RESPONSE_POOL_LOW_WATERMARK)) {
+        pool->low_watermark_events++;
+        if (READ_ONCE(pool->active)) {
+            schedule_work_on(pool->cpu, &pool->refill_work);
+        }
+        if (pool->count == 0) {
+            pool->misses++;
+            return NULL;
+        }
+    }
 
-    if (((head + 1) % RESPONSE_POOL_SIZE) == tail) {
-        spin_unlock_irqrestore(&response_pool.lock, flags);
-        nanonet_log_error("Response pool empty");
+    // Sized for a standard MTU, so jumbo orders are left to the caller
+    if (unlikely(skb_tailroom(pool->skbs[pool->count - 1]) < len)) {
         return NULL;
     }
 
-    struct sk_buff *skb = response_pool.pool[head];
-    response_pool.pool[head] = NULL;    // Clear to prevent double-free
-    atomic_set(&response_pool.head, (head + 1) % RESPONSE_POOL_SIZE);
-    spin_unlock_irqrestore(&response_pool.lock, flags);
+    skb = pool->skbs[--pool->count];
+    pool->skbs[pool->count] = NULL;    // Clear to prevent double-free
+    pool->hits++;
 
     return skb;
 }
 
+static void nanonet_response_skb_destructor(struct sk_buff *skb) {
+    struct response_skb_pool *pool;
+    struct sk_buff *fresh;
+
+    // Runs on the TX completion CPU once the driver drops the skb. Refilling
+    // here keeps the slab round trip off the order path.
+    if (in_serving_softirq()) {
+        pool = this_cpu_ptr(&response_pools);
+        if (READ_ONCE(pool->active) && pool->count < RESPONSE_POOL_SIZE) {
+            fresh = nanonet_alloc_pool_skb(pool->cpu, GFP_ATOMIC);
+            if (fresh) {
+                pool->skbs[pool->count++] = fresh;
+                pool->refills++;
+            }
+        }
+    }
+
+    // Last, so cleanup cannot drain the pool while we add to it
+    this_cpu_dec(response_pools.in_flight);
+}
+
+void nanonet_track_response_skb(struct sk_buff *skb) {
+    skb->destructor = nanonet_response_skb_destructor;
+    this_cpu_inc(response_pools.in_flight);
+}
+
+void nanonet_response_pool_show(struct seq_file *m) {
+    struct response_skb_pool *pool;
+    int cpu;
+
+    seq_printf(m, "%-5s %-6s %-12s %-12s %-12s %-12s %-10s\n",
+               "CPU", "Free", "Hits", "Misses", "Refills", "LowWater", "InFlight");
+    for_each_online_cpu(cpu) {
+        pool = per_cpu_ptr(&response_pools, cpu);
+        seq_printf(m, "%-5d %-6u %-12llu %-12llu %-12llu %-12llu %-10ld\n",
+                   cpu, READ_ONCE(pool->count), READ_ONCE(pool->hits), READ_ONCE(pool->misses),
+                   READ_ONCE(pool->refills), READ_ONCE(pool->low_watermark_events),
+                   READ_ONCE(pool->in_flight));
+    }
+}
+
+// Orders produced while handling one tick, sent together by
+// nanonet_tx_flush(). Only the owning CPU touches a burst, with BHs disabled.
+struct nanonet_tx_burst {
+    struct sk_buff *skbs[NANONET_TX_BURST];
+    unsigned int count;
+    u64 direct;
+    u64 fallback;
+    u64 dropped;
+    u64 bursts;
+} ____cacheline_aligned;
+
+static DEFINE_PER_CPU(struct nanonet_tx_burst, nanonet_tx_bursts);
+
+// Hand skbs[0..n) straight to the driver the way pktgen does: one TX queue
+// lock for the burst and xmit_more on all but the last, so the doorbell is
+// written once. Each CPU uses its own queue. Returns how many skbs the
+// driver took; the rest are still ours.
+//
+// Whatever the driver took with xmit_more set must still be kicked when
+// the burst ends early. A driver that stops its queue while taking an skb
+// writes the doorbell itself, as xmit_more requires. One that answers
+// NETDEV_TX_BUSY instead gets the same skb once more without xmit_more.
+// That either goes out or at least flushes the queue before we fall back.
+static int nanonet_xmit_direct(struct net_device *dev, struct sk_buff **skbs, int n) {
+    int cpu = smp_processor_id();
+    u16 queue = cpu % dev->real_num_tx_queues;
+    struct netdev_queue *txq = netdev_get_tx_queue(dev, queue);
+    netdev_tx_t rc;
+    bool more;
+    int sent = 0;
+
+    HARD_TX_LOCK(dev, txq, cpu);
+    while (sent < n) {
+        if (netif_xmit_frozen_or_drv_stopped(txq)) {
+            break;
+        }
+        skb_set_queue_mapping(skbs[sent], queue);
+        more = sent + 1 < n;
+        rc = netdev_start_xmit(skbs[sent], dev, txq, more);
+        if (unlikely(!dev_xmit_complete(rc)) && sent && more) {
+            rc = netdev_start_xmit(skbs[sent], dev, txq, false);
+        }
+        if (!dev_xmit_complete(rc)) {
+            break;    // NETDEV_TX_BUSY: the driver did not take it
+        }
+        sent++;
+    }
+    HARD_TX_UNLOCK(dev, txq);
+
+    return sent;
+}
+
+void nanonet_tx_flush(void) {
+    struct nanonet_tx_burst *burst = this_cpu_ptr(&nanonet_tx_bursts);
+    struct net_device *dev;
+    unsigned int i, sent = 0;
+
+    if (!burst->count) {
+        return;
+    }
+
+    dev = burst->skbs[0]->dev;
+    if (READ_ONCE(nanonet_tx_direct) && netif_running(dev)) {
+        sent = nanonet_xmit_direct(dev, burst->skbs, burst->count);
+    }
+    burst->direct += sent;
+
+    // Queue stopped, driver busy or direct mode off: the qdisc path queues
+    // what the driver could not take and rings the doorbell for the rest.
+    for (i = sent; i < burst->count; i++) {
+        if (net_xmit_eval(nanonet_raw_send(burst->skbs[i], dev)) == NET_XMIT_SUCCESS) {
+            burst->fallback++;
+        } else {
+            burst->dropped++;
+            nanonet_log_error("Failed to send response on %s", dev->name);
+        }
+    }
+
+    burst->bursts++;
+    burst->count = 0;
+}
+
+// Takes ownership of skb. It goes out at the next nanonet_tx_flush(), or
+// now if the burst is full or bound for another device.
+void nanonet_tx_queue(struct sk_buff *skb) {
+    struct nanonet_tx_burst *burst = this_cpu_ptr(&nanonet_tx_bursts);
+
+    if (burst->count == NANONET_TX_BURST || (burst->count && burst->skbs[0]->dev != skb->dev)) {
+        nanonet_tx_flush();
+    }
+    burst->skbs[burst->count++] = skb;
+}
+
+void nanonet_tx_show(struct seq_file *m) {
+    struct nanonet_tx_burst *burst;
+    int cpu;
+
+    seq_printf(m, "\nTransmit (%s)\n", READ_ONCE(nanonet_tx_direct) ? "direct" : "qdisc");
+    seq_printf(m, "%-5s %-12s %-12s %-12s %-12s\n", "CPU", "Bursts", "Direct", "Fallback", "Dropped");
+    for_each_online_cpu(cpu) {
+        burst = per_cpu_ptr(&nanonet_tx_bursts, cpu);
+        seq_printf(m, "%-5d %-12llu %-12llu %-12llu %-12llu\n", cpu,
+                   READ_ONCE(burst->bursts), READ_ONCE(burst->direct),
+                   READ_ONCE(burst->fallback), READ_ONCE(burst->dropped));
+    }
+}
+
 int nanonet_raw_send(struct sk_buff *skb, struct net_device *dev) {
     if (!skb || !dev) {
         if (skb) kfree_skb(skb);
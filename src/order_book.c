@@ -0,0 +1,107 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/seq_file.h>
+#include "../include/nanonet_strategy.h"
+
+// Each side is a sorted array of at most NANONET_BOOK_DEPTH levels in one
+// cache line: bids by descending price, asks by ascending, so the best
+// price is always slot 0. Levels past levels[side] are kept zeroed. A level
+// worse than the last one of a full side is outside the top N and is
+// ignored; deleting a level does not bring back deeper ones.
+
+static inline bool nanonet_book_better(int side, u32 a, u32 b) {
+    return side == NANONET_BOOK_BID ? a > b : a < b;
+}
+
+static void nanonet_book_set_locked(struct nanonet_book *book, int side, u32 price, u32 quantity) {
+    struct nanonet_book_level *levels = book->side[side];
+    int n = book->levels[side];
+    int i;
+
+    for (i = 0; i < n && nanonet_book_better(side, levels[i].price, price); i++) {
+    }
+
+    if (i < n && levels[i].price == price) {
+        if (quantity) {
+            levels[i].quantity = quantity;
+        } else {
+            memmove(&levels[i], &levels[i + 1], (n - i - 1) * sizeof(*levels));
+            levels[n - 1].price = 0;
+            levels[n - 1].quantity = 0;
+            book->levels[side] = n - 1;
+        }
+        return;
+    }
+
+    if (!quantity || i == NANONET_BOOK_DEPTH) {
+        return;    // Deleting an unknown level, or below the top N
+    }
+
+    // Insert at i, pushing the worst level out of a full side.
+    if (n == NANONET_BOOK_DEPTH) {
+        n--;
+    }
+    memmove(&levels[i + 1], &levels[i], (n - i) * sizeof(*levels));
+    levels[i].price = price;
+    levels[i].quantity = quantity;
+    book->levels[side] = n + 1;
+}
+
+void nanonet_book_set(struct nanonet_book *book, int side, u32 price, u32 quantity) {
+    if (unlikely(side != NANONET_BOOK_BID && side != NANONET_BOOK_ASK)) {
+        return;
+    }
+
+    write_seqlock(&book->lock);
+    nanonet_book_set_locked(book, side, price, quantity);
+    book->updates++;
+    write_sequnlock(&book->lock);
+}
+EXPORT_SYMBOL_GPL(nanonet_book_set);
+
+void nanonet_book_clear(struct nanonet_book *book) {
+    write_seqlock(&book->lock);
+    memset(book->side, 0, sizeof(book->side));
+    book->levels[NANONET_BOOK_BID] = 0;
+    book->levels[NANONET_BOOK_ASK] = 0;
+    book->updates++;
+    write_sequnlock(&book->lock);
+}
+EXPORT_SYMBOL_GPL(nanonet_book_clear);
+
+void nanonet_book_read(const struct nanonet_book *book, struct nanonet_book_view *view) {
+    unsigned int seq;
+
+    do {
+        seq = read_seqbegin(&book->lock);
+        view->levels[NANONET_BOOK_BID] = book->levels[NANONET_BOOK_BID];
+        view->levels[NANONET_BOOK_ASK] = book->levels[NANONET_BOOK_ASK];
+        memcpy(view->side, book->side, sizeof(view->side));
+    } while (read_seqretry(&book->lock, seq));
+}
+EXPORT_SYMBOL_GPL(nanonet_book_read);
+
+struct nanonet_book *nanonet_book_alloc(void) {
+    struct nanonet_book *book = kzalloc_node(sizeof(*book), GFP_KERNEL, nanonet_numa_node);
+
+    if (book) {
+        seqlock_init(&book->lock);
+    }
+    return book;
+}
+
+void nanonet_book_free(struct nanonet_book *book) {
+    kfree(book);
+}
+
+// One line: best bid and ask with their depth, for the symbols listing.
+void nanonet_book_show(struct seq_file *m, const struct nanonet_book *book) {
+    struct nanonet_book_view view;
+
+    nanonet_book_read(book, &view);
+    seq_printf(m, "%u@%u/%u@%u (%u/%u levels)",
+               view.side[NANONET_BOOK_BID][0].quantity, view.side[NANONET_BOOK_BID][0].price,
+               view.side[NANONET_BOOK_ASK][0].quantity, view.side[NANONET_BOOK_ASK][0].price,
+               view.levels[NANONET_BOOK_BID], view.levels[NANONET_BOOK_ASK]);
+}
@@ -0,0 +1,232 @@
+#include <linux/kernel.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/seq_file.h>
+#include "../include/nanonet.h"
+
+// Order injection. Records are copied out of the shared ring before they
+// are used, so nothing user space writes later can change an order after
+// its flow was looked up; the risk checks then run on the copy in the skb.
+// The consumer index the module acts on is its own.
+#define NANONET_INJECT_BUDGET 64            // Orders per TX burst and lock hold
+#define NANONET_INJECT_IDLE_NS 100000       // Poller spins this long before sleeping
+
+struct nanonet_inject_ring {
+    struct nanonet_inject_ring_hdr *hdr;
+    struct nanonet_inject_order *records;
+    u64 consumer;
+    u32 mask;
+    size_t bytes;
+};
+
+static struct nanonet_inject_ring nanonet_inject_ring;
+static DEFINE_SPINLOCK(nanonet_inject_lock);    // One consumer at a time
+static DECLARE_WAIT_QUEUE_HEAD(nanonet_inject_wait);
+static struct task_struct *nanonet_inject_task;
+
+static const struct nanonet_flow *nanonet_inject_flow(const struct nanonet_inject_order *rec) {
+    const struct nanonet_config_snapshot *snap;
+    const struct ull_config *config;
+    const struct nanonet_flow *flow;
+
+    flow = nanonet_flow_lookup(rec->flow_ip, rec->flow_port, rec->flow_protocol);
+    if (flow) {
+        return flow;
+    }
+
+    snap = nanonet_config_snapshot();
+    config = &snap->config;
+    if (config->target_ip && rec->flow_protocol == config->protocol && rec->flow_port == config->target_port &&
+        (rec->flow_ip == config->target_ip || (config->multicast && rec->flow_ip == config->multicast_group))) {
+        return &snap->flow;
+    }
+    return NULL;
+}
+
+// Sends up to NANONET_INJECT_BUDGET pending orders in one TX burst.
+// Returns how many records were consumed.
+static int nanonet_inject_drain(void) {
+    struct nanonet_inject_ring *ring = &nanonet_inject_ring;
+    struct nanonet_inject_ring_hdr *hdr = ring->hdr;
+    struct nanonet_inject_order rec;
+    const struct nanonet_flow *flow;
+    u64 prod, sent = 0, rejected = 0, failed = 0;
+    int n = 0, ret;
+
+    spin_lock_bh(&nanonet_inject_lock);
+    prod = smp_load_acquire(&hdr->producer);
+    if (prod == ring->consumer) {
+        spin_unlock_bh(&nanonet_inject_lock);
+        return 0;
+    }
+    if (unlikely(prod - ring->consumer > (u64)ring->mask + 1)) {
+        // Producer index is garbage; resynchronize rather than replay
+        nanonet_log_error("Order injection ring overrun, skipping to %llu", prod);
+        ring->consumer = prod;
+        failed++;
+        goto out;
+    }
+
+    rcu_read_lock();
+    for (; ring->consumer != prod && n < NANONET_INJECT_BUDGET; ring->consumer++, n++) {
+        memcpy(&rec, &ring->records[ring->consumer & ring->mask], sizeof(rec));
+
+        flow = nanonet_inject_flow(&rec);
+        if (unlikely(!flow)) {
+            failed++;
+            continue;
+        }
+
+        ret = nanonet_send_response(&rec.order, sizeof(rec.order), flow);
+        if (likely(ret == 0)) {
+            sent++;
+        } else if (ret == -EPERM) {
+            rejected++;
+        } else {
+            failed++;
+        }
+    }
+    nanonet_tx_flush();
+    rcu_read_unlock();
+
+out:
+    WRITE_ONCE(hdr->sent, hdr->sent + sent);
+    WRITE_ONCE(hdr->rejected, hdr->rejected + rejected);
+    WRITE_ONCE(hdr->failed, hdr->failed + failed);
+    // The producer may reuse the slots once it sees this
+    smp_store_release(&hdr->consumer, ring->consumer);
+    spin_unlock_bh(&nanonet_inject_lock);
+    return n;
+}
+
+static bool nanonet_inject_pending(void) {
+    return READ_ONCE(nanonet_inject_ring.hdr->producer) != READ_ONCE(nanonet_inject_ring.consumer);
+}
+
+// Busy-polls the ring. After NANONET_INJECT_IDLE_NS with nothing to send
+// it asks the producer for a kick and sleeps until one arrives.
+static int nanonet_inject_thread(void *data) {
+    struct nanonet_inject_ring_hdr *hdr = nanonet_inject_ring.hdr;
+    u64 idle_since = local_clock();
+
+    while (!kthread_should_stop()) {
+        if (nanonet_inject_drain()) {
+            idle_since = local_clock();
+            cond_resched();
+            continue;
+        }
+
+        if (local_clock() - idle_since < NANONET_INJECT_IDLE_NS) {
+            cpu_relax();
+            cond_resched();
+            continue;
+        }
+
+        WRITE_ONCE(hdr->flags, READ_ONCE(hdr->flags) | NANONET_RING_NEED_WAKEUP);
+        smp_mb();
+        wait_event_interruptible(nanonet_inject_wait, kthread_should_stop() || nanonet_inject_pending());
+        WRITE_ONCE(hdr->flags, READ_ONCE(hdr->flags) & ~NANONET_RING_NEED_WAKEUP);
+        idle_since = local_clock();
+    }
+    return 0;
+}
+
+// NANONET_IOC_INJECT_KICK: wake the poller, or drain the ring here.
+int nanonet_inject_kick(void) {
+    if (!nanonet_inject_ring.hdr) {
+        return -ENODEV;
+    }
+    if (nanonet_inject_task) {
+        wake_up_interruptible(&nanonet_inject_wait);
+        return 0;
+    }
+
+    while (nanonet_inject_drain() == NANONET_INJECT_BUDGET) {
+        cond_resched();
+    }
+    return 0;
+}
+
+int nanonet_inject_mmap(struct vm_area_struct *vma) {
+    struct nanonet_inject_ring *ring = &nanonet_inject_ring;
+
+    if (!ring->hdr) {
+        return -ENODEV;
+    }
+    if (vma->vm_end - vma->vm_start > PAGE_ALIGN(ring->bytes)) {
+        return -EINVAL;
+    }
+    return remap_vmalloc_range(vma, ring->hdr, 0);
+}
+
+void nanonet_inject_show(struct seq_file *m) {
+    struct nanonet_inject_ring_hdr *hdr = nanonet_inject_ring.hdr;
+
+    if (!hdr) {
+        return;
+    }
+    seq_printf(m, "\nOrder Injection:\n");
+    seq_printf(m, "Ring Size: %u records (%s)\n", hdr->size, nanonet_inject_task ? "polled" : "doorbell");
+    seq_printf(m, "Orders Sent: %llu\n", READ_ONCE(hdr->sent));
+    seq_printf(m, "Orders Rejected: %llu\n", READ_ONCE(hdr->rejected));
+    seq_printf(m, "Orders Failed: %llu\n", READ_ONCE(hdr->failed));
+}
+
+int nanonet_inject_init(void) {
+    struct nanonet_inject_ring *ring = &nanonet_inject_ring;
+    struct task_struct *task;
+    int node = nanonet_numa_node;
+
+    if (!nanonet_inject_ring_size) {
+        return 0;
+    }
+    nanonet_inject_ring_size = roundup_pow_of_two(clamp_t(unsigned int, nanonet_inject_ring_size, 64,
+                                                          NANONET_EVENT_RING_MAX));
+
+    ring->bytes = sizeof(*ring->hdr) + (size_t)nanonet_inject_ring_size * sizeof(struct nanonet_inject_order);
+    // Near the poller if it has a CPU, otherwise near the NIC
+    if (nanonet_inject_poll && nanonet_inject_cpu >= 0 && nanonet_inject_cpu < nr_cpu_ids) {
+        node = cpu_to_node(nanonet_inject_cpu);
+    }
+    ring->hdr = nanonet_vmalloc_user_node(ring->bytes, node);
+    if (!ring->hdr) {
+        return -ENOMEM;
+    }
+    ring->records = (struct nanonet_inject_order *)(ring->hdr + 1);
+    ring->mask = nanonet_inject_ring_size - 1;
+    ring->consumer = 0;
+    ring->hdr->size = nanonet_inject_ring_size;
+    // Without a poller every batch needs a kick
+    ring->hdr->flags = nanonet_inject_poll ? 0 : NANONET_RING_NEED_WAKEUP;
+
+    if (!nanonet_inject_poll) {
+        return 0;
+    }
+
+    task = kthread_create(nanonet_inject_thread, NULL, "nanonet_inject");
+    if (IS_ERR(task)) {
+        nanonet_inject_cleanup();
+        return PTR_ERR(task);
+    }
+    if (nanonet_inject_cpu >= 0 && nanonet_inject_cpu < nr_cpu_ids && cpu_online(nanonet_inject_cpu)) {
+        kthread_bind(task, nanonet_inject_cpu);
+    }
+    nanonet_inject_task = task;
+    wake_up_process(task);
+    return 0;
+}
+
+// The device is gone by now, so nothing can kick or still map the ring.
+void nanonet_inject_cleanup(void) {
+    if (nanonet_inject_task) {
+        kthread_stop(nanonet_inject_task);
+        nanonet_inject_task = NULL;
+    }
+    vfree(nanonet_inject_ring.hdr);
+    nanonet_inject_ring.hdr = NULL;
+}
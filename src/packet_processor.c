@@ -1,4 +1,5 @@
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/skbuff.h>
 #include <linux/netdevice.h>
 #include <linux/if_ether.h>
@@ -6,34 +7,46 @@
 #include <linux/tcp.h>
 #include <linux/udp.h>
 #include <linux/time.h>
-#include "../include/nanonet.h"
-
-struct market_data {
-    char symbol[8];
-    u32 price;          // Price in cents
-    u32 quantity;
-    u64 timestamp;
-} __packed;
-
-struct trading_order {
-    char symbol[8];
-    u32 price;
-    u32 quantity;
-    u8 side;            // 0 = buy, 1 = sell
-    u64 timestamp;
-    char clOrdId[16];   // Client order ID
-} __packed;
+#include <linux/percpu.h>
+#include "../include/nanonet_strategy.h"
+
+// Per-CPU client order ID generators, seeded at load from order_id_seed,
+// or from the clock in milliseconds; nanonet_pipeline.h explains when
+// the clock alone keeps IDs from repeating across reloads.
+static DEFINE_PER_CPU(struct nanonet_order_id_gen, nanonet_order_ids);
+
+void nanonet_order_ids_init(void) {
+    u64 seed = nanonet_order_id_seed ? nanonet_order_id_seed : nanonet_order_id_clock_seed(ktime_get_real_ns());
+    int cpu;
+
+    printk(KERN_INFO "NANONET: Order ID sequence starts at %09llu\n", seed % 1000000000ULL);
+
+    for_each_possible_cpu(cpu) {
+        nanonet_order_id_init(per_cpu_ptr(&nanonet_order_ids, cpu), cpu, seed);
+    }
+}
+
+// Next client order ID of this CPU, for strategies. Softirq context.
+void nanonet_next_order_id(char *out) {
+    nanonet_order_id_next(this_cpu_ptr(&nanonet_order_ids), out);
+}
+EXPORT_SYMBOL_GPL(nanonet_next_order_id);
 
 static u64 get_timestamp_ns(void) {
-    struct timespec64 ts;
-    ktime_get_real_ts64(&ts);
-    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    return ktime_get_real_ns();
 }
 
-static int process_market_data(void *payload, int payload_len, struct ull_config *config, void **response_data, int *response_len) {
-   
+// Built-in strategy 0: buy when a tick prices below the threshold, or sell
+// above it, with the symbol's own parameters when it has any. Encodes the
+// order straight into the payload area of the response skb: no heap
+// allocation, no formatting and no intermediate copy.
+static int nanonet_threshold_tick(void *state, void *payload, int payload_len, const struct nanonet_flow *flow) {
     struct market_data *market;
     struct trading_order *order;
+    struct nanonet_symbol *sym;
+    struct nanonet_symbol_params params;
+    struct sk_buff *skb;
+    int result;
 
     if (!payload || payload_len < sizeof(struct market_data)) {
         nanonet_log_error("Invalid market data size: %d", payload_len);
@@ -41,61 +54,74 @@ static int process_market_data(void *payload, int payload_len, struct ull_config
     }
 
     market = (struct market_data *)payload;
-    if (!market) {
-        nanonet_log_error("Null market data pointer");
-        return -EINVAL;
-    }
-
-    if (market->price < 10000) {            // $100.00 threshold
-        order = kmalloc(sizeof(struct trading_order), GFP_ATOMIC);
-        if (!order) {
-            nanonet_log_error("Failed to allocate memory for order");
-            return -ENOMEM;
+    sym = nanonet_symbol_lookup(market->symbol);
+    if (sym) {
+        nanonet_symbol_read(sym, &params);
+        WRITE_ONCE(sym->last_price, market->price);
+        WRITE_ONCE(sym->last_timestamp, market->timestamp);
+        atomic64_inc(&sym->ticks);
+        if (!params.enabled ||
+            (params.side ? market->price <= params.price_threshold : market->price >= params.price_threshold)) {
+            return 0;
         }
+    } else if (!nanonet_market_data_triggers(market)) {
+        return 0;
+    }
 
-        memcpy(order->symbol, market->symbol, 8);
-        order->price = market->price + 1; // Bid 1 cent higher
-        order->quantity = 100;
-        order->side = 0;                  // Buy
-        order->timestamp = get_timestamp_ns();
-        snprintf(order->clOrdId, sizeof(order->clOrdId), "ORD%llu", order->timestamp);
+    skb = nanonet_response_begin(sizeof(struct trading_order), flow, (void **)&order);
+    if (!skb) {
+        return -ENOMEM;
+    }
 
-        *response_data = order;
-        *response_len = sizeof(struct trading_order);
+    nanonet_market_data_fill(market, order, get_timestamp_ns());
+    if (sym) {
+        order->price = params.side ? market->price - 1 : market->price + 1;
+        order->quantity = params.quantity;
+        order->side = params.side;
+    }
+    nanonet_next_order_id(order->clOrdId);
 
-        return 1;
+    result = nanonet_response_finish(skb, sizeof(struct trading_order), flow);
+    if (result < 0) {
+        return result;
+    }
+    if (sym) {
+        atomic64_inc(&sym->orders);
     }
+    return 1;
+}
+
+static struct nanonet_strategy nanonet_threshold_strategy = {
+    .name = "threshold",
+    .id = 0,
+    .on_tick = nanonet_threshold_tick,
+};
+
+int nanonet_builtin_strategies_init(void) {
+    return nanonet_strategy_register(&nanonet_threshold_strategy);
+}
 
-    return 0;
+void nanonet_builtin_strategies_cleanup(void) {
+    nanonet_strategy_unregister(&nanonet_threshold_strategy);
 }
 
-int nanonet_process_application_logic(void *payload, int payload_len, struct ull_config *config) {
-    void *response_data = NULL;
-    int response_len = 0;
-    int result = 0;
+// Decodes the payload and runs the strategy bound to flow on each message.
+// Caller holds rcu_read_lock().
+int nanonet_process_application_logic(void *payload, int payload_len, const struct nanonet_flow *flow) {
+    int result;
 
     if (!payload || payload_len <= 0) {
         return 0;
     }
 
-    switch (config->application_logic_type) {
-        case 0:                         // Market data processing
-            result = process_market_data(payload, payload_len, config,
-                                        &response_data, &response_len);
-            break;
-
-        default:
-            nanonet_log_error("Unknown application logic type: %d", config->application_logic_type);
-            return -EINVAL;
-    }
-
-    if (result > 0 && response_data) {
-        result = nanonet_send_response(NULL, response_data, response_len, config);
-        kfree(response_data);
-        if (result < 0) {
-            nanonet_log_error("Failed to send response: %d", result);
-        }
+    result = nanonet_feed_decode(payload, payload_len, flow);
+    if (result == -EPERM) {
+        return 0;    // Order rejected by the risk checks, which count it
+    } else if (result == -ENOENT) {
+        nanonet_log_error("No strategy registered for logic type %u", flow->rule.application_logic_type);
+    } else if (result < 0) {
+        nanonet_log_error("Strategy %u failed: %d", flow->rule.application_logic_type, result);
     }
 
     return result;
-}
\ No newline at end of file
+}
@@ -1,4 +1,5 @@
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/skbuff.h>
 #include <linux/netdevice.h>
 #include <linux/if_ether.h>
@@ -8,42 +9,119 @@
 #include <linux/route.h>
 #include <net/ip.h>
 #include <net/route.h>
+#include <net/checksum.h>
 #include "../include/nanonet.h"
 
-static struct sk_buff *nanonet_create_response_packet(struct sk_buff *orig_skb,
-                                                    void *response_data,
-                                                    int response_len,
-                                                    struct ull_config *config) {
-    struct sk_buff *new_skb;
-    struct ull_ethhdr *orig_eth = NULL, *new_eth;
-    struct ull_iphdr *orig_ip = NULL, *new_ip;
-    struct ull_tcphdr *orig_tcp = NULL, *new_tcp;
-    struct ull_udphdr *orig_udp = NULL, *new_udp;
-    int total_len;
-    int ip_hdr_len = sizeof(struct ull_iphdr);
+// IP ID of the next packet. Kept per CPU so the send path never writes to
+// the shared, read-mostly config or flow rules. TCP sequence numbers are
+// per rule, in its throttle, since each rule is its own stream.
+static DEFINE_PER_CPU(u16, nanonet_ip_id);
+
+#define NANONET_TX_IP_OFFSET sizeof(struct ull_ethhdr)
+#define NANONET_TX_L4_OFFSET (NANONET_TX_IP_OFFSET + sizeof(struct ull_iphdr))
+
+// Fill in everything that is fixed for rule: MACs, addresses, ports, TTL,
+// DF and the IP checksum over a header whose tot_len covers the headers
+// alone and whose id is 0. Called from process context whenever a rule or
+// the config is (re)installed, or its egress device dev changes.
+void nanonet_tx_template_build(struct nanonet_tx_template *tmpl, const struct nanonet_flow_rule *rule,
+                               struct net_device *dev) {
+    struct ull_ethhdr *eth = (struct ull_ethhdr *)tmpl->data;
+    struct ull_iphdr *ip = (struct ull_iphdr *)(tmpl->data + NANONET_TX_IP_OFFSET);
     int transport_hdr_len;
-    void *payload_ptr;
-    struct net_device *dev = NULL;
+    __be16 dest_port;
 
-    if (config->response_ip == 0 || config->response_port == 0) {
-        nanonet_log_error("Invalid response IP or port");
-        return NULL;
-    }
+    memset(tmpl, 0, sizeof(*tmpl));
 
-    if (config->protocol == IPPROTO_TCP) {
+    if (rule->response_ip == 0 || rule->response_port == 0) {
+        return;
+    }
+    if (rule->protocol == IPPROTO_TCP) {
         transport_hdr_len = sizeof(struct ull_tcphdr);
-    } else if (config->protocol == IPPROTO_UDP) {
+    } else if (rule->protocol == IPPROTO_UDP) {
         transport_hdr_len = sizeof(struct ull_udphdr);
     } else {
-        nanonet_log_error("Unsupported protocol: %d", config->protocol);
-        return NULL;
+        return;
     }
 
-    total_len = sizeof(struct ull_ethhdr) + ip_hdr_len + transport_hdr_len + response_len;
+    ip->version_ihl = 0x45;
+    ip->tot_len = htons(sizeof(struct ull_iphdr) + transport_hdr_len);
+    ip->frag_off = htons(IP_DF);
+    ip->ttl = 64;
+    ip->protocol = rule->protocol;
+    ip->saddr = rule->response_ip;
+    ip->daddr = rule->order_ip ? rule->order_ip : rule->dst_ip;
+    ip->check = nanonet_compute_checksum(ip, sizeof(struct ull_iphdr));
+
+    // A multicast destination maps to a fixed MAC; anything else goes to
+    // the cached MAC of its next hop, filled in per order. Without a cache
+    // entry there is no MAC to send to, so the rule gets no template.
+    if (dev) {
+        memcpy(eth->h_source, dev->dev_addr, ETH_ALEN);
+        if (ipv4_is_multicast(ip->daddr)) {
+            ip_eth_mc_map(ip->daddr, eth->h_dest);
+        } else {
+            tmpl->neigh = nanonet_neigh_get(dev, ip->daddr);
+            if (!tmpl->neigh) {
+                memset(tmpl, 0, sizeof(*tmpl));
+                return;
+            }
+        }
+    }
+    eth->h_proto = htons(ETH_P_IP);
+
+    dest_port = rule->order_ip ? rule->order_port : rule->dst_port;
+    if (rule->protocol == IPPROTO_TCP) {
+        struct ull_tcphdr *tcp = (struct ull_tcphdr *)(tmpl->data + NANONET_TX_L4_OFFSET);
+
+        tcp->source = rule->response_port;
+        tcp->dest = dest_port;
+        tcp->doff = sizeof(struct ull_tcphdr) / 4;
+        tcp->psh = 1;
+        tcp->window = htons(65535);
+    } else {
+        struct ull_udphdr *udp = (struct ull_udphdr *)(tmpl->data + NANONET_TX_L4_OFFSET);
+
+        udp->source = rule->response_port;
+        udp->dest = dest_port;
+    }
 
-    new_skb = nanonet_get_response_skb();
+    tmpl->len = NANONET_TX_L4_OFFSET + transport_hdr_len;
+}
+
+// Copy the prebuilt headers of flow and patch the per-packet fields. The IP
+// checksum is updated incrementally (RFC 1624) for tot_len and id only.
+static struct sk_buff *nanonet_create_response_packet(int response_len, const struct nanonet_flow *flow,
+                                                      void **payload) {
+    const struct nanonet_tx_template *tmpl = &flow->tmpl;
+    unsigned int frame_len = tmpl->len + response_len;
+    struct sk_buff *new_skb;
+    struct ull_iphdr *ip;
+    u8 dest[ETH_ALEN];
+    __be16 tot_len, id;
+
+    if (unlikely(!tmpl->len)) {
+        nanonet_log_error("Invalid response IP, port, protocol or next hop");
+        return NULL;
+    }
+    if (unlikely(!flow->out.dev)) {
+        nanonet_log_error("Egress device of flow is gone");
+        return NULL;
+    }
+    // Orders are never fragmented
+    if (unlikely(frame_len - NANONET_TX_IP_OFFSET > READ_ONCE(flow->out.dev->mtu))) {
+        nanonet_log_error("Response of %d bytes exceeds the MTU of %s", response_len, flow->out.dev->name);
+        return NULL;
+    }
+    // Counted, never waited for: ARP runs in the background
+    if (tmpl->neigh && unlikely(!nanonet_neigh_read(tmpl->neigh, dest))) {
+        nanonet_neigh_miss();
+        return NULL;
+    }
+
+    new_skb = nanonet_get_response_skb(NET_IP_ALIGN + frame_len);
     if (!new_skb) {
-        new_skb = alloc_skb(total_len + NET_IP_ALIGN, GFP_ATOMIC);
+        new_skb = alloc_skb(NET_IP_ALIGN + NANONET_TX_TEMPLATE_SIZE + response_len, GFP_ATOMIC);
         if (!new_skb) {
             nanonet_log_error("Failed to allocate response skb");
             return NULL;
@@ -51,100 +129,129 @@ static struct sk_buff *nanonet_create_response_packet(struct sk_buff *orig_skb,
     }
 
     skb_reserve(new_skb, NET_IP_ALIGN);
+    nanonet_track_response_skb(new_skb);
+
+    // A fixed-size copy of the whole line compiles to a handful of moves;
+    // the bytes past tmpl->len are overwritten by the payload.
+    if (likely(skb_tailroom(new_skb) >= NANONET_TX_TEMPLATE_SIZE)) {
+        memcpy(skb_tail_pointer(new_skb), tmpl->data, NANONET_TX_TEMPLATE_SIZE);
+    } else {
+        memcpy(skb_tail_pointer(new_skb), tmpl->data, tmpl->len);
+    }
+    skb_put(new_skb, tmpl->len);
+    if (tmpl->neigh) {
+        memcpy(((struct ull_ethhdr *)new_skb->data)->h_dest, dest, ETH_ALEN);
+    }
+    skb_reset_mac_header(new_skb);
+    skb_set_network_header(new_skb, NANONET_TX_IP_OFFSET);
+    skb_set_transport_header(new_skb, NANONET_TX_L4_OFFSET);
+
+    ip = (struct ull_iphdr *)(new_skb->data + NANONET_TX_IP_OFFSET);
+    tot_len = htons(tmpl->len - NANONET_TX_IP_OFFSET + response_len);
+    id = htons(this_cpu_inc_return(nanonet_ip_id));
+    csum_replace2(&ip->check, ip->tot_len, tot_len);
+    csum_replace2(&ip->check, ip->id, id);
+    ip->tot_len = tot_len;
+    ip->id = id;
 
-    if (orig_skb) {
-        orig_eth = (struct ull_ethhdr *)orig_skb->data;
-        orig_ip = (struct ull_iphdr *)(orig_skb->data + sizeof(struct ull_ethhdr));
+    // TCP takes its sequence number once risk has passed the order
+    if (flow->rule.protocol == IPPROTO_UDP) {
+        struct ull_udphdr *udp = (struct ull_udphdr *)(new_skb->data + NANONET_TX_L4_OFFSET);
+
+        udp->len = htons(sizeof(struct ull_udphdr) + response_len);
     }
 
-    new_eth = (struct ull_ethhdr *)skb_put(new_skb, sizeof(struct ull_ethhdr));
-    if (orig_eth) {
-        memcpy(new_eth->h_dest, orig_eth->h_source, ETH_ALEN);
-        memcpy(new_eth->h_source, orig_eth->h_dest, ETH_ALEN);
+    *payload = skb_put(new_skb, response_len);
+
+    // Held by the flow, which outlives the caller's RCU read section
+    new_skb->dev = flow->out.dev;
+    new_skb->protocol = htons(ETH_P_IP);
+
+    return new_skb;
+}
+
+// Builds the headers of an order for flow and returns the skb with
+// response_len bytes of payload reserved at *payload, for the strategy to
+// encode into directly. Pass the skb to nanonet_response_finish() to queue it.
+// Returns NULL if the order would not fit in one packet on the egress device.
+struct sk_buff *nanonet_response_begin(int response_len, const struct nanonet_flow *flow, void **payload) {
+    if (response_len <= 0) {
+        nanonet_log_error("Invalid response length");
+        return NULL;
+    }
+    return nanonet_create_response_packet(response_len, flow, payload);
+}
+EXPORT_SYMBOL_GPL(nanonet_response_begin);
+
+// Fill in the L4 checksum once the payload is final. Devices that can
+// checksum get CHECKSUM_PARTIAL with only the pseudo-header folded in;
+// otherwise TCP is summed in software and UDP is left at zero, which
+// receivers accept (RFC 768).
+static void nanonet_tx_checksum(struct sk_buff *skb, const struct nanonet_flow *flow) {
+    struct ull_iphdr *ip = (struct ull_iphdr *)skb_network_header(skb);
+    void *l4 = skb_transport_header(skb);
+    int l4_len = ntohs(ip->tot_len) - sizeof(struct ull_iphdr);
+    u8 protocol = flow->rule.protocol;
+    __sum16 *check;
+
+    if (protocol == IPPROTO_TCP) {
+        check = &((struct ull_tcphdr *)l4)->check;
     } else {
-        memset(new_eth->h_dest, 0, ETH_ALEN);
-        memset(new_eth->h_source, 0, ETH_ALEN);
-    }
-    new_eth->h_proto = htons(ETH_P_IP);
-
-    new_ip = (struct ull_iphdr *)skb_put(new_skb, ip_hdr_len);
-    memset(new_ip, 0, ip_hdr_len);
-    new_ip->version_ihl = 0x45;
-    new_ip->tos = 0;
-    new_ip->tot_len = htons(ip_hdr_len + transport_hdr_len + response_len);
-    new_ip->id = 0;
-    new_ip->frag_off = htons(IP_DF);
-    new_ip->ttl = 64;
-    new_ip->protocol = config->protocol;
-    new_ip->saddr = config->response_ip;
-    new_ip->daddr = orig_ip ? orig_ip->saddr : config->target_ip;
-    new_ip->check = 0;
-    new_ip->check = nanonet_compute_checksum(new_ip, ip_hdr_len);
-
-    if (config->protocol == IPPROTO_TCP) {
-        if (orig_skb) {
-            orig_tcp = (struct ull_tcphdr *)((void *)orig_ip + ((orig_ip->version_ihl & 0x0F) * 4));
-        }
+        check = &((struct ull_udphdr *)l4)->check;
+    }
 
-        new_tcp = (struct ull_tcphdr *)skb_put(new_skb, transport_hdr_len);
-        memset(new_tcp, 0, transport_hdr_len);
-        new_tcp->source = config->response_port;
-        new_tcp->dest = orig_tcp ? orig_tcp->source : config->target_port;
-        new_tcp->seq = htonl(config->seq_num);
-        new_tcp->ack_seq = orig_tcp ? htonl(ntohl(orig_tcp->seq) + 1) : 0;
-        new_tcp->doff = sizeof(struct ull_tcphdr) / 4;
-        new_tcp->psh = 1;
-        new_tcp->ack = orig_tcp ? 1 : 0;
-        new_tcp->window = htons(65535);
-        new_tcp->check = 0;
-    } else if (config->protocol == IPPROTO_UDP) {
-        if (orig_skb) {
-            orig_udp = (struct ull_udphdr *)((void *)orig_ip + ((orig_ip->version_ihl & 0x0F) * 4));
-        }
-        new_udp = (struct ull_udphdr *)skb_put(new_skb, transport_hdr_len);
-        new_udp->source = config->response_port;
-        new_udp->dest = orig_udp ? orig_udp->source : config->target_port;
-        new_udp->len = htons(transport_hdr_len + response_len);
-        new_udp->check = 0;
+    if (skb->dev->features & (NETIF_F_HW_CSUM | NETIF_F_IP_CSUM)) {
+        *check = ~csum_tcpudp_magic(ip->saddr, ip->daddr, l4_len, protocol, 0);
+        skb->ip_summed = CHECKSUM_PARTIAL;
+        skb->csum_start = skb_transport_header(skb) - skb->head;
+        skb->csum_offset = (void *)check - l4;
+    } else if (protocol == IPPROTO_TCP) {
+        *check = csum_tcpudp_magic(ip->saddr, ip->daddr, l4_len, protocol, csum_partial(l4, l4_len, 0));
     }
+}
 
-    payload_ptr = skb_put(new_skb, response_len);
-    memcpy(payload_ptr, response_data, response_len);
+// Runs the pre-trade risk checks and queues the order on this CPU's TX
+// burst; the caller sends it with nanonet_tx_flush() once it has produced
+// every order for the tick. Returns -EPERM if risk rejected the order.
+int nanonet_response_finish(struct sk_buff *skb, int response_len, const struct nanonet_flow *flow) {
+    void *order;
+    int ret;
 
-    dev = orig_skb ? orig_skb->dev : dev_get_by_name(&init_net, "eth0");
-    if (!dev) {
-        kfree_skb(new_skb);
-        nanonet_log_error("Failed to get network device");
-        return NULL;
+    order = skb_tail_pointer(skb) - response_len;
+    ret = nanonet_risk_check(order, response_len, flow);
+    if (ret < 0) {
+        kfree_skb(skb);
+        return ret;
     }
+    nanonet_event(NANONET_EVENT_ORDER, 0, order, flow);
 
-    new_skb->dev = dev;
-    new_skb->protocol = htons(ETH_P_IP);
+    // Orders on one rule from several CPUs get disjoint sequence ranges
+    if (flow->rule.protocol == IPPROTO_TCP) {
+        struct ull_tcphdr *tcp = (struct ull_tcphdr *)skb_transport_header(skb);
 
-    return new_skb;
+        tcp->seq = htonl((u32)atomic64_fetch_add(response_len, &flow->throttle->tx_seq));
+    }
+    nanonet_tx_checksum(skb, flow);
+    nanonet_tx_queue(skb);
+    return 0;
 }
+EXPORT_SYMBOL_GPL(nanonet_response_finish);
 
-int nanonet_send_response(struct sk_buff *orig_skb, void *response_data, int response_len, struct ull_config *config) {
+int nanonet_send_response(void *response_data, int response_len, const struct nanonet_flow *flow) {
     struct sk_buff *response_skb;
-    int result;
+    void *payload;
 
     if (!response_data || response_len <= 0) {
         nanonet_log_error("Invalid response data or length");
         return -EINVAL;
     }
 
-    response_skb = nanonet_create_response_packet(orig_skb, response_data, response_len, config);
+    response_skb = nanonet_response_begin(response_len, flow, &payload);
     if (!response_skb) {
         return -ENOMEM;
     }
+    memcpy(payload, response_data, response_len);
 
-    result = nanonet_raw_send(response_skb, response_skb->dev);
-    if (result != NET_XMIT_SUCCESS) {
-        kfree_skb(response_skb);
-        nanonet_log_error("Failed to send response: %d", result);
-        return -EIO;
-    }
-
-    config->seq_num += response_len;
-    return 0;
-}
\ No newline at end of file
+    return nanonet_response_finish(response_skb, response_len, flow);
+}
+EXPORT_SYMBOL_GPL(nanonet_send_response);
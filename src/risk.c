@@ -0,0 +1,264 @@
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/seqlock.h>
+#include <linux/timekeeping.h>
+#include <linux/seq_file.h>
+#include "../include/nanonet_strategy.h"
+
+// Pre-trade risk checks. Every order passes through nanonet_risk_check()
+// after the strategy has encoded it and before it is queued for transmit.
+// Limits are read under a seqlock. Per-symbol exposure and the per-rule
+// token buckets are plain atomics, and the counters are per CPU, so no
+// check takes a lock or leaves the CPU.
+
+struct nanonet_risk_config {
+    struct nanonet_risk_limits limits;
+    u64 interval_ns;            // Between orders at max_orders_per_sec
+    u64 tolerance_ns;           // How far ahead of that rate a burst may run
+};
+
+static struct nanonet_risk_config nanonet_risk_config;
+static DEFINE_SEQLOCK(nanonet_risk_lock);
+static bool nanonet_risk_killed;
+
+// Reset like the main statistics: the epoch is bumped and each CPU clears
+// its own counters the next time it records.
+struct nanonet_risk_stats {
+    unsigned int epoch;
+    u64 accepted;
+    u64 rejected[NANONET_RISK_REASONS];
+};
+
+static DEFINE_PER_CPU(struct nanonet_risk_stats, nanonet_risk_stats);
+static unsigned int nanonet_risk_epoch;
+
+static const char *const nanonet_risk_reasons[NANONET_RISK_REASONS] = {
+    [NANONET_RISK_KILLED] = "Kill switch",
+    [NANONET_RISK_FORMAT] = "Malformed order",
+    [NANONET_RISK_QUANTITY] = "Order quantity",
+    [NANONET_RISK_UNKNOWN_SYMBOL] = "Unknown symbol",
+    [NANONET_RISK_POSITION] = "Position limit",
+    [NANONET_RISK_NOTIONAL] = "Notional limit",
+    [NANONET_RISK_THROTTLE] = "Order rate",
+};
+
+static inline struct nanonet_risk_stats *nanonet_risk_stats_this_cpu(void) {
+    struct nanonet_risk_stats *stats = this_cpu_ptr(&nanonet_risk_stats);
+    unsigned int epoch = READ_ONCE(nanonet_risk_epoch);
+
+    if (unlikely(stats->epoch != epoch)) {
+        memset(stats, 0, sizeof(*stats));
+        stats->epoch = epoch;
+    }
+    return stats;
+}
+
+static inline void nanonet_risk_read(struct nanonet_risk_config *out) {
+    unsigned int seq;
+
+    do {
+        seq = read_seqbegin(&nanonet_risk_lock);
+        *out = nanonet_risk_config;
+    } while (read_seqretry(&nanonet_risk_lock, seq));
+}
+
+// One cmpxchg: the order is admitted if the bucket's theoretical arrival
+// time is no further ahead of now than the burst allows.
+static bool nanonet_throttle_admit(struct nanonet_throttle *throttle, const struct nanonet_risk_config *cfg) {
+    u64 now = ktime_get_ns();
+    s64 tat = atomic64_read(&throttle->tat);
+    u64 start;
+
+    do {
+        start = max_t(u64, tat, now);
+        if (start - now > cfg->tolerance_ns) {
+            return false;
+        }
+    } while (!atomic64_try_cmpxchg(&throttle->tat, &tat, start + cfg->interval_ns));
+
+    return true;
+}
+
+// Gives an unpublished flow a throttle of its own: a full rate budget and
+// a TCP stream starting at sequence number 0.
+int nanonet_throttle_init(struct nanonet_flow *flow) {
+    flow->throttle = kzalloc_node(sizeof(*flow->throttle), GFP_KERNEL, nanonet_numa_node);
+    if (!flow->throttle) {
+        return -ENOMEM;
+    }
+    refcount_set(&flow->throttle->refs, 1);
+    return 0;
+}
+
+// An unpublished flow that replaces from carries on with its throttle:
+// orders already sent still count against the rate limit, and the TCP
+// stream continues. CPUs still sending on from draw on the same state.
+void nanonet_throttle_inherit(struct nanonet_flow *to, const struct nanonet_flow *from) {
+    nanonet_throttle_release(to);
+    refcount_inc(&from->throttle->refs);
+    to->throttle = from->throttle;
+}
+
+// Once no reader can reach flow any more, e.g. from its RCU callback
+void nanonet_throttle_release(struct nanonet_flow *flow) {
+    if (flow->throttle && refcount_dec_and_test(&flow->throttle->refs)) {
+        kfree(flow->throttle);
+    }
+    flow->throttle = NULL;
+}
+
+// Checks an encoded order against the limits and books its exposure.
+// Returns 0 to send it, or -EPERM with the reason counted. Softirq
+// context, under rcu_read_lock().
+int nanonet_risk_check(const void *order_data, int order_len, const struct nanonet_flow *flow) {
+    const struct trading_order *order = order_data;
+    struct nanonet_risk_stats *stats = nanonet_risk_stats_this_cpu();
+    struct nanonet_risk_config cfg;
+    struct nanonet_symbol_params params;
+    struct nanonet_symbol *sym;
+    u64 max_position, max_notional, notional = 0;
+    s64 delta = 0, position;
+    bool reducing;
+    int reason;
+
+    if (unlikely(READ_ONCE(nanonet_risk_killed))) {
+        reason = NANONET_RISK_KILLED;
+        goto reject;
+    }
+
+    if (unlikely(order_len != sizeof(*order) || order->side > 1)) {
+        reason = NANONET_RISK_FORMAT;
+        goto reject;
+    }
+
+    nanonet_risk_read(&cfg);
+    if (cfg.limits.max_order_quantity && order->quantity > cfg.limits.max_order_quantity) {
+        reason = NANONET_RISK_QUANTITY;
+        goto reject;
+    }
+
+    max_position = cfg.limits.max_position;
+    max_notional = cfg.limits.max_notional;
+    sym = nanonet_symbol_lookup(order->symbol);
+    if (sym) {
+        nanonet_symbol_read(sym, &params);
+        if (params.max_position) {
+            max_position = params.max_position;
+        }
+        if (params.max_notional) {
+            max_notional = params.max_notional;
+        }
+
+        // Book first, then check, so two CPUs cannot both slip under a
+        // limit. Orders that bring the position back toward flat always
+        // pass both checks: notional only grows, and once it is used up
+        // the position could otherwise never be closed.
+        delta = order->side ? -(s64)order->quantity : (s64)order->quantity;
+        position = atomic64_add_return(delta, &sym->position);
+        reducing = abs(position) < abs(position - delta);
+        if (max_position && abs(position) > max_position && !reducing) {
+            atomic64_sub(delta, &sym->position);
+            reason = NANONET_RISK_POSITION;
+            goto reject;
+        }
+
+        notional = (u64)order->price * order->quantity;
+        if (atomic64_add_return(notional, &sym->notional) > max_notional && max_notional && !reducing) {
+            atomic64_sub(notional, &sym->notional);
+            atomic64_sub(delta, &sym->position);
+            reason = NANONET_RISK_NOTIONAL;
+            goto reject;
+        }
+    } else if (max_position || max_notional) {
+        // No exposure to track it against
+        reason = NANONET_RISK_UNKNOWN_SYMBOL;
+        goto reject;
+    }
+
+    if (cfg.limits.max_orders_per_sec && !nanonet_throttle_admit(flow->throttle, &cfg)) {
+        if (sym) {
+            atomic64_sub(notional, &sym->notional);
+            atomic64_sub(delta, &sym->position);
+        }
+        reason = NANONET_RISK_THROTTLE;
+        goto reject;
+    }
+
+    stats->accepted++;
+    return 0;
+
+reject:
+    stats->rejected[reason]++;
+    if (order_len == sizeof(*order)) {
+        nanonet_event(NANONET_EVENT_REJECT, reason, order, flow);
+    }
+    return -EPERM;
+}
+
+void nanonet_risk_set_limits(const struct nanonet_risk_limits *limits) {
+    struct nanonet_risk_config cfg = { .limits = *limits };
+
+    if (limits->max_orders_per_sec) {
+        cfg.interval_ns = NSEC_PER_SEC / limits->max_orders_per_sec;
+        cfg.tolerance_ns = cfg.interval_ns * (limits->order_burst ? limits->order_burst - 1 : 0);
+    }
+
+    // BHs off so a check on this CPU cannot spin on a write it interrupted
+    write_seqlock_bh(&nanonet_risk_lock);
+    nanonet_risk_config = cfg;
+    write_sequnlock_bh(&nanonet_risk_lock);
+}
+
+// Takes effect for the next order on every CPU; orders already queued for
+// the current burst are still sent.
+void nanonet_risk_kill(bool killed) {
+    WRITE_ONCE(nanonet_risk_killed, killed);
+    printk(KERN_WARNING "NANONET: Kill switch %s\n", killed ? "engaged" : "released");
+}
+
+void nanonet_risk_reset(void) {
+    WRITE_ONCE(nanonet_risk_epoch, READ_ONCE(nanonet_risk_epoch) + 1);
+    nanonet_symbols_reset_exposure();
+}
+
+void nanonet_risk_get_status(struct nanonet_risk_status *status) {
+    struct nanonet_risk_config cfg;
+    struct nanonet_risk_stats *stats;
+    unsigned int epoch = READ_ONCE(nanonet_risk_epoch);
+    int cpu, i;
+
+    memset(status, 0, sizeof(*status));
+    nanonet_risk_read(&cfg);
+    status->limits = cfg.limits;
+    status->killed = READ_ONCE(nanonet_risk_killed);
+
+    for_each_possible_cpu(cpu) {
+        stats = per_cpu_ptr(&nanonet_risk_stats, cpu);
+        if (READ_ONCE(stats->epoch) != epoch) {
+            continue;
+        }
+        status->accepted += READ_ONCE(stats->accepted);
+        for (i = 0; i < NANONET_RISK_REASONS; i++) {
+            status->rejected[i] += READ_ONCE(stats->rejected[i]);
+        }
+    }
+}
+
+void nanonet_risk_show(struct seq_file *m) {
+    struct nanonet_risk_status status;
+    int i;
+
+    nanonet_risk_get_status(&status);
+    seq_printf(m, "\nRisk:\n");
+    seq_printf(m, "Kill Switch: %s\n", status.killed ? "ENGAGED" : "off");
+    seq_printf(m, "Max Order Quantity: %u\n", status.limits.max_order_quantity);
+    seq_printf(m, "Max Orders/sec per Rule: %u (burst %u)\n", status.limits.max_orders_per_sec,
+               status.limits.order_burst);
+    seq_printf(m, "Max Position per Symbol: %u\n", status.limits.max_position);
+    seq_printf(m, "Max Notional per Symbol: %llu\n", status.limits.max_notional);
+    seq_printf(m, "Orders Accepted: %llu\n", status.accepted);
+    for (i = 0; i < NANONET_RISK_REASONS; i++) {
+        seq_printf(m, "Rejected (%s): %llu\n", nanonet_risk_reasons[i], status.rejected[i]);
+    }
+}
@@ -0,0 +1,252 @@
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/netfilter.h>
+#include <linux/timekeeping.h>
+#include <linux/seq_file.h>
+#include "../include/nanonet.h"
+
+// RX workers. Each CPU that receives ticks has a single-producer,
+// single-consumer ring: the softirq on that CPU writes head and the one
+// worker that owns the ring writes tail, each with release ordering so the
+// other side sees the slot contents before the index. Rings are assigned
+// to workers round robin at load time and never move.
+#define NANONET_RX_BATCH 32     // Ticks per BH-disabled section
+
+struct nanonet_rx_slot {
+    struct sk_buff *skb;
+    u64 start_time;
+};
+
+struct nanonet_rx_ring {
+    u32 head;                   // Written by the RX CPU
+    u64 enqueued;
+    u64 overflows;
+    u32 tail ____cacheline_aligned;    // Written by the worker
+    struct nanonet_rx_slot slots[NANONET_RX_RING_SIZE] ____cacheline_aligned;
+};
+
+struct nanonet_rx_worker {
+    struct task_struct *task;
+    int cpu;
+    struct cpumask rings;       // CPUs whose rings this worker drains
+    u64 packets;
+    u64 dropped;                // Not ours any more, or failed validation
+    u64 empty_polls;
+} ____cacheline_aligned;
+
+bool nanonet_rx_workers;
+static DEFINE_PER_CPU(struct nanonet_rx_ring *, nanonet_rx_rings);
+static struct nanonet_rx_worker *nanonet_rx_worker_list;
+static int nanonet_rx_nr_workers;
+
+// Softirq on the receiving CPU. Takes ownership of skb; a full ring drops
+// it, since running it here out of order would hand the strategy ticks
+// older than ones it has not seen yet.
+void nanonet_rx_enqueue(struct sk_buff *skb, u64 start_time) {
+    struct nanonet_rx_ring *ring = this_cpu_read(nanonet_rx_rings);
+    struct nanonet_rx_slot *slot;
+    u32 head = ring->head;
+
+    if (unlikely(head - smp_load_acquire(&ring->tail) >= NANONET_RX_RING_SIZE)) {
+        WRITE_ONCE(ring->overflows, ring->overflows + 1);
+        kfree_skb(skb);
+        return;
+    }
+
+    slot = &ring->slots[head & (NANONET_RX_RING_SIZE - 1)];
+    slot->skb = skb;
+    slot->start_time = start_time;
+    WRITE_ONCE(ring->enqueued, ring->enqueued + 1);
+    smp_store_release(&ring->head, head + 1);
+}
+
+static void nanonet_rx_run(struct nanonet_rx_worker *w, struct sk_buff *skb, u64 start_time) {
+    const struct nanonet_config_snapshot *snap = nanonet_config_snapshot();
+    const struct nanonet_flow *flow;
+
+    // The rule may have changed while the tick was queued
+    flow = snap->config.enabled ? nanonet_flow_classify(skb, snap) : NULL;
+    if (!flow || nanonet_process_packet(skb, flow, start_time) != NF_STOLEN) {
+        // Past the point where the stack could still take it
+        WRITE_ONCE(w->dropped, w->dropped + 1);
+        kfree_skb(skb);
+        return;
+    }
+    WRITE_ONCE(w->packets, w->packets + 1);
+}
+
+static int nanonet_rx_drain(struct nanonet_rx_worker *w, struct nanonet_rx_ring *ring) {
+    struct nanonet_rx_slot *slot;
+    u32 tail = ring->tail;
+    u32 head = smp_load_acquire(&ring->head);
+    int n = 0;
+
+    if (head == tail) {
+        return 0;
+    }
+
+    local_bh_disable();
+    rcu_read_lock();
+    for (; tail != head && n < NANONET_RX_BATCH; tail++, n++) {
+        slot = &ring->slots[tail & (NANONET_RX_RING_SIZE - 1)];
+        nanonet_rx_run(w, slot->skb, slot->start_time);
+    }
+    rcu_read_unlock();
+    local_bh_enable();
+
+    // The RX CPU may reuse the slots once it sees this
+    smp_store_release(&ring->tail, tail);
+    return n;
+}
+
+// Busy-polls every ring the worker owns. It never sleeps; cond_resched()
+// only yields to work bound to the same core.
+static int nanonet_rx_worker_thread(void *data) {
+    struct nanonet_rx_worker *w = data;
+    int cpu, n;
+
+    while (!kthread_should_stop()) {
+        n = 0;
+        for_each_cpu(cpu, &w->rings) {
+            n += nanonet_rx_drain(w, per_cpu(nanonet_rx_rings, cpu));
+        }
+        if (!n) {
+            WRITE_ONCE(w->empty_polls, w->empty_polls + 1);
+            cpu_relax();
+        }
+        cond_resched();
+    }
+    return 0;
+}
+
+void nanonet_rx_workers_show(struct seq_file *m) {
+    struct nanonet_rx_worker *w;
+    struct nanonet_rx_ring *ring;
+    u64 enqueued = 0, overflows = 0;
+    int i, cpu;
+
+    if (!nanonet_rx_nr_workers) {
+        return;
+    }
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu(nanonet_rx_rings, cpu);
+        enqueued += READ_ONCE(ring->enqueued);
+        overflows += READ_ONCE(ring->overflows);
+    }
+
+    seq_printf(m, "\nRX Workers: %d (ring %u slots per CPU)\n", nanonet_rx_nr_workers, NANONET_RX_RING_SIZE);
+    seq_printf(m, "Ticks Queued: %llu\n", enqueued);
+    seq_printf(m, "Ring Overflows: %llu\n", overflows);
+    for (i = 0; i < nanonet_rx_nr_workers; i++) {
+        w = &nanonet_rx_worker_list[i];
+        seq_printf(m, "Worker CPU %d: rings %*pbl, processed %llu, dropped %llu, empty polls %llu\n", w->cpu,
+                   cpumask_pr_args(&w->rings), READ_ONCE(w->packets), READ_ONCE(w->dropped),
+                   READ_ONCE(w->empty_polls));
+    }
+}
+
+int nanonet_rx_workers_init(void) {
+    struct nanonet_rx_worker *w;
+    struct task_struct *task;
+    cpumask_var_t cpus;
+    int cpu, i = 0, ret;
+
+    if (!nanonet_rx_worker_cpus || !*nanonet_rx_worker_cpus) {
+        return 0;
+    }
+
+    if (!zalloc_cpumask_var(&cpus, GFP_KERNEL)) {
+        return -ENOMEM;
+    }
+    ret = cpulist_parse(nanonet_rx_worker_cpus, cpus);
+    if (ret < 0 || !cpumask_subset(cpus, cpu_online_mask) || cpumask_empty(cpus)) {
+        printk(KERN_ERR "NANONET: rx_worker_cpus must list online CPUs: %s\n", nanonet_rx_worker_cpus);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    for_each_possible_cpu(cpu) {
+        per_cpu(nanonet_rx_rings, cpu) = kzalloc_node(sizeof(struct nanonet_rx_ring), GFP_KERNEL, cpu_to_node(cpu));
+        if (!per_cpu(nanonet_rx_rings, cpu)) {
+            ret = -ENOMEM;
+            goto err;
+        }
+    }
+
+    nanonet_rx_nr_workers = cpumask_weight(cpus);
+    nanonet_rx_worker_list = kcalloc(nanonet_rx_nr_workers, sizeof(*w), GFP_KERNEL);
+    if (!nanonet_rx_worker_list) {
+        ret = -ENOMEM;
+        goto err;
+    }
+
+    for_each_cpu(cpu, cpus) {
+        nanonet_rx_worker_list[i++].cpu = cpu;
+    }
+    i = 0;
+    for_each_possible_cpu(cpu) {
+        cpumask_set_cpu(cpu, &nanonet_rx_worker_list[i].rings);
+        i = (i + 1) % nanonet_rx_nr_workers;
+    }
+
+    for (i = 0; i < nanonet_rx_nr_workers; i++) {
+        w = &nanonet_rx_worker_list[i];
+        task = kthread_create(nanonet_rx_worker_thread, w, "nanonet_rx/%d", w->cpu);
+        if (IS_ERR(task)) {
+            ret = PTR_ERR(task);
+            goto err;
+        }
+        kthread_bind(task, w->cpu);
+        w->task = task;
+        wake_up_process(task);
+    }
+
+    WRITE_ONCE(nanonet_rx_workers, true);
+    printk(KERN_INFO "NANONET: %d RX workers on CPUs %*pbl\n", nanonet_rx_nr_workers, cpumask_pr_args(cpus));
+    ret = 0;
+    goto out;
+
+err:
+    nanonet_rx_workers_cleanup();
+out:
+    free_cpumask_var(cpus);
+    return ret;
+}
+
+// Ingress is stopped by now, so nothing is still enqueueing. Workers are
+// stopped before the rings they drain are freed with what is left in them.
+void nanonet_rx_workers_cleanup(void) {
+    struct nanonet_rx_ring *ring;
+    int i, cpu;
+
+    WRITE_ONCE(nanonet_rx_workers, false);
+    synchronize_net();
+
+    for (i = 0; nanonet_rx_worker_list && i < nanonet_rx_nr_workers; i++) {
+        if (nanonet_rx_worker_list[i].task) {
+            kthread_stop(nanonet_rx_worker_list[i].task);
+        }
+    }
+    kfree(nanonet_rx_worker_list);
+    nanonet_rx_worker_list = NULL;
+    nanonet_rx_nr_workers = 0;
+
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu(nanonet_rx_rings, cpu);
+        if (!ring) {
+            continue;
+        }
+        for (; ring->tail != ring->head; ring->tail++) {
+            kfree_skb(ring->slots[ring->tail & (NANONET_RX_RING_SIZE - 1)].skb);
+        }
+        kfree(ring);
+        per_cpu(nanonet_rx_rings, cpu) = NULL;
+    }
+}
@@ -0,0 +1,169 @@
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+#include "../include/nanonet.h"
+
+DEFINE_PER_CPU_ALIGNED(struct nanonet_cpu_stats, nanonet_cpu_stats);
+unsigned int nanonet_stats_epoch __read_mostly;
+
+void nanonet_stats_reset_local(struct nanonet_cpu_stats *st) {
+    s64 connections_active = st->connections_active;
+    u64 connections_dropped = st->connections_dropped;
+    u64 connections_evicted = st->connections_evicted;
+
+    memset(st, 0, sizeof(*st));
+    st->min_process_time_ns = U64_MAX;
+    st->connections_active = connections_active;
+    st->connections_dropped = connections_dropped;
+    st->connections_evicted = connections_evicted;
+    // Readers that see the new epoch also see the cleared counters
+    smp_store_release(&st->epoch, READ_ONCE(nanonet_stats_epoch));
+}
+
+void nanonet_stats_reset(void) {
+    WRITE_ONCE(nanonet_stats_epoch, READ_ONCE(nanonet_stats_epoch) + 1);
+}
+
+static inline bool nanonet_stats_current(struct nanonet_cpu_stats *st, unsigned int epoch) {
+    return smp_load_acquire(&st->epoch) == epoch;
+}
+
+// A reset during a pass would mix CPUs counted before and after it, and a
+// CPU caught mid-clear; such a pass is redone.
+static inline bool nanonet_stats_retry(unsigned int epoch) {
+    smp_rmb();
+    return READ_ONCE(nanonet_stats_epoch) != epoch;
+}
+
+void nanonet_stats_snapshot(struct ull_stats *out) {
+    struct nanonet_cpu_stats *st;
+    unsigned int epoch;
+    u64 total_time;
+    int cpu;
+
+retry:
+    epoch = READ_ONCE(nanonet_stats_epoch);
+    total_time = 0;
+    memset(out, 0, sizeof(*out));
+    out->min_process_time_ns = U64_MAX;
+
+    for_each_possible_cpu(cpu) {
+        st = per_cpu_ptr(&nanonet_cpu_stats, cpu);
+
+        out->connections_active += READ_ONCE(st->connections_active);
+        out->connections_dropped += READ_ONCE(st->connections_dropped);
+        out->connections_evicted += READ_ONCE(st->connections_evicted);
+        if (!nanonet_stats_current(st, epoch)) {
+            continue;
+        }
+
+        out->packets_processed += READ_ONCE(st->packets_processed);
+        out->packets_bypassed += READ_ONCE(st->packets_bypassed);
+        out->responses_sent += READ_ONCE(st->responses_sent);
+        out->errors += READ_ONCE(st->errors);
+        out->last_process_time_ns = max(out->last_process_time_ns, READ_ONCE(st->last_process_time_ns));
+        out->min_process_time_ns = min(out->min_process_time_ns, READ_ONCE(st->min_process_time_ns));
+        out->max_process_time_ns = max(out->max_process_time_ns, READ_ONCE(st->max_process_time_ns));
+        total_time += READ_ONCE(st->total_process_time_ns);
+    }
+    if (nanonet_stats_retry(epoch)) {
+        goto retry;
+    }
+
+    if (out->packets_processed) {
+        out->avg_process_time_ns = div64_u64(total_time, out->packets_processed);
+    } else {
+        out->min_process_time_ns = 0;
+    }
+}
+
+static u64 nanonet_hist_bucket_upper(unsigned int idx) {
+    unsigned int exp;
+    u64 mant;
+
+    if (idx < NANONET_HIST_SUB_COUNT) {
+        return idx;
+    }
+
+    exp = (idx >> NANONET_HIST_SUB_BITS) + NANONET_HIST_SUB_BITS - 1;
+    mant = NANONET_HIST_SUB_COUNT + (idx & (NANONET_HIST_SUB_COUNT - 1));
+    return ((mant + 1) << (exp - NANONET_HIST_SUB_BITS)) - 1;
+}
+
+// Quantile q is given in basis points, e.g. 9990 for p99.9
+static u64 nanonet_hist_percentile(const struct ull_latency_histogram *h, u64 q) {
+    u64 target, seen = 0;
+    unsigned int i;
+
+    if (!h->count) {
+        return 0;
+    }
+
+    target = div64_u64(h->count * q + 9999, 10000);
+    for (i = 0; i < NANONET_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            return min(nanonet_hist_bucket_upper(i), h->max_ns);
+        }
+    }
+
+    return h->max_ns;
+}
+
+int nanonet_stats_histogram(struct ull_latency_histogram *out) {
+    struct nanonet_cpu_stats *st;
+    unsigned int epoch, i;
+    u64 total_time;
+    int cpu;
+
+retry:
+    epoch = READ_ONCE(nanonet_stats_epoch);
+    total_time = 0;
+    memset(out, 0, sizeof(*out));
+    out->min_ns = U64_MAX;
+
+    for_each_possible_cpu(cpu) {
+        st = per_cpu_ptr(&nanonet_cpu_stats, cpu);
+        if (!nanonet_stats_current(st, epoch)) {
+            continue;
+        }
+
+        for (i = 0; i < NANONET_HIST_BUCKETS; i++) {
+            out->buckets[i] += READ_ONCE(st->latency_hist[i]);
+        }
+        out->min_ns = min(out->min_ns, READ_ONCE(st->min_process_time_ns));
+        out->max_ns = max(out->max_ns, READ_ONCE(st->max_process_time_ns));
+        total_time += READ_ONCE(st->total_process_time_ns);
+    }
+    if (nanonet_stats_retry(epoch)) {
+        goto retry;
+    }
+
+    // Count from the buckets so percentiles stay consistent with them even
+    // while CPUs keep recording during the merge.
+    for (i = 0; i < NANONET_HIST_BUCKETS; i++) {
+        out->count += out->buckets[i];
+    }
+
+    if (!out->count) {
+        out->min_ns = 0;
+        return 0;
+    }
+
+    out->avg_ns = div64_u64(total_time, out->count);
+    out->p50_ns = nanonet_hist_percentile(out, 5000);
+    out->p99_ns = nanonet_hist_percentile(out, 9900);
+    out->p999_ns = nanonet_hist_percentile(out, 9990);
+
+    return 0;
+}
+
+void nanonet_stats_init(void) {
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        nanonet_stats_reset_local(per_cpu_ptr(&nanonet_cpu_stats, cpu));
+    }
+}
@@ -0,0 +1,131 @@
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/workqueue.h>
+#include <linux/timekeeping.h>
+#include "../include/nanonet.h"
+
+// Statistics page. A worker merges the per-CPU counters into one
+// vmalloc_user() page every stats_refresh_ms, bracketing the rewrite with
+// the page's sequence counter. It only runs while the page is mapped, so
+// an unwatched module pays nothing; a mapped reader pays no syscall.
+static struct nanonet_stats_page *nanonet_stats_page;
+static struct ull_latency_histogram *nanonet_stats_page_hist;
+static atomic_t nanonet_stats_page_maps = ATOMIC_INIT(0);
+
+static void nanonet_stats_page_refresh(struct work_struct *work);
+static DECLARE_DELAYED_WORK(nanonet_stats_page_work, nanonet_stats_page_refresh);
+
+static void nanonet_stats_page_refresh(struct work_struct *work) {
+    struct nanonet_stats_page *page = nanonet_stats_page;
+    struct ull_latency_histogram *hist = nanonet_stats_page_hist;
+    struct nanonet_risk_status risk;
+    struct ull_stats stats;
+    unsigned int epoch;
+    u64 rejected = 0;
+    int i;
+
+    // Counters and histogram from the same epoch, or a reset would pair
+    // fresh counters with stale percentiles
+    do {
+        epoch = READ_ONCE(nanonet_stats_epoch);
+        nanonet_stats_snapshot(&stats);
+        nanonet_stats_histogram(hist);
+        smp_rmb();
+    } while (READ_ONCE(nanonet_stats_epoch) != epoch);
+
+    nanonet_risk_get_status(&risk);
+    for (i = 0; i < NANONET_RISK_REASONS; i++) {
+        rejected += risk.rejected[i];
+    }
+
+    WRITE_ONCE(page->seq, page->seq + 1);
+    smp_wmb();
+    page->updated_ns = ktime_get_real_ns();
+    page->stats = stats;
+    page->latency_count = hist->count;
+    page->latency_p50_ns = hist->p50_ns;
+    page->latency_p99_ns = hist->p99_ns;
+    page->latency_p999_ns = hist->p999_ns;
+    page->orders_accepted = risk.accepted;
+    page->orders_rejected = rejected;
+    page->killed = risk.killed;
+    smp_wmb();
+    WRITE_ONCE(page->seq, page->seq + 1);
+
+    if (atomic_read(&nanonet_stats_page_maps)) {
+        schedule_delayed_work(&nanonet_stats_page_work, msecs_to_jiffies(nanonet_stats_refresh_ms));
+    }
+}
+
+static void nanonet_stats_page_vm_open(struct vm_area_struct *vma) {
+    if (atomic_inc_return(&nanonet_stats_page_maps) == 1) {
+        schedule_delayed_work(&nanonet_stats_page_work, 0);
+    }
+}
+
+static void nanonet_stats_page_vm_close(struct vm_area_struct *vma) {
+    atomic_dec(&nanonet_stats_page_maps);
+}
+
+static const struct vm_operations_struct nanonet_stats_page_vm_ops = {
+    .open = nanonet_stats_page_vm_open,
+    .close = nanonet_stats_page_vm_close,
+};
+
+// Read-only: the mapping may not be made writable later with mprotect().
+int nanonet_stats_page_mmap(struct vm_area_struct *vma) {
+    int ret;
+
+    if (vma->vm_flags & VM_WRITE) {
+        return -EPERM;
+    }
+    if (vma->vm_end - vma->vm_start > PAGE_SIZE) {
+        return -EINVAL;
+    }
+
+    ret = remap_vmalloc_range(vma, nanonet_stats_page, 0);
+    if (ret < 0) {
+        return ret;
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+    vma->vm_ops = &nanonet_stats_page_vm_ops;
+    nanonet_stats_page_vm_open(vma);
+
+    // Filled in before the caller's first read
+    flush_delayed_work(&nanonet_stats_page_work);
+    return 0;
+}
+
+int nanonet_stats_page_init(void) {
+    BUILD_BUG_ON(sizeof(struct nanonet_stats_page) > PAGE_SIZE);
+
+    nanonet_stats_refresh_ms = max(nanonet_stats_refresh_ms, 1U);
+    nanonet_stats_page_hist = kvmalloc_node(sizeof(*nanonet_stats_page_hist), GFP_KERNEL, nanonet_numa_node);
+    if (!nanonet_stats_page_hist) {
+        return -ENOMEM;
+    }
+    nanonet_stats_page = nanonet_vmalloc_user_node(PAGE_SIZE, nanonet_numa_node);
+    if (!nanonet_stats_page) {
+        kvfree(nanonet_stats_page_hist);
+        return -ENOMEM;
+    }
+    nanonet_stats_page->refresh_ms = nanonet_stats_refresh_ms;
+    return 0;
+}
+
+// The device is gone by now, so the page is unmapped and the worker has at
+// most one run left.
+void nanonet_stats_page_cleanup(void) {
+    cancel_delayed_work_sync(&nanonet_stats_page_work);
+    vfree(nanonet_stats_page);
+    kvfree(nanonet_stats_page_hist);
+    nanonet_stats_page = NULL;
+    nanonet_stats_page_hist = NULL;
+}
@@ -0,0 +1,164 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/seq_file.h>
+#include "../include/nanonet_strategy.h"
+
+// Strategies indexed by ID. The packet path does one rcu_dereference() per
+// tick; registration and removal serialize on nanonet_strategy_lock, and
+// removal waits for a grace period before tearing the strategy down, so a
+// module can unload its strategy while ticks are flowing.
+static struct nanonet_strategy __rcu *nanonet_strategies[NANONET_MAX_STRATEGIES];
+static DEFINE_MUTEX(nanonet_strategy_lock);
+
+static struct nanonet_strategy *nanonet_strategy_find(const char *name) {
+    struct nanonet_strategy *s;
+    int id;
+
+    for (id = 0; id < NANONET_MAX_STRATEGIES; id++) {
+        s = rcu_dereference_protected(nanonet_strategies[id], lockdep_is_held(&nanonet_strategy_lock));
+        if (s && strncmp(s->name, name, NANONET_STRATEGY_NAME_LEN) == 0) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static void nanonet_strategy_replay(const struct nanonet_flow_rule *rule, void *arg) {
+    struct nanonet_strategy *s = arg;
+
+    if (rule->application_logic_type == s->id) {
+        s->on_config(s, rule);
+    }
+}
+
+int nanonet_strategy_register(struct nanonet_strategy *s) {
+    struct nanonet_config_snapshot *snap;
+    struct nanonet_flow_rule rule;
+    int ret;
+
+    if (!s->name || !s->on_tick || strlen(s->name) >= NANONET_STRATEGY_NAME_LEN) {
+        return -EINVAL;
+    }
+
+    s->state = NULL;
+    if (s->state_size) {
+        s->state = __alloc_percpu(s->state_size, SMP_CACHE_BYTES);
+        if (!s->state) {
+            return -ENOMEM;
+        }
+    }
+
+    if (s->init) {
+        ret = s->init(s);
+        if (ret < 0) {
+            goto err_free;
+        }
+    }
+
+    mutex_lock(&nanonet_strategy_lock);
+    if (rcu_access_pointer(nanonet_strategies[s->id]) || nanonet_strategy_find(s->name)) {
+        mutex_unlock(&nanonet_strategy_lock);
+        ret = -EEXIST;
+        goto err_teardown;
+    }
+
+    // Let the strategy see the rules already bound to it before any tick.
+    if (s->on_config) {
+        nanonet_flow_for_each(nanonet_strategy_replay, s);
+
+        rcu_read_lock();
+        snap = rcu_dereference(nanonet_active_config);
+        rule = snap->flow.rule;
+        rcu_read_unlock();
+        if (rule.dst_ip) {
+            nanonet_strategy_replay(&rule, s);
+        }
+    }
+
+    rcu_assign_pointer(nanonet_strategies[s->id], s);
+    mutex_unlock(&nanonet_strategy_lock);
+
+    printk(KERN_INFO "NANONET: Strategy %u (%s) registered\n", s->id, s->name);
+    return 0;
+
+err_teardown:
+    if (s->teardown) {
+        s->teardown(s);
+    }
+err_free:
+    free_percpu(s->state);
+    s->state = NULL;
+    return ret;
+}
+EXPORT_SYMBOL_GPL(nanonet_strategy_register);
+
+void nanonet_strategy_unregister(struct nanonet_strategy *s) {
+    mutex_lock(&nanonet_strategy_lock);
+    if (rcu_access_pointer(nanonet_strategies[s->id]) != s) {
+        mutex_unlock(&nanonet_strategy_lock);
+        return;
+    }
+    RCU_INIT_POINTER(nanonet_strategies[s->id], NULL);
+    mutex_unlock(&nanonet_strategy_lock);
+
+    // Ticks that already picked up s finish before it goes away.
+    synchronize_rcu();
+
+    if (s->teardown) {
+        s->teardown(s);
+    }
+    free_percpu(s->state);
+    s->state = NULL;
+
+    printk(KERN_INFO "NANONET: Strategy %u (%s) unregistered\n", s->id, s->name);
+}
+EXPORT_SYMBOL_GPL(nanonet_strategy_unregister);
+
+// Caller holds rcu_read_lock() for as long as it uses the strategy.
+struct nanonet_strategy *nanonet_strategy_get(u8 id) {
+    return rcu_dereference(nanonet_strategies[id]);
+}
+
+// A rule was installed or changed; let its strategy (re)read parameters.
+void nanonet_strategy_config(const struct nanonet_flow_rule *rule) {
+    struct nanonet_strategy *s;
+
+    mutex_lock(&nanonet_strategy_lock);
+    s = rcu_dereference_protected(nanonet_strategies[rule->application_logic_type],
+                                  lockdep_is_held(&nanonet_strategy_lock));
+    if (s && s->on_config) {
+        s->on_config(s, rule);
+    }
+    mutex_unlock(&nanonet_strategy_lock);
+}
+
+int nanonet_strategy_id(const char *name) {
+    struct nanonet_strategy *s;
+    int id;
+
+    mutex_lock(&nanonet_strategy_lock);
+    s = nanonet_strategy_find(name);
+    id = s ? s->id : -ENOENT;
+    mutex_unlock(&nanonet_strategy_lock);
+
+    return id;
+}
+
+void nanonet_strategy_show(struct seq_file *m) {
+    struct nanonet_strategy *s;
+    int id;
+
+    mutex_lock(&nanonet_strategy_lock);
+    seq_printf(m, "\nStrategies:\n");
+    for (id = 0; id < NANONET_MAX_STRATEGIES; id++) {
+        s = rcu_dereference_protected(nanonet_strategies[id], lockdep_is_held(&nanonet_strategy_lock));
+        if (s) {
+            seq_printf(m, "%u %s\n", s->id, s->name);
+        }
+    }
+    mutex_unlock(&nanonet_strategy_lock);
+}
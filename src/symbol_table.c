@@ -0,0 +1,225 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/hash.h>
+#include <linux/seq_file.h>
+#include <asm/unaligned.h>
+#include "../include/nanonet_strategy.h"
+
+#define NANONET_SYMBOL_TABLE_SIZE (1 << NANONET_SYMBOL_TABLE_BITS)
+#define NANONET_SYMBOL_TABLE_MASK (NANONET_SYMBOL_TABLE_SIZE - 1)
+
+// Slots are only ever added, never removed, so a lookup can stop at the
+// first free slot without tombstones. Clearing swaps in a fresh table.
+struct nanonet_symbol_table {
+    unsigned int count;
+    struct nanonet_symbol slots[NANONET_SYMBOL_TABLE_SIZE];
+};
+
+static struct nanonet_symbol_table __rcu *nanonet_symbols;
+static DEFINE_MUTEX(nanonet_symbol_lock);
+
+static inline u64 nanonet_symbol_key(const char *symbol) {
+    return get_unaligned((const u64 *)symbol);
+}
+
+struct nanonet_symbol *nanonet_symbol_lookup(const char *symbol) {
+    struct nanonet_symbol_table *table = rcu_dereference(nanonet_symbols);
+    u64 key = nanonet_symbol_key(symbol);
+    u32 i = hash_64(key, NANONET_SYMBOL_TABLE_BITS);
+    u64 slot_key;
+
+    if (unlikely(!key)) {
+        return NULL;
+    }
+
+    // At most half full, so a free slot always ends the probe.
+    for (;;) {
+        slot_key = smp_load_acquire(&table->slots[i].key);
+        if (slot_key == key) {
+            return &table->slots[i];
+        }
+        if (!slot_key) {
+            return NULL;
+        }
+        i = (i + 1) & NANONET_SYMBOL_TABLE_MASK;
+    }
+}
+EXPORT_SYMBOL_GPL(nanonet_symbol_lookup);
+
+// Adds the symbol, with an empty order book, or updates its parameters in
+// place.
+int nanonet_symbol_set(const struct nanonet_symbol_params *params) {
+    struct nanonet_symbol_table *table;
+    struct nanonet_symbol *sym;
+    struct nanonet_book *book;
+    u64 key = nanonet_symbol_key(params->symbol);
+    u32 i = hash_64(key, NANONET_SYMBOL_TABLE_BITS);
+
+    if (!key || params->side > 1) {
+        return -EINVAL;
+    }
+
+    // Allocated up front, since the symbol may be new; freed if unused.
+    book = nanonet_book_alloc();
+    if (!book) {
+        return -ENOMEM;
+    }
+
+    mutex_lock(&nanonet_symbol_lock);
+    table = rcu_dereference_protected(nanonet_symbols, lockdep_is_held(&nanonet_symbol_lock));
+    while (table->slots[i].key && table->slots[i].key != key) {
+        i = (i + 1) & NANONET_SYMBOL_TABLE_MASK;
+    }
+    sym = &table->slots[i];
+
+    if (sym->key) {
+        // Readers retry rather than wait; keep BHs off so a tick on this
+        // CPU cannot spin on a write it interrupted.
+        write_seqlock_bh(&sym->lock);
+        sym->price_threshold = params->price_threshold;
+        sym->quantity = params->quantity;
+        sym->side = params->side;
+        sym->enabled = params->enabled;
+        sym->max_position = params->max_position;
+        sym->max_notional = params->max_notional;
+        write_sequnlock_bh(&sym->lock);
+    } else if (table->count >= NANONET_MAX_SYMBOLS) {
+        mutex_unlock(&nanonet_symbol_lock);
+        nanonet_book_free(book);
+        return -ENOSPC;
+    } else {
+        seqlock_init(&sym->lock);
+        sym->book = book;
+        book = NULL;
+        sym->price_threshold = params->price_threshold;
+        sym->quantity = params->quantity;
+        sym->side = params->side;
+        sym->enabled = params->enabled;
+        sym->max_position = params->max_position;
+        sym->max_notional = params->max_notional;
+        // Publishing the key makes the initialized slot visible.
+        smp_store_release(&sym->key, key);
+        table->count++;
+    }
+    mutex_unlock(&nanonet_symbol_lock);
+
+    nanonet_book_free(book);
+    return 0;
+}
+
+static struct nanonet_symbol_table *nanonet_symbol_table_alloc(void) {
+    return vzalloc_node(sizeof(struct nanonet_symbol_table), nanonet_numa_node);
+}
+
+// Caller has waited for readers of table to finish.
+static void nanonet_symbol_table_free(struct nanonet_symbol_table *table) {
+    int i;
+
+    if (!table) {
+        return;
+    }
+    for (i = 0; i < NANONET_SYMBOL_TABLE_SIZE; i++) {
+        nanonet_book_free(table->slots[i].book);
+    }
+    vfree(table);
+}
+
+void nanonet_symbols_clear(void) {
+    struct nanonet_symbol_table *fresh, *old;
+
+    fresh = nanonet_symbol_table_alloc();
+    if (!fresh) {
+        nanonet_log_error("Failed to allocate symbol table");
+        return;
+    }
+
+    mutex_lock(&nanonet_symbol_lock);
+    old = rcu_replace_pointer(nanonet_symbols, fresh, lockdep_is_held(&nanonet_symbol_lock));
+    mutex_unlock(&nanonet_symbol_lock);
+
+    synchronize_rcu();
+    nanonet_symbol_table_free(old);
+}
+
+// Forgets the exposure of every symbol, e.g. after positions were flattened
+// outside the module.
+void nanonet_symbols_reset_exposure(void) {
+    struct nanonet_symbol_table *table;
+    int i;
+
+    mutex_lock(&nanonet_symbol_lock);
+    table = rcu_dereference_protected(nanonet_symbols, lockdep_is_held(&nanonet_symbol_lock));
+    for (i = 0; i < NANONET_SYMBOL_TABLE_SIZE; i++) {
+        if (table->slots[i].key) {
+            atomic64_set(&table->slots[i].position, 0);
+            atomic64_set(&table->slots[i].notional, 0);
+        }
+    }
+    mutex_unlock(&nanonet_symbol_lock);
+}
+
+unsigned int nanonet_symbols_count(void) {
+    unsigned int count;
+
+    mutex_lock(&nanonet_symbol_lock);
+    count = rcu_dereference_protected(nanonet_symbols, lockdep_is_held(&nanonet_symbol_lock))->count;
+    mutex_unlock(&nanonet_symbol_lock);
+
+    return count;
+}
+
+void nanonet_symbols_show(struct seq_file *m) {
+    struct nanonet_symbol_table *table;
+    struct nanonet_symbol_params params;
+    struct nanonet_symbol *sym;
+    char name[9];
+    int i;
+
+    mutex_lock(&nanonet_symbol_lock);
+    table = rcu_dereference_protected(nanonet_symbols, lockdep_is_held(&nanonet_symbol_lock));
+    seq_printf(m, "%u symbols (max %u)\n", table->count, NANONET_MAX_SYMBOLS);
+    seq_printf(m, "%-9s %-4s %-10s %-8s %-3s %-10s %-12s %-12s %-10s %-14s %s\n",
+               "Symbol", "Side", "Threshold", "Qty", "On", "Last", "Ticks", "Orders", "Position", "Notional",
+               "Book (bid/ask)");
+    for (i = 0; i < NANONET_SYMBOL_TABLE_SIZE; i++) {
+        sym = &table->slots[i];
+        if (!sym->key) {
+            continue;
+        }
+        memcpy(name, &sym->key, 8);
+        name[8] = '\0';
+        nanonet_symbol_read(sym, &params);
+        seq_printf(m, "%-9s %-4s %-10u %-8u %-3s %-10u %-12llu %-12llu ",
+                   name, params.side ? "sell" : "buy", params.price_threshold, params.quantity,
+                   params.enabled ? "yes" : "no", READ_ONCE(sym->last_price),
+                   atomic64_read(&sym->ticks), atomic64_read(&sym->orders));
+        seq_printf(m, "%-10lld %-14lld ", atomic64_read(&sym->position), atomic64_read(&sym->notional));
+        nanonet_book_show(m, sym->book);
+        seq_putc(m, '\n');
+    }
+    mutex_unlock(&nanonet_symbol_lock);
+}
+
+int nanonet_symbols_init(void) {
+    struct nanonet_symbol_table *table = nanonet_symbol_table_alloc();
+
+    if (!table) {
+        return -ENOMEM;
+    }
+    RCU_INIT_POINTER(nanonet_symbols, table);
+    return 0;
+}
+
+// Called after the ingress hooks are gone.
+void nanonet_symbols_cleanup(void) {
+    struct nanonet_symbol_table *table;
+
+    mutex_lock(&nanonet_symbol_lock);
+    table = rcu_replace_pointer(nanonet_symbols, NULL, lockdep_is_held(&nanonet_symbol_lock));
+    mutex_unlock(&nanonet_symbol_lock);
+
+    synchronize_rcu();
+    nanonet_symbol_table_free(table);
+}
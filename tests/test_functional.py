@@ -2,15 +2,18 @@
 
 import socket
 import struct
+import subprocess
 import time
 import argparse
 
 class FunctionalTester:
-    def __init__(self, target_ip, target_port, protocol='udp', multicast_group=None):
+    def __init__(self, target_ip, target_port, protocol='udp', multicast_group=None,
+                 control='./tools/nanonet_control'):
         self.target_ip = target_ip
         self.target_port = target_port
         self.protocol = protocol.lower()
         self.multicast_group = multicast_group
+        self.control = control
 
     def create_test_packet(self, price):
         symbol = b'AAPL    '
@@ -19,45 +22,100 @@ class FunctionalTester:
         timestamp = struct.pack('<Q', int(time.time_ns()))
         return symbol + price + quantity + timestamp
 
-    def run_test(self):
-        print(f"Running functional test for NanoNet: {self.target_ip}:{self.target_port} ({self.protocol})")
-        if self.multicast_group:
-            print(f"Multicast group: {self.multicast_group}")
+    def nanonet_control(self, *args):
+        return subprocess.run([self.control] + list(args), check=True, capture_output=True, text=True).stdout
+
+    def max_order_quantity(self):
+        for line in self.nanonet_control('risk').splitlines():
+            if line.startswith('Max Order Quantity:'):
+                return int(line.split(':')[1])
+        raise RuntimeError("risk status has no order quantity limit")
 
+    def open_response_socket(self):
         if self.protocol == 'udp':
             sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
             sock.bind(('0.0.0.0', 9999))  # Bind to response port
+            if self.multicast_group:
+                sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP,
+                                socket.inet_aton(self.multicast_group) + socket.inet_aton('0.0.0.0'))
         else:
             sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
             sock.bind(('0.0.0.0', 9999))
             sock.listen(1)
+        return sock
 
+    # Sends one tick below the threshold and returns the order it triggered,
+    # or None if none arrived within timeout seconds.
+    def send_tick(self, sock, timeout=None):
+        packet = self.create_test_packet(9999)
+        addr = (self.multicast_group if self.multicast_group else self.target_ip, self.target_port)
+        tick = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.settimeout(timeout)
         try:
-            # Send packet below threshold (should trigger order)
-            packet = self.create_test_packet(9999)
-            addr = (self.multicast_group if self.multicast_group else self.target_ip, self.target_port)
+            tick.sendto(packet, addr)
             if self.protocol == 'udp':
-                if self.multicast_group:
-                    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP,
-                                    socket.inet_aton(self.multicast_group) + socket.inet_aton('0.0.0.0'))
-                sock.sendto(packet, addr)
                 data, _ = sock.recvfrom(1024)
             else:
-                sock.sendto(packet, addr)
                 conn, _ = sock.accept()
                 data = conn.recv(1024)
                 conn.close()
+            return data
+        except socket.timeout:
+            return None
+        finally:
+            tick.close()
 
-            if len(data) >= 28:  # sizeof(trading_order)
-                symbol = data[:8].decode()
-                price = struct.unpack('<I', data[8:12])[0]
-                quantity = struct.unpack('<I', data[12:16])[0]
-                side = data[16]
-                print(f"Received order: symbol={symbol}, price={price}, quantity={quantity}, side={'buy' if side == 0 else 'sell'}")
-                return 0
-            else:
-                print("Invalid order received")
-                return 1
+    def test_order(self, sock):
+        data = self.send_tick(sock)
+        if data and len(data) >= 28:  # sizeof(trading_order)
+            symbol = data[:8].decode()
+            price = struct.unpack('<I', data[8:12])[0]
+            quantity = struct.unpack('<I', data[12:16])[0]
+            side = data[16]
+            print(f"Received order: symbol={symbol}, price={price}, quantity={quantity}, side={'buy' if side == 0 else 'sell'}")
+            return 0
+        print("Invalid order received")
+        return 1
+
+    # With the kill switch engaged the same tick must not produce an order
+    def test_kill_switch(self, sock):
+        self.nanonet_control('kill')
+        try:
+            data = self.send_tick(sock, timeout=1.0)
+        finally:
+            self.nanonet_control('resume')
+        if data:
+            print("Kill switch: order sent while engaged")
+            return 1
+        print("Kill switch: no order while engaged")
+        return 0
+
+    # An order larger than max_order_quantity must be rejected
+    def test_quantity_limit(self, sock):
+        previous = self.max_order_quantity()
+        self.nanonet_control('risk', 'set', 'qty', '1')
+        try:
+            data = self.send_tick(sock, timeout=1.0)
+        finally:
+            self.nanonet_control('risk', 'set', 'qty', str(previous))
+        if data:
+            print("Quantity limit: order above max_order_quantity sent")
+            return 1
+        print("Quantity limit: order above max_order_quantity rejected")
+        return 0
+
+    def run_test(self):
+        print(f"Running functional test for NanoNet: {self.target_ip}:{self.target_port} ({self.protocol})")
+        if self.multicast_group:
+            print(f"Multicast group: {self.multicast_group}")
+
+        sock = self.open_response_socket()
+        try:
+            # Send packet below threshold (should trigger order)
+            result = self.test_order(sock)
+            result |= self.test_kill_switch(sock)
+            result |= self.test_quantity_limit(sock)
+            return result
 
         except Exception as e:
             print(f"Test failed: {e}")
@@ -71,12 +129,13 @@ def main():
     parser.add_argument('--port', type=int, default=8080, help='Target port')
     parser.add_argument('--protocol', choices=['tcp', 'udp'], default='udp', help='Protocol')
     parser.add_argument('--multicast', help='Multicast group IP (UDP only)')
+    parser.add_argument('--control', default='./tools/nanonet_control', help='Path to nanonet_control')
 
     args = parser.parse_args()
 
-    tester = FunctionalTester(args.ip, args.port, args.protocol, args.multicast)
+    tester = FunctionalTester(args.ip, args.port, args.protocol, args.multicast, args.control)
     result = tester.run_test()
     exit(result)
 
 if __name__ == '__main__':
-    main()
\ No newline at end of file
+    main()
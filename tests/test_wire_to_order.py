@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+
+import socket
+import struct
+import time
+import argparse
+import statistics
+
+ETH_P_ALL = 0x0003
+ETH_P_IP = 0x0800
+ORDER_SIZE = 41  # sizeof(struct trading_order)
+
+class WireToOrderTester:
+    def __init__(self, iface, target_ip, target_port, response_port=9999):
+        self.iface = iface
+        self.target_ip = target_ip
+        self.target_port = target_port
+        self.response_port = response_port
+
+    def create_test_packet(self):
+        symbol = b'AAPL    '
+        price = struct.pack('<I', 9999)
+        quantity = struct.pack('<I', 1000)
+        timestamp = struct.pack('<Q', int(time.time_ns()))
+        return symbol + price + quantity + timestamp
+
+    def is_order_frame(self, frame):
+        if len(frame) < 14 + 20 + 8 + ORDER_SIZE:
+            return False
+        if struct.unpack('!H', frame[12:14])[0] != ETH_P_IP:
+            return False
+        ihl = (frame[14] & 0x0F) * 4
+        if frame[14 + 9] != socket.IPPROTO_UDP:
+            return False
+        sport = struct.unpack('!H', frame[14 + ihl:14 + ihl + 2])[0]
+        return sport == self.response_port
+
+    def run_test(self, num_packets=1000, interval_us=1000, timeout_s=0.1):
+        print(f"Running wire-to-order test on {self.iface}: {num_packets} ticks to {self.target_ip}:{self.target_port}")
+
+        # Orders are captured at L2 so that they are seen even when the
+        # response carries MACs or addresses the IP stack would drop.
+        capture = socket.socket(socket.AF_PACKET, socket.SOCK_RAW, socket.htons(ETH_P_ALL))
+        capture.bind((self.iface, 0))
+        capture.settimeout(timeout_s)
+        sender = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+
+        latencies = []
+        lost = 0
+        try:
+            for i in range(num_packets):
+                start_time = time.perf_counter_ns()
+                sender.sendto(self.create_test_packet(), (self.target_ip, self.target_port))
+                while True:
+                    try:
+                        frame, addr = capture.recvfrom(2048)
+                    except socket.timeout:
+                        lost += 1
+                        break
+                    # Skip our own outgoing tick
+                    if addr[2] == socket.PACKET_OUTGOING:
+                        continue
+                    if self.is_order_frame(frame):
+                        latencies.append(time.perf_counter_ns() - start_time)
+                        break
+                if i % 100 == 0:
+                    print(f"Sent {i} ticks...")
+                if interval_us > 0:
+                    time.sleep(interval_us / 1000000.0)
+        finally:
+            capture.close()
+            sender.close()
+
+        print(f"\nWire-to-Order Results:")
+        print(f"Ticks sent: {num_packets}")
+        print(f"Orders received: {len(latencies)}")
+        print(f"Lost: {lost}")
+        if not latencies:
+            return 1
+
+        ordered = sorted(latencies)
+        print(f"Min RTT: {ordered[0]:,} ns ({ordered[0]/1000:.2f} μs)")
+        print(f"Median RTT: {statistics.median(ordered):,.0f} ns ({statistics.median(ordered)/1000:.2f} μs)")
+        print(f"99th percentile: {ordered[int(len(ordered) * 0.99)]:,} ns")
+        print(f"Max RTT: {ordered[-1]:,} ns ({ordered[-1]/1000:.2f} μs)")
+        return 0
+
+def main():
+    parser = argparse.ArgumentParser(description='Measure tick-to-order round trip through NanoNet')
+    parser.add_argument('--iface', required=True, help='Interface to capture orders on (sender side)')
+    parser.add_argument('--ip', default='10.77.0.1', help='Target IP address')
+    parser.add_argument('--port', type=int, default=8080, help='Target port')
+    parser.add_argument('--response-port', type=int, default=9999, help='Source port of generated orders')
+    parser.add_argument('--packets', type=int, default=1000, help='Number of ticks to send')
+    parser.add_argument('--interval', type=int, default=1000, help='Interval between ticks (microseconds)')
+
+    args = parser.parse_args()
+
+    tester = WireToOrderTester(args.iface, args.ip, args.port, args.response_port)
+    exit(tester.run_test(args.packets, args.interval))
+
+if __name__ == '__main__':
+    main()
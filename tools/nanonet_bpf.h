@@ -0,0 +1,96 @@
+#ifndef __NANONET_BPF_H__
+#define __NANONET_BPF_H__
+
+// Minimal bpf(2) wrappers for the user-space tools, so that they only need
+// kernel UAPI headers and not libbpf.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+
+#define NANONET_DEFAULT_PIN_DIR "/sys/fs/bpf/xdp/globals"
+
+static inline const char *nanonet_pin_dir(void) {
+    const char *dir = getenv("NANONET_XDP_PIN_DIR");
+    return dir ? dir : NANONET_DEFAULT_PIN_DIR;
+}
+
+static inline int bpf_obj_get(const char *path) {
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.pathname = (uint64_t)(unsigned long)path;
+    return syscall(__NR_bpf, BPF_OBJ_GET, &attr, sizeof(attr));
+}
+
+static inline int bpf_map_update(int fd, const void *key, const void *value) {
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key = (uint64_t)(unsigned long)key;
+    attr.value = (uint64_t)(unsigned long)value;
+    attr.flags = BPF_ANY;
+    return syscall(__NR_bpf, BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr));
+}
+
+static inline int bpf_map_lookup(int fd, const void *key, void *value) {
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key = (uint64_t)(unsigned long)key;
+    attr.value = (uint64_t)(unsigned long)value;
+    return syscall(__NR_bpf, BPF_MAP_LOOKUP_ELEM, &attr, sizeof(attr));
+}
+
+static inline int bpf_map_delete(int fd, const void *key) {
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key = (uint64_t)(unsigned long)key;
+    return syscall(__NR_bpf, BPF_MAP_DELETE_ELEM, &attr, sizeof(attr));
+}
+
+static inline int open_pinned_map(const char *name) {
+    char path[256];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", nanonet_pin_dir(), name);
+    fd = bpf_obj_get(path);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open pinned map %s: %s\n", path, strerror(errno));
+    }
+    return fd;
+}
+
+// MAC address of ifname, which XDP and AF_XDP orders carry as their source.
+static inline int nanonet_if_mac(const char *ifname, unsigned char *mac) {
+    struct ifreq ifr;
+    int fd, ret;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+    ret = ioctl(fd, SIOCGIFHWADDR, &ifr);
+    close(fd);
+    if (ret < 0) {
+        return -1;
+    }
+    memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+    return 0;
+}
+
+#endif /* __NANONET_BPF_H__ */
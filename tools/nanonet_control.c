@@ -4,8 +4,13 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <arpa/inet.h>
+#include <net/if.h>
 #include <stdint.h>
+#include <time.h>
+#include "nanonet_bpf.h"
 
 struct ull_config {
     int enabled;
@@ -17,6 +22,25 @@ struct ull_config {
     uint8_t application_logic_type;
     int multicast;
     uint32_t multicast_group;
+    uint32_t ingress_ifindex;
+    uint32_t egress_ifindex;
+};
+
+struct nanonet_flow_rule {
+    uint32_t dst_ip;
+    uint16_t dst_port;
+    uint8_t protocol;
+    uint8_t application_logic_type;
+    uint32_t response_ip;
+    uint16_t response_port;
+    uint16_t order_port;
+    uint32_t order_ip;
+    uint8_t decoder;
+    uint8_t channel;
+    uint8_t line;
+    uint8_t reserved;
+    uint32_t ingress_ifindex;
+    uint32_t egress_ifindex;
 };
 
 struct ull_stats {
@@ -30,6 +54,171 @@ struct ull_stats {
     uint64_t avg_process_time_ns;
     long long connections_active;
     long long connections_dropped;
+    long long connections_evicted;
+};
+
+struct nanonet_stats_page {
+    uint32_t seq;
+    uint32_t refresh_ms;
+    uint64_t updated_ns;
+    struct ull_stats stats;
+    uint64_t latency_count;
+    uint64_t latency_p50_ns;
+    uint64_t latency_p99_ns;
+    uint64_t latency_p999_ns;
+    uint64_t orders_accepted;
+    uint64_t orders_rejected;
+    uint32_t killed;
+    uint32_t reserved;
+};
+
+#define NANONET_HIST_SUB_BITS 4
+#define NANONET_HIST_SUB_COUNT (1 << NANONET_HIST_SUB_BITS)
+#define NANONET_HIST_MAX_EXP 35
+#define NANONET_HIST_BUCKETS ((NANONET_HIST_MAX_EXP - NANONET_HIST_SUB_BITS + 2) << NANONET_HIST_SUB_BITS)
+
+struct ull_latency_histogram {
+    uint64_t count;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t avg_ns;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t buckets[NANONET_HIST_BUCKETS];
+};
+
+struct nanonet_strategy_info {
+    char name[16];
+    uint32_t id;
+};
+
+struct nanonet_symbol_params {
+    char symbol[8];
+    uint32_t price_threshold;
+    uint32_t quantity;
+    uint8_t side;
+    uint8_t enabled;
+    uint16_t reserved;
+    uint32_t max_position;
+    uint64_t max_notional;
+};
+
+struct nanonet_risk_limits {
+    uint32_t max_order_quantity;
+    uint32_t max_orders_per_sec;
+    uint32_t order_burst;
+    uint32_t max_position;
+    uint64_t max_notional;
+};
+
+#define NANONET_RISK_REASONS 7
+
+struct nanonet_risk_status {
+    struct nanonet_risk_limits limits;
+    uint32_t killed;
+    uint32_t reserved;
+    uint64_t accepted;
+    uint64_t rejected[NANONET_RISK_REASONS];
+};
+
+// Config map of the XDP program (include/nanonet_pipeline.h)
+struct nanonet_xdp_config {
+    uint32_t enabled;
+    uint32_t target_ip;
+    uint32_t multicast_group;
+    uint32_t response_ip;
+    uint16_t target_port;
+    uint16_t response_port;
+    uint8_t protocol;
+    uint8_t multicast;
+    uint8_t xsk;
+    uint8_t pad;
+    uint32_t redirect_ifindex;
+    unsigned char h_source[6];
+    uint8_t pad2[2];
+    uint32_t killed;
+    uint32_t max_order_quantity;
+    uint32_t pad3;
+    uint64_t interval_ns;
+    uint64_t tolerance_ns;
+};
+
+static const char *risk_reasons[NANONET_RISK_REASONS] = {
+    "Kill switch", "Malformed order", "Order quantity", "Unknown symbol",
+    "Position limit", "Notional limit", "Order rate",
+};
+
+#define NANONET_MAX_CHANNELS 64
+
+#define NANONET_MMAP_STATS 0x0ULL
+#define NANONET_MMAP_INJECT 0x10000000ULL
+#define NANONET_MMAP_EVENTS 0x100000000ULL
+#define NANONET_MMAP_EVENT_STRIDE 0x1000000ULL
+#define NANONET_RING_NEED_WAKEUP 0x1
+#define MAX_EVENT_RINGS 1024
+
+struct nanonet_event_ring_hdr {
+    uint64_t producer;
+    uint64_t dropped;
+    uint32_t size;
+    uint32_t cpu;
+    uint32_t nr_rings;
+    uint32_t reserved[9];
+    uint64_t consumer;
+    uint32_t flags;
+    uint32_t reserved2[13];
+};
+
+struct nanonet_inject_ring_hdr {
+    uint64_t producer;
+    uint32_t reserved[14];
+    uint64_t consumer;
+    uint64_t sent;
+    uint64_t rejected;
+    uint64_t failed;
+    uint32_t size;
+    uint32_t flags;
+    uint32_t reserved2[6];
+};
+
+struct trading_order {
+    char symbol[8];
+    uint32_t price;
+    uint32_t quantity;
+    uint8_t side;
+    uint64_t timestamp;
+    char clOrdId[16];
+} __attribute__((packed));
+
+struct nanonet_inject_order {
+    uint32_t flow_ip;
+    uint16_t flow_port;
+    uint8_t flow_protocol;
+    uint8_t reserved;
+    struct trading_order order;
+    uint8_t reserved2[64 - 8 - sizeof(struct trading_order)];
+};
+
+#define NANONET_EVENT_TICK 1
+#define NANONET_EVENT_ORDER 2
+#define NANONET_EVENT_REJECT 3
+#define NANONET_EVENT_ERROR 4
+
+struct nanonet_event {
+    uint64_t timestamp;
+    uint8_t type;
+    uint8_t side;
+    uint16_t reason;
+    uint32_t quantity;
+    char symbol[8];
+    uint32_t price;
+    uint32_t flow_ip;
+    uint64_t feed_timestamp;
+    char clOrdId[16];
+    uint16_t flow_port;
+    uint8_t flow_protocol;
+    uint8_t reserved[5];
 };
 
 #define NANONET_IOC_MAGIC 'u'
@@ -38,28 +227,524 @@ struct ull_stats {
 #define NANONET_IOC_GET_STATS _IOR(NANONET_IOC_MAGIC, 3, struct ull_stats)
 #define NANONET_IOC_RESET_STATS _IO(NANONET_IOC_MAGIC, 4)
 #define NANONET_IOC_CLEAR_CONNECTIONS _IO(NANONET_IOC_MAGIC, 5)
+#define NANONET_IOC_GET_HISTOGRAM _IOR(NANONET_IOC_MAGIC, 6, struct ull_latency_histogram)
+#define NANONET_IOC_ADD_FLOW _IOW(NANONET_IOC_MAGIC, 9, struct nanonet_flow_rule)
+#define NANONET_IOC_DEL_FLOW _IOW(NANONET_IOC_MAGIC, 10, struct nanonet_flow_rule)
+#define NANONET_IOC_CLEAR_FLOWS _IO(NANONET_IOC_MAGIC, 11)
+#define NANONET_IOC_GET_STRATEGY _IOWR(NANONET_IOC_MAGIC, 12, struct nanonet_strategy_info)
+#define NANONET_IOC_SET_SYMBOL _IOW(NANONET_IOC_MAGIC, 13, struct nanonet_symbol_params)
+#define NANONET_IOC_CLEAR_SYMBOLS _IO(NANONET_IOC_MAGIC, 14)
+#define NANONET_IOC_SET_RISK _IOW(NANONET_IOC_MAGIC, 15, struct nanonet_risk_limits)
+#define NANONET_IOC_GET_RISK _IOR(NANONET_IOC_MAGIC, 16, struct nanonet_risk_status)
+#define NANONET_IOC_KILL_SWITCH _IOW(NANONET_IOC_MAGIC, 17, uint32_t)
+#define NANONET_IOC_RESET_RISK _IO(NANONET_IOC_MAGIC, 18)
+#define NANONET_IOC_SET_EVENTFD _IOW(NANONET_IOC_MAGIC, 19, int32_t)
+#define NANONET_IOC_INJECT_KICK _IO(NANONET_IOC_MAGIC, 20)
 
 #define DEVICE_PATH "/dev/nanonet"
 
+static uint64_t hist_bucket_lower(unsigned int idx) {
+    unsigned int exp;
+
+    if (idx < NANONET_HIST_SUB_COUNT) {
+        return idx;
+    }
+    exp = (idx >> NANONET_HIST_SUB_BITS) + NANONET_HIST_SUB_BITS - 1;
+    return (uint64_t)(NANONET_HIST_SUB_COUNT + (idx & (NANONET_HIST_SUB_COUNT - 1))) << (exp - NANONET_HIST_SUB_BITS);
+}
+
+static void print_percentiles(const struct ull_latency_histogram *hist) {
+    printf("\nLatency Percentiles (%llu samples):\n", (unsigned long long)hist->count);
+    printf("p50: %llu ns\n", (unsigned long long)hist->p50_ns);
+    printf("p99: %llu ns\n", (unsigned long long)hist->p99_ns);
+    printf("p99.9: %llu ns\n", (unsigned long long)hist->p999_ns);
+    printf("max: %llu ns\n", (unsigned long long)hist->max_ns);
+}
+
+// flow add|del <ip> <port> <proto> [logic <id|name>] [decoder raw|moldudp64] [channel <n> a|b] [from <ip> <port>] [to <ip> <port>]
+// A strategy is given by ID or by the name it registered with.
+static int parse_strategy(int fd, const char *arg) {
+    struct nanonet_strategy_info info;
+
+    if (arg[0] && strspn(arg, "0123456789") == strlen(arg)) {
+        return atoi(arg) <= 255 ? atoi(arg) : -1;
+    }
+
+    memset(&info, 0, sizeof(info));
+    strncpy(info.name, arg, sizeof(info.name) - 1);
+    if (ioctl(fd, NANONET_IOC_GET_STRATEGY, &info) < 0) {
+        fprintf(stderr, "Unknown strategy: %s\n", arg);
+        return -1;
+    }
+    return info.id;
+}
+
+// "in <if>" or "out <if>" at argv[i]; returns 1 if consumed, -1 on a bad name.
+static int parse_device(int argc, char *argv[], int i, uint32_t *ingress, uint32_t *egress) {
+    uint32_t *ifindex;
+
+    if (strcmp(argv[i], "in") == 0) {
+        ifindex = ingress;
+    } else if (strcmp(argv[i], "out") == 0) {
+        ifindex = egress;
+    } else {
+        return 0;
+    }
+    if (i + 1 >= argc) {
+        return -1;
+    }
+    *ifindex = if_nametoindex(argv[i + 1]);
+    if (!*ifindex) {
+        fprintf(stderr, "Unknown network device: %s\n", argv[i + 1]);
+        return -1;
+    }
+    return 1;
+}
+
+static int parse_flow_rule(int fd, int argc, char *argv[], struct nanonet_flow_rule *rule) {
+    int strategy;
+    int channel;
+    int dev;
+    int i;
+
+    memset(rule, 0, sizeof(*rule));
+    if (argc < 6 || inet_pton(AF_INET, argv[3], &rule->dst_ip) != 1) {
+        return -1;
+    }
+    rule->dst_port = htons(atoi(argv[4]));
+    if (strcmp(argv[5], "tcp") == 0) {
+        rule->protocol = 6;
+    } else if (strcmp(argv[5], "udp") == 0) {
+        rule->protocol = 17;
+    } else {
+        return -1;
+    }
+    rule->response_ip = rule->dst_ip;
+    rule->response_port = htons(9999);
+
+    for (i = 6; i < argc; i++) {
+        dev = parse_device(argc, argv, i, &rule->ingress_ifindex, &rule->egress_ifindex);
+        if (dev < 0) {
+            return -1;
+        } else if (dev) {
+            i++;
+        } else if (strcmp(argv[i], "logic") == 0 && i + 1 < argc) {
+            strategy = parse_strategy(fd, argv[++i]);
+            if (strategy < 0) {
+                return -1;
+            }
+            rule->application_logic_type = strategy;
+        } else if (strcmp(argv[i], "decoder") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "raw") == 0) {
+                rule->decoder = 0;
+            } else if (strcmp(argv[i], "moldudp64") == 0) {
+                rule->decoder = 1;
+            } else {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "channel") == 0 && i + 2 < argc) {
+            channel = atoi(argv[i + 1]);
+            if (channel <= 0 || channel >= NANONET_MAX_CHANNELS) {
+                return -1;
+            }
+            rule->channel = channel;
+            if (strcmp(argv[i + 2], "a") == 0) {
+                rule->line = 0;
+            } else if (strcmp(argv[i + 2], "b") == 0) {
+                rule->line = 1;
+            } else {
+                return -1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "from") == 0 && i + 2 < argc) {
+            if (inet_pton(AF_INET, argv[i + 1], &rule->response_ip) != 1) {
+                return -1;
+            }
+            rule->response_port = htons(atoi(argv[i + 2]));
+            i += 2;
+        } else if (strcmp(argv[i], "to") == 0 && i + 2 < argc) {
+            if (inet_pton(AF_INET, argv[i + 1], &rule->order_ip) != 1) {
+                return -1;
+            }
+            rule->order_port = htons(atoi(argv[i + 2]));
+            i += 2;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// symbol set <symbol> <threshold> <qty> <buy|sell> [off] [limit <position> <notional>]
+static int parse_symbol_params(int argc, char *argv[], struct nanonet_symbol_params *params) {
+    int i;
+
+    if (argc < 7 || strcmp(argv[2], "set") != 0 || strlen(argv[3]) > sizeof(params->symbol) ||
+        (strcmp(argv[6], "buy") != 0 && strcmp(argv[6], "sell") != 0)) {
+        return -1;
+    }
+
+    // Symbols are space-padded on the wire, like the feed's
+    memset(params->symbol, ' ', sizeof(params->symbol));
+    memcpy(params->symbol, argv[3], strlen(argv[3]));
+    params->price_threshold = strtoul(argv[4], NULL, 10);
+    params->quantity = strtoul(argv[5], NULL, 10);
+    params->side = strcmp(argv[6], "sell") == 0;
+    params->enabled = 1;
+
+    for (i = 7; i < argc; i++) {
+        if (strcmp(argv[i], "off") == 0) {
+            params->enabled = 0;
+        } else if (strcmp(argv[i], "limit") == 0 && i + 2 < argc) {
+            params->max_position = strtoul(argv[i + 1], NULL, 10);
+            params->max_notional = strtoull(argv[i + 2], NULL, 10);
+            i += 2;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// risk set [qty <n>] [rate <n> [burst <n>]] [position <n>] [notional <cents>]
+static int parse_risk_limits(int argc, char *argv[], struct nanonet_risk_limits *limits) {
+    int i;
+
+    if (argc < 4) {
+        return -1;
+    }
+
+    for (i = 3; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "qty") == 0) {
+            limits->max_order_quantity = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "rate") == 0) {
+            limits->max_orders_per_sec = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "burst") == 0) {
+            limits->order_burst = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "position") == 0) {
+            limits->max_position = strtoul(argv[i + 1], NULL, 10);
+        } else if (strcmp(argv[i], "notional") == 0) {
+            limits->max_notional = strtoull(argv[i + 1], NULL, 10);
+        } else {
+            return -1;
+        }
+    }
+    return i == argc ? 0 : -1;
+}
+
+// Orders from the XDP program and the AF_XDP engine bypass the module's
+// risk checks; the XDP program enforces the kill switch and the quantity
+// and rate limits from its config map instead. Copy them there whenever
+// they change. Nothing to do if the program is not loaded.
+static int sync_xdp_risk(int fd) {
+    struct nanonet_risk_status status;
+    struct nanonet_xdp_config xcfg;
+    uint32_t key = 0;
+    char path[256];
+    int map_fd, ret;
+
+    snprintf(path, sizeof(path), "%s/nanonet_xdp_cfg", nanonet_pin_dir());
+    map_fd = bpf_obj_get(path);
+    if (map_fd < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    ret = ioctl(fd, NANONET_IOC_GET_RISK, &status);
+    if (ret == 0) {
+        ret = bpf_map_lookup(map_fd, &key, &xcfg);
+    }
+    if (ret == 0) {
+        xcfg.killed = status.killed;
+        xcfg.max_order_quantity = status.limits.max_order_quantity;
+        xcfg.interval_ns = 0;
+        xcfg.tolerance_ns = 0;
+        if (status.limits.max_orders_per_sec) {
+            xcfg.interval_ns = 1000000000ULL / status.limits.max_orders_per_sec;
+            xcfg.tolerance_ns = xcfg.interval_ns * (status.limits.order_burst ? status.limits.order_burst - 1 : 0);
+        }
+        ret = bpf_map_update(map_fd, &key, &xcfg);
+    }
+    close(map_fd);
+    return ret;
+}
+
+static void print_event(const struct nanonet_event *ev) {
+    char flow[INET_ADDRSTRLEN];
+
+    inet_ntop(AF_INET, &ev->flow_ip, flow, sizeof(flow));
+    switch (ev->type) {
+        case NANONET_EVENT_TICK:
+            printf("%llu tick   %s:%u %.8s %u x %u\n", (unsigned long long)ev->timestamp, flow, ntohs(ev->flow_port),
+                   ev->symbol, ev->quantity, ev->price);
+            break;
+        case NANONET_EVENT_ORDER:
+        case NANONET_EVENT_REJECT:
+            printf("%llu %s %s:%u %.8s %s %u @ %u %.16s", (unsigned long long)ev->timestamp,
+                   ev->type == NANONET_EVENT_ORDER ? "order " : "reject", flow, ntohs(ev->flow_port),
+                   ev->symbol, ev->side ? "sell" : "buy", ev->quantity, ev->price, ev->clOrdId);
+            if (ev->type == NANONET_EVENT_REJECT && ev->reason < NANONET_RISK_REASONS) {
+                printf(" (%s)", risk_reasons[ev->reason]);
+            }
+            printf("\n");
+            break;
+        case NANONET_EVENT_ERROR:
+            printf("%llu error  %s:%u %s\n", (unsigned long long)ev->timestamp, flow, ntohs(ev->flow_port),
+                   strerror(ev->reason));
+            break;
+    }
+}
+
+// Maps every CPU's event ring and prints events as they arrive. Sleeps in
+// poll() when all rings are empty, or spins on them with busy.
+static int stream_events(int fd, int busy) {
+    struct nanonet_event_ring_hdr *rings[MAX_EVENT_RINGS];
+    struct nanonet_event_ring_hdr *hdr;
+    struct nanonet_event *records;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    uint64_t cons, prod;
+    unsigned int nr_rings = 1, i, n = 0;
+    size_t len;
+    void *map;
+
+    for (i = 0; i < nr_rings; i++) {
+        // The size is only known once the header is mapped.
+        map = mmap(NULL, sizeof(*hdr), PROT_READ, MAP_SHARED, fd, NANONET_MMAP_EVENTS + i * NANONET_MMAP_EVENT_STRIDE);
+        if (map == MAP_FAILED) {
+            rings[i] = NULL;    // Not a possible CPU
+            continue;
+        }
+        hdr = map;
+        len = sizeof(*hdr) + (size_t)hdr->size * sizeof(struct nanonet_event);
+        nr_rings = hdr->nr_rings < MAX_EVENT_RINGS ? hdr->nr_rings : MAX_EVENT_RINGS;
+        munmap(map, sizeof(*hdr));
+
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, NANONET_MMAP_EVENTS + i * NANONET_MMAP_EVENT_STRIDE);
+        if (map == MAP_FAILED) {
+            perror("Failed to map event ring");
+            return 1;
+        }
+        rings[i] = map;
+        n++;
+    }
+    if (!n) {
+        printf("No event rings (module loaded with event_ring_size=0?)\n");
+        return 1;
+    }
+
+    for (;;) {
+        n = 0;
+        for (i = 0; i < nr_rings; i++) {
+            hdr = rings[i];
+            if (!hdr) {
+                continue;
+            }
+            records = (struct nanonet_event *)(hdr + 1);
+            prod = __atomic_load_n(&hdr->producer, __ATOMIC_ACQUIRE);
+            for (cons = hdr->consumer; cons != prod; cons++, n++) {
+                print_event(&records[cons & (hdr->size - 1)]);
+            }
+            __atomic_store_n(&hdr->consumer, cons, __ATOMIC_RELEASE);
+        }
+
+        if (!n && !busy) {
+            fflush(stdout);
+            // poll() asks every ring for a wakeup before it checks them.
+            if (poll(&pfd, 1, -1) < 0) {
+                perror("poll");
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Copies the statistics page between two equal, even reads of its
+// sequence counter; the module never blocks on us.
+static void read_stats_page(const volatile struct nanonet_stats_page *page, struct nanonet_stats_page *out) {
+    uint32_t seq;
+
+    for (;;) {
+        seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(out, (const void *)page, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq) {
+            return;
+        }
+    }
+}
+
+static uint64_t rate(uint64_t now, uint64_t then, uint64_t ns) {
+    // Counters restart from zero after a reset
+    return ns ? (now >= then ? now - then : now) * 1000000000ULL / ns : 0;
+}
+
+// Prints one line of rates and latency percentiles every interval_ms from
+// the mmap statistics page, without a syscall per sample.
+static int watch_stats(int fd, unsigned int interval_ms) {
+    const struct nanonet_stats_page *page;
+    struct nanonet_stats_page cur, prev;
+    unsigned int lines = 0;
+    uint64_t ns;
+
+    page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, NANONET_MMAP_STATS);
+    if (page == MAP_FAILED) {
+        perror("Failed to map statistics page");
+        return 1;
+    }
+
+    read_stats_page(page, &prev);
+    for (;;) {
+        usleep(interval_ms * 1000);
+        read_stats_page(page, &cur);
+        ns = cur.updated_ns - prev.updated_ns;
+
+        if (lines++ % 20 == 0) {
+            printf("%10s %10s %10s %8s %10s %10s %10s %10s %10s\n", "pkts/s", "bypass/s", "resp/s", "errors",
+                   "orders/s", "rejects/s", "p50 ns", "p99 ns", "p99.9 ns");
+        }
+        printf("%10llu %10llu %10llu %8lld %10llu %10llu %10llu %10llu %10llu%s\n",
+               (unsigned long long)rate(cur.stats.packets_processed, prev.stats.packets_processed, ns),
+               (unsigned long long)rate(cur.stats.packets_bypassed, prev.stats.packets_bypassed, ns),
+               (unsigned long long)rate(cur.stats.responses_sent, prev.stats.responses_sent, ns),
+               cur.stats.errors,
+               (unsigned long long)rate(cur.orders_accepted, prev.orders_accepted, ns),
+               (unsigned long long)rate(cur.orders_rejected, prev.orders_rejected, ns),
+               (unsigned long long)cur.latency_p50_ns, (unsigned long long)cur.latency_p99_ns,
+               (unsigned long long)cur.latency_p999_ns, cur.killed ? "  KILLED" : "");
+        fflush(stdout);
+        prev = cur;
+    }
+    return 0;
+}
+
+// inject <ip> <port> <proto> <symbol> <price> <qty> <buy|sell> [count <n>]
+// Writes the orders into the injection ring and kicks the module only if
+// it asked for a kick.
+static int inject_orders(int fd, int argc, char *argv[]) {
+    struct nanonet_inject_ring_hdr *hdr;
+    struct nanonet_inject_order rec, *records;
+    struct timespec ts;
+    uint64_t prod;
+    size_t len;
+    void *map;
+    long count = 1, i;
+
+    memset(&rec, 0, sizeof(rec));
+    if (argc < 9 || inet_pton(AF_INET, argv[2], &rec.flow_ip) != 1 || strlen(argv[5]) > sizeof(rec.order.symbol) ||
+        (strcmp(argv[8], "buy") != 0 && strcmp(argv[8], "sell") != 0)) {
+        return -1;
+    }
+    rec.flow_port = htons(atoi(argv[3]));
+    if (strcmp(argv[4], "tcp") == 0) {
+        rec.flow_protocol = 6;
+    } else if (strcmp(argv[4], "udp") == 0) {
+        rec.flow_protocol = 17;
+    } else {
+        return -1;
+    }
+    memset(rec.order.symbol, ' ', sizeof(rec.order.symbol));
+    memcpy(rec.order.symbol, argv[5], strlen(argv[5]));
+    rec.order.price = strtoul(argv[6], NULL, 10);
+    rec.order.quantity = strtoul(argv[7], NULL, 10);
+    rec.order.side = strcmp(argv[8], "sell") == 0;
+    if (argc == 11 && strcmp(argv[9], "count") == 0) {
+        count = atol(argv[10]);
+    } else if (argc != 9) {
+        return -1;
+    }
+
+    map = mmap(NULL, sizeof(*hdr), PROT_READ, MAP_SHARED, fd, NANONET_MMAP_INJECT);
+    if (map == MAP_FAILED) {
+        perror("Failed to map injection ring");
+        return 1;
+    }
+    len = sizeof(*hdr) + (size_t)((struct nanonet_inject_ring_hdr *)map)->size * sizeof(rec);
+    munmap(map, sizeof(*hdr));
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, NANONET_MMAP_INJECT);
+    if (map == MAP_FAILED) {
+        perror("Failed to map injection ring");
+        return 1;
+    }
+    hdr = map;
+    records = (struct nanonet_inject_order *)(hdr + 1);
+
+    prod = hdr->producer;
+    for (i = 0; i < count; i++) {
+        // Wait for the module to free a slot
+        while (prod - __atomic_load_n(&hdr->consumer, __ATOMIC_ACQUIRE) >= hdr->size) {
+            if (hdr->flags & NANONET_RING_NEED_WAKEUP) {
+                ioctl(fd, NANONET_IOC_INJECT_KICK);
+            }
+        }
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        rec.order.timestamp = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        snprintf(rec.order.clOrdId, sizeof(rec.order.clOrdId), "INJ%012llu", (unsigned long long)prod);
+        records[prod & (hdr->size - 1)] = rec;
+        __atomic_store_n(&hdr->producer, ++prod, __ATOMIC_RELEASE);
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ((hdr->flags & NANONET_RING_NEED_WAKEUP) && ioctl(fd, NANONET_IOC_INJECT_KICK) < 0) {
+        perror("Failed to kick injection ring");
+        return 1;
+    }
+    while (__atomic_load_n(&hdr->consumer, __ATOMIC_ACQUIRE) != prod) {
+        usleep(100);
+    }
+    printf("Injected %ld orders: sent %llu, rejected %llu, failed %llu (ring totals)\n", count,
+           (unsigned long long)hdr->sent, (unsigned long long)hdr->rejected, (unsigned long long)hdr->failed);
+    munmap(map, len);
+    return 0;
+}
+
 void print_usage(const char *program_name) {
     printf("Usage: %s <command> [options]\n", program_name);
     printf("Commands:\n");
     printf("  status                    - Show current status\n");
     printf("  enable                    - Enable packet processing\n");
     printf("  disable                   - Disable packet processing\n");
-    printf("  config <ip> <port> <proto> [multicast <group>]\n");
+    printf("  config <ip> <port> <proto> [multicast <group>] [in <if>] [out <if>]\n");
     printf("                            - Set target configuration\n");
-    printf("  stats                     - Show statistics\n");
+    printf("  stats                     - Show statistics and latency percentiles\n");
+    printf("  histogram                 - Show non-empty latency histogram buckets\n");
     printf("  reset                     - Reset statistics\n");
     printf("  clear-connections         - Clear TCP connections\n");
+    printf("  flow add <ip> <port> <proto> [logic <id|name>] [decoder raw|moldudp64] [channel <n> a|b] [from <ip> <port>] [to <ip> <port>] [in <if>] [out <if>]\n");
+    printf("                            - Add or replace a flow rule (orders from/to the given addresses,\n");
+    printf("                              ticks only from device in, orders out of device out)\n");
+    printf("  flow del <ip> <port> <proto>\n");
+    printf("                            - Remove a flow rule\n");
+    printf("  flow clear                - Remove all flow rules\n");
+    printf("  symbol set <symbol> <threshold> <qty> <buy|sell> [off] [limit <position> <notional>]\n");
+    printf("                            - Set per-symbol strategy parameters and risk limits (cents)\n");
+    printf("  symbol clear              - Remove all symbol parameters\n");
+    printf("  risk                      - Show risk limits and rejections\n");
+    printf("  risk set [qty <n>] [rate <n> [burst <n>]] [position <n>] [notional <cents>]\n");
+    printf("                            - Change risk limits (0 disables a limit)\n");
+    printf("  risk reset                - Forget exposure and reset rejection counters\n");
+    printf("  events [busy]             - Stream tick, order, reject and error events from the mmap rings\n");
+    printf("  inject <ip> <port> <proto> <symbol> <price> <qty> <buy|sell> [count <n>]\n");
+    printf("                            - Send orders through the injection ring, routed and risk-checked by the flow\n");
+    printf("  watch [interval_ms]       - Print rates and latency percentiles from the mmap statistics page\n");
+    printf("                              (default every 1000 ms)\n");
+    printf("  kill                      - Engage the kill switch: send no more orders\n");
+    printf("  resume                    - Release the kill switch\n");
     printf("\nExample:\n");
     printf("  %s config 192.168.1.100 8080 udp multicast 239.1.1.1\n", program_name);
+    printf("  %s flow add 239.1.1.2 8081 udp to 10.0.0.5 7000\n", program_name);
+    printf("  %s flow add 239.2.1.1 9001 udp in eth2 out eth3\n", program_name);
 }
 
 int main(int argc, char *argv[]) {
     int fd;
     struct ull_config config;
     struct ull_stats stats;
+    struct ull_latency_histogram hist;
     int ret;
 
     if (argc < 2) {
@@ -96,6 +781,16 @@ int main(int argc, char *argv[]) {
         if (config.multicast) {
             printf("Multicast Group: %s\n", inet_ntoa(*(struct in_addr*)&config.multicast_group));
         }
+        if (config.ingress_ifindex) {
+            char name[IF_NAMESIZE];
+
+            printf("Ingress Device: %s\n", if_indextoname(config.ingress_ifindex, name) ? name : "(gone)");
+        }
+        if (config.egress_ifindex) {
+            char name[IF_NAMESIZE];
+
+            printf("Egress Device: %s\n", if_indextoname(config.egress_ifindex, name) ? name : "(gone)");
+        }
         printf("\nStatistics:\n");
         printf("Packets Processed: %lld\n", stats.packets_processed);
         printf("Packets Bypassed: %lld\n", stats.packets_bypassed);
@@ -103,6 +798,7 @@ int main(int argc, char *argv[]) {
         printf("Errors: %lld\n", stats.errors);
         printf("Active Connections: %lld\n", stats.connections_active);
         printf("Dropped Connections: %lld\n", stats.connections_dropped);
+        printf("Evicted Connections: %lld\n", stats.connections_evicted);
         printf("Min Process Time: %llu ns\n", stats.min_process_time_ns);
         printf("Max Process Time: %llu ns\n", stats.max_process_time_ns);
         printf("Avg Process Time: %llu ns\n", stats.avg_process_time_ns);
@@ -140,8 +836,10 @@ int main(int argc, char *argv[]) {
         printf("Module disabled\n");
 
     } else if (strcmp(argv[1], "config") == 0) {
-        if (argc < 5 || (strcmp(argv[4], "multicast") == 0 && argc != 6)) {
-            printf("Usage: %s config <ip> <port> <proto> [multicast <group>]\n", argv[0]);
+        int i, dev;
+
+        if (argc < 5) {
+            printf("Usage: %s config <ip> <port> <proto> [multicast <group>] [in <if>] [out <if>]\n", argv[0]);
             close(fd);
             return 1;
         }
@@ -166,10 +864,20 @@ int main(int argc, char *argv[]) {
         config.response_port = htons(9999);
         config.application_logic_type = 0;
 
-        if (argc == 6 && strcmp(argv[4], "udp") == 0 && strcmp(argv[5], "multicast") == 0) {
-            config.multicast = 1;
-            if (inet_aton(argv[6], (struct in_addr*)&config.multicast_group) == 0) {
-                printf("Invalid multicast group: %s\n", argv[6]);
+        for (i = 5; i < argc; i++) {
+            dev = parse_device(argc, argv, i, &config.ingress_ifindex, &config.egress_ifindex);
+            if (dev > 0) {
+                i++;
+            } else if (dev == 0 && strcmp(argv[i], "multicast") == 0 && i + 1 < argc &&
+                       config.protocol == 17) {
+                config.multicast = 1;
+                if (inet_aton(argv[++i], (struct in_addr*)&config.multicast_group) == 0) {
+                    printf("Invalid multicast group: %s\n", argv[i]);
+                    close(fd);
+                    return 1;
+                }
+            } else {
+                printf("Usage: %s config <ip> <port> <proto> [multicast <group>] [in <if>] [out <if>]\n", argv[0]);
                 close(fd);
                 return 1;
             }
@@ -197,10 +905,38 @@ int main(int argc, char *argv[]) {
         printf("Errors: %lld\n", stats.errors);
         printf("Active Connections: %lld\n", stats.connections_active);
         printf("Dropped Connections: %lld\n", stats.connections_dropped);
+        printf("Evicted Connections: %lld\n", stats.connections_evicted);
         printf("Min Process Time: %llu ns\n", stats.min_process_time_ns);
         printf("Max Process Time: %llu ns\n", stats.max_process_time_ns);
         printf("Avg Process Time: %llu ns\n", stats.avg_process_time_ns);
 
+        ret = ioctl(fd, NANONET_IOC_GET_HISTOGRAM, &hist);
+        if (ret < 0) {
+            perror("Failed to get latency histogram");
+            close(fd);
+            return 1;
+        }
+        print_percentiles(&hist);
+
+    } else if (strcmp(argv[1], "histogram") == 0) {
+        ret = ioctl(fd, NANONET_IOC_GET_HISTOGRAM, &hist);
+        if (ret < 0) {
+            perror("Failed to get latency histogram");
+            close(fd);
+            return 1;
+        }
+        printf("%-14s %-12s %s\n", "Lower (ns)", "Count", "Cumulative");
+        uint64_t seen = 0;
+        for (unsigned int i = 0; i < NANONET_HIST_BUCKETS; i++) {
+            if (!hist.buckets[i]) {
+                continue;
+            }
+            seen += hist.buckets[i];
+            printf("%-14llu %-12llu %6.3f%%\n", (unsigned long long)hist_bucket_lower(i),
+                   (unsigned long long)hist.buckets[i], 100.0 * seen / hist.count);
+        }
+        print_percentiles(&hist);
+
     } else if (strcmp(argv[1], "reset") == 0) {
         ret = ioctl(fd, NANONET_IOC_RESET_STATS, 0);
         if (ret < 0) {
@@ -219,6 +955,143 @@ int main(int argc, char *argv[]) {
         }
         printf("TCP connections cleared\n");
 
+    } else if (strcmp(argv[1], "flow") == 0) {
+        struct nanonet_flow_rule rule;
+
+        if (argc >= 3 && strcmp(argv[2], "clear") == 0) {
+            ret = ioctl(fd, NANONET_IOC_CLEAR_FLOWS, 0);
+        } else if (argc >= 3 && (strcmp(argv[2], "add") == 0 || strcmp(argv[2], "del") == 0) &&
+                   parse_flow_rule(fd, argc, argv, &rule) == 0) {
+            ret = ioctl(fd, strcmp(argv[2], "add") == 0 ? NANONET_IOC_ADD_FLOW : NANONET_IOC_DEL_FLOW, &rule);
+        } else {
+            printf("Usage: %s flow add|del <ip> <port> <proto> [logic <id|name>] [decoder raw|moldudp64] [channel <n> a|b] [from <ip> <port>] [to <ip> <port>] [in <if>] [out <if>]\n", argv[0]);
+            printf("       %s flow clear\n", argv[0]);
+            close(fd);
+            return 1;
+        }
+        if (ret < 0) {
+            perror("Failed to update flow rules");
+            close(fd);
+            return 1;
+        }
+        printf("Flow rules updated\n");
+
+    } else if (strcmp(argv[1], "symbol") == 0) {
+        struct nanonet_symbol_params params;
+
+        memset(&params, 0, sizeof(params));
+        if (argc >= 3 && strcmp(argv[2], "clear") == 0) {
+            ret = ioctl(fd, NANONET_IOC_CLEAR_SYMBOLS, 0);
+        } else if (parse_symbol_params(argc, argv, &params) == 0) {
+            ret = ioctl(fd, NANONET_IOC_SET_SYMBOL, &params);
+        } else {
+            printf("Usage: %s symbol set <symbol> <threshold> <qty> <buy|sell> [off] [limit <position> <notional>]\n", argv[0]);
+            printf("       %s symbol clear\n", argv[0]);
+            close(fd);
+            return 1;
+        }
+        if (ret < 0) {
+            perror("Failed to update symbols");
+            close(fd);
+            return 1;
+        }
+        printf("Symbols updated\n");
+
+    } else if (strcmp(argv[1], "risk") == 0) {
+        struct nanonet_risk_status status;
+        int i;
+
+        if (argc >= 3 && strcmp(argv[2], "reset") == 0) {
+            if (ioctl(fd, NANONET_IOC_RESET_RISK, 0) < 0) {
+                perror("Failed to reset risk");
+                close(fd);
+                return 1;
+            }
+            printf("Risk exposure and counters reset\n");
+            close(fd);
+            return 0;
+        }
+
+        if (ioctl(fd, NANONET_IOC_GET_RISK, &status) < 0) {
+            perror("Failed to get risk status");
+            close(fd);
+            return 1;
+        }
+
+        if (argc >= 3 && strcmp(argv[2], "set") == 0) {
+            if (parse_risk_limits(argc, argv, &status.limits) < 0) {
+                printf("Usage: %s risk set [qty <n>] [rate <n> [burst <n>]] [position <n>] [notional <cents>]\n", argv[0]);
+                close(fd);
+                return 1;
+            }
+            if (ioctl(fd, NANONET_IOC_SET_RISK, &status.limits) < 0) {
+                perror("Failed to set risk limits");
+                close(fd);
+                return 1;
+            }
+            if (sync_xdp_risk(fd) < 0) {
+                perror("Failed to update XDP risk limits");
+                close(fd);
+                return 1;
+            }
+            printf("Risk limits updated\n");
+        } else if (argc > 2) {
+            printf("Usage: %s risk [set ...|reset]\n", argv[0]);
+            close(fd);
+            return 1;
+        }
+
+        printf("Kill Switch: %s\n", status.killed ? "ENGAGED" : "off");
+        printf("Max Order Quantity: %u\n", status.limits.max_order_quantity);
+        printf("Max Orders/sec per Rule: %u (burst %u)\n", status.limits.max_orders_per_sec,
+               status.limits.order_burst);
+        printf("Max Position per Symbol: %u\n", status.limits.max_position);
+        printf("Max Notional per Symbol: %llu\n", (unsigned long long)status.limits.max_notional);
+        printf("Orders Accepted: %llu\n", (unsigned long long)status.accepted);
+        for (i = 0; i < NANONET_RISK_REASONS; i++) {
+            printf("Rejected (%s): %llu\n", risk_reasons[i], (unsigned long long)status.rejected[i]);
+        }
+
+    } else if (strcmp(argv[1], "events") == 0) {
+        ret = stream_events(fd, argc >= 3 && strcmp(argv[2], "busy") == 0);
+        close(fd);
+        return ret;
+
+    } else if (strcmp(argv[1], "inject") == 0) {
+        ret = inject_orders(fd, argc, argv);
+        if (ret < 0) {
+            print_usage(argv[0]);
+        }
+        close(fd);
+        return ret ? 1 : 0;
+
+    } else if (strcmp(argv[1], "watch") == 0) {
+        int interval_ms = argc >= 3 ? atoi(argv[2]) : 1000;
+
+        if (interval_ms <= 0) {
+            printf("Invalid interval: %s\n", argv[2]);
+            close(fd);
+            return 1;
+        }
+        ret = watch_stats(fd, interval_ms);
+        close(fd);
+        return ret;
+
+    } else if (strcmp(argv[1], "kill") == 0 || strcmp(argv[1], "resume") == 0) {
+        uint32_t killed = strcmp(argv[1], "kill") == 0;
+
+        if (ioctl(fd, NANONET_IOC_KILL_SWITCH, &killed) < 0) {
+            perror("Failed to set kill switch");
+            close(fd);
+            return 1;
+        }
+        if (sync_xdp_risk(fd) < 0) {
+            perror("Failed to set XDP kill switch");
+            close(fd);
+            return 1;
+        }
+        printf("Kill switch %s\n", killed ? "engaged" : "released");
+
     } else {
         printf("Unknown command: %s\n", argv[1]);
         print_usage(argv[0]);
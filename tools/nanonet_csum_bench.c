@@ -0,0 +1,163 @@
+// Checksum microbenchmark.
+//
+// Compares the Internet checksum variants used across NanoNet on buffers
+// of typical frame sizes:
+//   scalar16  the original 16-bit-at-a-time loop (odd-byte handling fixed)
+//   wide64    nanonet_csum_add() from include/nanonet_pipeline.h
+// and, for a 20-byte IP header, a full recompute against the RFC 1624
+// incremental update the send path uses to patch tot_len and id.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "../include/nanonet_pipeline.h"
+
+#define DEFAULT_ITERATIONS 2000000
+
+static volatile __sum16 sink;
+
+static __sum16 csum_scalar16(const void *data, int len) {
+    const uint16_t *ptr = data;
+    uint32_t sum = 0;
+
+    while (len > 1) {
+        sum += *ptr++;
+        len -= 2;
+    }
+    if (len == 1) {
+        sum += *(const uint8_t *)ptr;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (__sum16)~sum;
+}
+
+static __sum16 csum_wide64(const void *data, int len) {
+    return nanonet_csum_fold(nanonet_csum_add(data, len, 0));
+}
+
+// RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m')
+static __sum16 csum_replace16(__sum16 check, uint16_t old, uint16_t new) {
+    uint32_t sum = (uint16_t)~check + (uint16_t)~old + new;
+
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (__sum16)~sum;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double bench(__sum16 (*fn)(const void *, int), const void *buf, int len, long iterations) {
+    double start = now_ns();
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        sink = fn(buf, len);
+        __asm__ volatile("" ::: "memory");
+    }
+    return (now_ns() - start) / iterations;
+}
+
+static void bench_ip_header(long iterations) {
+    struct ull_iphdr ip = {
+        .version_ihl = 0x45,
+        .tot_len = 0,
+        .frag_off = nn_htons(NANONET_IP_DF),
+        .ttl = 64,
+        .protocol = NANONET_IPPROTO_UDP,
+        .saddr = nn_htonl(0xC0A80164),
+        .daddr = nn_htonl(0xC0A80101),
+    };
+    __sum16 base, check;
+    double start, full, incr;
+    long i;
+
+    ip.check = csum_wide64(&ip, sizeof(ip));
+    base = ip.check;
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+        ip.tot_len = nn_htons(28 + (i & 0x3FF));
+        ip.id = nn_htons((uint16_t)i);
+        ip.check = 0;
+        ip.check = csum_wide64(&ip, sizeof(ip));
+        sink = ip.check;
+        __asm__ volatile("" ::: "memory");
+    }
+    full = (now_ns() - start) / iterations;
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+        __be16 tot_len = nn_htons(28 + (i & 0x3FF));
+        __be16 id = nn_htons((uint16_t)i);
+
+        check = csum_replace16(base, 0, tot_len);
+        check = csum_replace16(check, 0, id);
+        sink = check;
+        __asm__ volatile("" ::: "memory");
+    }
+    incr = (now_ns() - start) / iterations;
+
+    // Both must agree with a checksum computed from scratch
+    ip.check = 0;
+    ip.check = csum_wide64(&ip, sizeof(ip));
+    if (ip.check != check) {
+        fprintf(stderr, "Incremental checksum mismatch: %04x != %04x\n", check, ip.check);
+        exit(1);
+    }
+
+    printf("\nIP header (20 bytes): full %.2f ns, incremental %.2f ns\n", full, incr);
+}
+
+int main(int argc, char *argv[]) {
+    static const int sizes[] = {20, 64, 128, 256, 512, 1024, 1472};
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    unsigned char *buf;
+    size_t i;
+
+    if (iterations <= 0) {
+        printf("Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    buf = malloc(2048);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    srand(1);
+    for (i = 0; i < 2048; i++) {
+        buf[i] = rand();
+    }
+
+    printf("%-8s %-14s %-14s %-8s\n", "Bytes", "scalar16 (ns)", "wide64 (ns)", "Speedup");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        int len = sizes[i];
+        double scalar, wide;
+
+        // Offset 2, like a payload behind NET_IP_ALIGN: not 8-byte aligned
+        if (csum_scalar16(buf + 2, len) != csum_wide64(buf + 2, len) ||
+            csum_scalar16(buf + 2, len - 1) != csum_wide64(buf + 2, len - 1)) {
+            fprintf(stderr, "Checksum mismatch at %d bytes\n", len);
+            return 1;
+        }
+
+        scalar = bench(csum_scalar16, buf + 2, len, iterations);
+        wide = bench(csum_wide64, buf + 2, len, iterations);
+        printf("%-8d %-14.2f %-14.2f %.2fx\n", len, scalar, wide, scalar / wide);
+    }
+
+    bench_ip_header(iterations);
+
+    free(buf);
+    return 0;
+}
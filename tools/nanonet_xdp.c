@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+#include "../include/nanonet_pipeline.h"
+#include "nanonet_bpf.h"
+
+struct ull_config {
+    int enabled;
+    uint32_t target_ip;
+    uint16_t target_port;
+    uint8_t protocol;
+    uint32_t response_ip;
+    uint16_t response_port;
+    uint8_t application_logic_type;
+    int multicast;
+    uint32_t multicast_group;
+    uint32_t ingress_ifindex;
+    uint32_t egress_ifindex;
+};
+
+struct nanonet_risk_limits {
+    uint32_t max_order_quantity;
+    uint32_t max_orders_per_sec;
+    uint32_t order_burst;
+    uint32_t max_position;
+    uint64_t max_notional;
+};
+
+#define NANONET_RISK_REASONS 7
+
+struct nanonet_risk_status {
+    struct nanonet_risk_limits limits;
+    uint32_t killed;
+    uint32_t reserved;
+    uint64_t accepted;
+    uint64_t rejected[NANONET_RISK_REASONS];
+};
+
+#define NANONET_INGRESS_NETFILTER 1
+#define NANONET_INGRESS_XDP 2
+
+#define NANONET_IOC_MAGIC 'u'
+#define NANONET_IOC_GET_CONFIG _IOR(NANONET_IOC_MAGIC, 2, struct ull_config)
+#define NANONET_IOC_SET_INGRESS_MODE _IOW(NANONET_IOC_MAGIC, 7, uint32_t)
+#define NANONET_IOC_GET_RISK _IOR(NANONET_IOC_MAGIC, 16, struct nanonet_risk_status)
+
+#define DEVICE_PATH "/dev/nanonet"
+#define DEFAULT_XDP_OBJ "src/nanonet_xdp.bpf.o"
+
+static int set_module_mode(uint32_t mode) {
+    int fd, ret;
+
+    fd = open(DEVICE_PATH, O_RDWR);
+    if (fd < 0) {
+        perror("Failed to open device");
+        return -1;
+    }
+    ret = ioctl(fd, NANONET_IOC_SET_INGRESS_MODE, &mode);
+    if (ret < 0) {
+        perror("Failed to set ingress mode");
+    }
+    close(fd);
+    return ret;
+}
+
+// Mirror the module configuration and risk limits into the XDP config map.
+// Orders leave on redirect_ifname if given, else on ifname; with neither,
+// the source MAC already in the map is kept.
+static int sync_config(const char *ifname, const char *redirect_ifname) {
+    struct ull_config config;
+    struct nanonet_risk_status risk;
+    struct nanonet_xdp_config xcfg, old;
+    const char *out_ifname = redirect_ifname ? redirect_ifname : ifname;
+    uint32_t key = 0;
+    int dev_fd, map_fd, ret;
+
+    dev_fd = open(DEVICE_PATH, O_RDWR);
+    if (dev_fd < 0) {
+        perror("Failed to open device");
+        return -1;
+    }
+    ret = ioctl(dev_fd, NANONET_IOC_GET_CONFIG, &config);
+    if (ret < 0) {
+        perror("Failed to get configuration");
+        close(dev_fd);
+        return -1;
+    }
+    ret = ioctl(dev_fd, NANONET_IOC_GET_RISK, &risk);
+    close(dev_fd);
+    if (ret < 0) {
+        perror("Failed to get risk limits");
+        return -1;
+    }
+
+    if (config.protocol != NANONET_IPPROTO_UDP) {
+        fprintf(stderr, "XDP ingress mode supports UDP only\n");
+        return -1;
+    }
+
+    memset(&xcfg, 0, sizeof(xcfg));
+    xcfg.enabled = config.enabled;
+    xcfg.target_ip = config.target_ip;
+    xcfg.target_port = config.target_port;
+    xcfg.protocol = config.protocol;
+    xcfg.multicast = config.multicast;
+    xcfg.multicast_group = config.multicast_group;
+    xcfg.response_ip = config.response_ip;
+    xcfg.response_port = config.response_port;
+    xcfg.killed = risk.killed;
+    xcfg.max_order_quantity = risk.limits.max_order_quantity;
+    nanonet_xdp_set_rate(&xcfg, risk.limits.max_orders_per_sec, risk.limits.order_burst);
+    if (risk.limits.max_position || risk.limits.max_notional) {
+        fprintf(stderr, "Warning: position and notional limits are not enforced in XDP mode\n");
+    }
+    if (redirect_ifname) {
+        xcfg.redirect_ifindex = if_nametoindex(redirect_ifname);
+        if (!xcfg.redirect_ifindex) {
+            fprintf(stderr, "Unknown redirect interface: %s\n", redirect_ifname);
+            return -1;
+        }
+    }
+    if (out_ifname && nanonet_if_mac(out_ifname, xcfg.h_source) < 0) {
+        fprintf(stderr, "Failed to read the MAC address of %s\n", out_ifname);
+        return -1;
+    }
+
+    map_fd = open_pinned_map("nanonet_xdp_cfg");
+    if (map_fd < 0) {
+        return -1;
+    }
+    if (!out_ifname) {
+        if (bpf_map_lookup(map_fd, &key, &old) < 0) {
+            perror("Failed to read XDP config map");
+            close(map_fd);
+            return -1;
+        }
+        memcpy(xcfg.h_source, old.h_source, sizeof(xcfg.h_source));
+    }
+    ret = bpf_map_update(map_fd, &key, &xcfg);
+    if (ret < 0) {
+        perror("Failed to update XDP config map");
+    }
+    close(map_fd);
+    return ret;
+}
+
+static int show_stats(void) {
+    struct nanonet_xdp_stats *per_cpu, total;
+    uint32_t key = 0;
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    int map_fd, i;
+
+    map_fd = open_pinned_map("nanonet_xdp_stats");
+    if (map_fd < 0) {
+        return -1;
+    }
+
+    per_cpu = calloc(ncpus, sizeof(*per_cpu));
+    if (!per_cpu || bpf_map_lookup(map_fd, &key, per_cpu) < 0) {
+        perror("Failed to read XDP stats map");
+        free(per_cpu);
+        close(map_fd);
+        return -1;
+    }
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < ncpus; i++) {
+        total.packets_processed += per_cpu[i].packets_processed;
+        total.packets_bypassed += per_cpu[i].packets_bypassed;
+        total.responses_sent += per_cpu[i].responses_sent;
+        total.errors += per_cpu[i].errors;
+        total.orders_rejected += per_cpu[i].orders_rejected;
+    }
+
+    printf("XDP Statistics:\n");
+    printf("Packets Processed: %llu\n", (unsigned long long)total.packets_processed);
+    printf("Packets Bypassed: %llu\n", (unsigned long long)total.packets_bypassed);
+    printf("Responses Sent: %llu\n", (unsigned long long)total.responses_sent);
+    printf("Errors: %llu\n", (unsigned long long)total.errors);
+    printf("Orders Rejected: %llu\n", (unsigned long long)total.orders_rejected);
+
+    free(per_cpu);
+    close(map_fd);
+    return 0;
+}
+
+static int run_ip_link(const char *ifname, const char *args) {
+    char cmd[512];
+
+    snprintf(cmd, sizeof(cmd), "ip -force link set dev %s %s", ifname, args);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "Command failed: %s\n", cmd);
+        return -1;
+    }
+    return 0;
+}
+
+void print_usage(const char *program_name) {
+    printf("Usage: %s <command> [options]\n", program_name);
+    printf("Commands:\n");
+    printf("  attach <ifname> [native|generic] [redirect <ifname>]\n");
+    printf("                            - Load the XDP program and switch the module to XDP mode\n");
+    printf("  detach <ifname>           - Remove the XDP program and switch back to netfilter mode\n");
+    printf("  sync [<ifname>] [redirect <ifname>]\n");
+    printf("                            - Push the module configuration into the XDP program\n");
+    printf("  stats                     - Show XDP path statistics\n");
+    printf("\nEnvironment:\n");
+    printf("  NANONET_XDP_OBJ           - XDP object file (default %s)\n", DEFAULT_XDP_OBJ);
+    printf("  NANONET_XDP_PIN_DIR       - bpffs directory of pinned maps (default %s)\n", NANONET_DEFAULT_PIN_DIR);
+}
+
+int main(int argc, char *argv[]) {
+    const char *obj = getenv("NANONET_XDP_OBJ") ? getenv("NANONET_XDP_OBJ") : DEFAULT_XDP_OBJ;
+    const char *redirect = NULL;
+    char args[384];
+
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = 2; i < argc - 1; i++) {
+        if (strcmp(argv[i], "redirect") == 0) {
+            redirect = argv[i + 1];
+        }
+    }
+
+    if (strcmp(argv[1], "attach") == 0) {
+        const char *xdp_mode = "xdpdrv";
+
+        if (argc < 3) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (argc > 3 && strcmp(argv[3], "generic") == 0) {
+            xdp_mode = "xdpgeneric";
+        }
+
+        snprintf(args, sizeof(args), "%s obj %s sec xdp", xdp_mode, obj);
+        if (run_ip_link(argv[2], args) < 0) {
+            return 1;
+        }
+        if (sync_config(argv[2], redirect) < 0 || set_module_mode(NANONET_INGRESS_XDP) < 0) {
+            run_ip_link(argv[2], "xdp off");
+            return 1;
+        }
+        printf("XDP program attached to %s (%s)\n", argv[2], xdp_mode);
+
+    } else if (strcmp(argv[1], "detach") == 0) {
+        if (argc < 3) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (set_module_mode(NANONET_INGRESS_NETFILTER) < 0) {
+            return 1;
+        }
+        if (run_ip_link(argv[2], "xdp off") < 0) {
+            return 1;
+        }
+        printf("XDP program detached from %s\n", argv[2]);
+
+    } else if (strcmp(argv[1], "sync") == 0) {
+        const char *ifname = argc > 2 && strcmp(argv[2], "redirect") != 0 ? argv[2] : NULL;
+
+        if (sync_config(ifname, redirect) < 0) {
+            return 1;
+        }
+        printf("XDP configuration synchronized\n");
+
+    } else if (strcmp(argv[1], "stats") == 0) {
+        if (show_stats() < 0) {
+            return 1;
+        }
+
+    } else {
+        printf("Unknown command: %s\n", argv[1]);
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,587 @@
+// AF_XDP user-space engine.
+//
+// Runs the same parse -> strategy -> response pipeline as the kernel module
+// (include/nanonet_pipeline.h) on frames redirected to AF_XDP sockets by
+// src/nanonet_xdp.bpf.c. One pinned thread busy-polls each queue and sends
+// orders straight out of the UMEM frame the tick arrived in. The XDP program
+// applies the kill switch and the quantity and rate limits before it
+// redirects a tick, so the engine does not check them again.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_xdp.h>
+#include "../include/nanonet_pipeline.h"
+#include "nanonet_bpf.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+#define NUM_FRAMES 4096
+#define FRAME_SIZE 2048
+#define RING_SIZE 2048
+#define BATCH_SIZE 64
+
+struct xsk_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;
+    uint32_t size;
+    uint32_t mask;
+    uint32_t cached_prod;
+    uint32_t cached_cons;
+    void *map;
+    size_t map_len;
+};
+
+struct engine_stats {
+    uint64_t rx_frames;
+    uint64_t packets_processed;
+    uint64_t packets_bypassed;
+    uint64_t responses_sent;
+    uint64_t tx_completed;
+    uint64_t tx_ring_full;
+    uint64_t errors;
+    uint64_t min_process_time_ns;
+    uint64_t max_process_time_ns;
+    uint64_t total_process_time_ns;
+};
+
+struct xsk_queue {
+    int queue_id;
+    int cpu;
+    int fd;
+    void *umem;
+    struct xsk_ring fill;
+    struct xsk_ring comp;
+    struct xsk_ring rx;
+    struct xsk_ring tx;
+    uint64_t free_frames[NUM_FRAMES];
+    uint32_t free_count;
+    struct engine_stats stats;
+    struct nanonet_order_id_gen order_ids;
+    pthread_t thread;
+};
+
+struct engine_config {
+    const char *ifname;
+    int ifindex;
+    int num_queues;
+    int first_queue;
+    int first_cpu;
+    int zerocopy;
+    int busy_poll;
+    struct nanonet_xdp_config xdp;
+};
+
+static struct engine_config engine;
+static volatile int stop_requested;
+
+static inline uint64_t now_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Producer side (fill, tx): number of free slots, refreshing the cached
+// consumer index only when the cached view says we are short.
+static inline uint32_t ring_prod_free(struct xsk_ring *r, uint32_t wanted) {
+    uint32_t free_slots = r->size - (r->cached_prod - r->cached_cons);
+
+    if (free_slots >= wanted) {
+        return free_slots;
+    }
+    r->cached_cons = __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE);
+    return r->size - (r->cached_prod - r->cached_cons);
+}
+
+static inline void ring_prod_submit(struct xsk_ring *r) {
+    __atomic_store_n(r->producer, r->cached_prod, __ATOMIC_RELEASE);
+}
+
+// Consumer side (rx, completion)
+static inline uint32_t ring_cons_avail(struct xsk_ring *r) {
+    uint32_t avail = r->cached_prod - r->cached_cons;
+
+    if (avail == 0) {
+        r->cached_prod = __atomic_load_n(r->producer, __ATOMIC_ACQUIRE);
+        avail = r->cached_prod - r->cached_cons;
+    }
+    return avail;
+}
+
+static inline void ring_cons_release(struct xsk_ring *r) {
+    __atomic_store_n(r->consumer, r->cached_cons, __ATOMIC_RELEASE);
+}
+
+static inline int ring_needs_wakeup(struct xsk_ring *r) {
+    return __atomic_load_n(r->flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP;
+}
+
+static int map_ring(int fd, struct xsk_ring *r, const struct xdp_ring_offset *off, size_t desc_size, off_t pgoff) {
+    r->map_len = off->desc + RING_SIZE * desc_size;
+    r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        return -1;
+    }
+
+    r->producer = (uint32_t *)((char *)r->map + off->producer);
+    r->consumer = (uint32_t *)((char *)r->map + off->consumer);
+    r->flags = (uint32_t *)((char *)r->map + off->flags);
+    r->descs = (char *)r->map + off->desc;
+    r->size = RING_SIZE;
+    r->mask = RING_SIZE - 1;
+    r->cached_prod = *r->producer;
+    r->cached_cons = *r->consumer;
+    return 0;
+}
+
+static void refill(struct xsk_queue *q) {
+    uint32_t n = ring_prod_free(&q->fill, 1);
+    uint64_t *descs = q->fill.descs;
+
+    if (n > q->free_count) {
+        n = q->free_count;
+    }
+    if (n == 0) {
+        return;
+    }
+
+    while (n--) {
+        descs[q->fill.cached_prod++ & q->fill.mask] = q->free_frames[--q->free_count];
+    }
+    ring_prod_submit(&q->fill);
+}
+
+static int xsk_queue_setup(struct xsk_queue *q) {
+    struct xdp_umem_reg umem_reg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    socklen_t optlen = sizeof(off);
+    int ring_size = RING_SIZE;
+    int map_fd;
+    uint32_t key;
+    int i;
+
+    q->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (q->fd < 0) {
+        perror("Failed to create AF_XDP socket");
+        return -1;
+    }
+
+    q->umem = mmap(NULL, (size_t)NUM_FRAMES * FRAME_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (q->umem == MAP_FAILED) {
+        q->umem = NULL;
+        perror("Failed to allocate UMEM");
+        return -1;
+    }
+
+    memset(&umem_reg, 0, sizeof(umem_reg));
+    umem_reg.addr = (uint64_t)(unsigned long)q->umem;
+    umem_reg.len = (uint64_t)NUM_FRAMES * FRAME_SIZE;
+    umem_reg.chunk_size = FRAME_SIZE;
+    umem_reg.headroom = 0;
+    if (setsockopt(q->fd, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg)) < 0 ||
+        setsockopt(q->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(q->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(q->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) < 0 ||
+        setsockopt(q->fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) < 0) {
+        perror("Failed to configure UMEM rings");
+        return -1;
+    }
+
+    if (getsockopt(q->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+        perror("Failed to get ring offsets");
+        return -1;
+    }
+
+    if (map_ring(q->fd, &q->fill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) < 0 ||
+        map_ring(q->fd, &q->comp, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) < 0 ||
+        map_ring(q->fd, &q->rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) < 0 ||
+        map_ring(q->fd, &q->tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) < 0) {
+        perror("Failed to map rings");
+        return -1;
+    }
+
+    if (engine.busy_poll) {
+        int one = 1, usecs = 20, budget = BATCH_SIZE;
+
+        if (setsockopt(q->fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) < 0 ||
+            setsockopt(q->fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) < 0 ||
+            setsockopt(q->fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget)) < 0) {
+            perror("Failed to enable socket busy polling");
+            return -1;
+        }
+    }
+
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = engine.ifindex;
+    sxdp.sxdp_queue_id = q->queue_id;
+    sxdp.sxdp_flags = (engine.zerocopy ? XDP_ZEROCOPY : XDP_COPY) | XDP_USE_NEED_WAKEUP;
+    if (bind(q->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+        perror("Failed to bind AF_XDP socket");
+        return -1;
+    }
+
+    for (i = 0; i < NUM_FRAMES; i++) {
+        q->free_frames[q->free_count++] = (uint64_t)i * FRAME_SIZE;
+    }
+    refill(q);
+
+    map_fd = open_pinned_map("nanonet_xsks");
+    if (map_fd < 0) {
+        return -1;
+    }
+    key = q->queue_id;
+    if (bpf_map_update(map_fd, &key, &q->fd) < 0) {
+        perror("Failed to register socket in XSK map");
+        close(map_fd);
+        return -1;
+    }
+    close(map_fd);
+
+    q->stats.min_process_time_ns = UINT64_MAX;
+    nanonet_order_id_init(&q->order_ids, q->queue_id, nanonet_order_id_clock_seed(now_ns(CLOCK_REALTIME)));
+    return 0;
+}
+
+static void xsk_queue_teardown(struct xsk_queue *q) {
+    struct xsk_ring *rings[] = { &q->fill, &q->comp, &q->rx, &q->tx };
+    uint32_t key = q->queue_id;
+    int map_fd, i;
+
+    map_fd = open_pinned_map("nanonet_xsks");
+    if (map_fd >= 0) {
+        bpf_map_delete(map_fd, &key);
+        close(map_fd);
+    }
+
+    for (i = 0; i < 4; i++) {
+        if (rings[i]->map) {
+            munmap(rings[i]->map, rings[i]->map_len);
+        }
+    }
+    if (q->fd >= 0) {
+        close(q->fd);
+    }
+    if (q->umem) {
+        munmap(q->umem, (size_t)NUM_FRAMES * FRAME_SIZE);
+    }
+}
+
+// Returns the length of the order frame written in place, or 0 when the
+// frame should simply be recycled.
+static uint32_t process_frame(struct xsk_queue *q, uint64_t addr, uint32_t len) {
+    void *data = (char *)q->umem + addr;
+    uint32_t room = FRAME_SIZE - (addr & (FRAME_SIZE - 1));
+    struct nanonet_frame frame;
+    struct market_data tick;
+    struct trading_order *order;
+    const struct nanonet_xdp_config *cfg = &engine.xdp;
+    uint32_t header_len;
+
+    if (nanonet_parse_frame(data, (char *)data + len, &frame) < 0 ||
+        !nanonet_frame_matches(&frame, cfg->target_ip, cfg->target_port, cfg->protocol,
+                               cfg->multicast, cfg->multicast_group)) {
+        q->stats.packets_bypassed++;
+        return 0;
+    }
+
+    header_len = (char *)frame.payload - (char *)data;
+    if (frame.ip_hdr_len != sizeof(struct ull_iphdr) || !frame.udp ||
+        frame.payload_len < (int)sizeof(struct market_data) || header_len + sizeof(*order) > room) {
+        q->stats.errors++;
+        return 0;
+    }
+
+    q->stats.packets_processed++;
+    if (!nanonet_market_data_triggers(frame.payload)) {
+        return 0;
+    }
+
+    // The order is encoded over the tick, so work from a copy of it.
+    tick = *(const struct market_data *)frame.payload;
+    order = frame.payload;
+    nanonet_market_data_fill(&tick, order, now_ns(CLOCK_REALTIME));
+    nanonet_order_id_next(&q->order_ids, order->clOrdId);
+    nanonet_reflect_udp_headers(&frame, cfg->h_source, cfg->response_ip, cfg->response_port, sizeof(*order));
+    return header_len + sizeof(*order);
+}
+
+// The risk fields of the XDP config belong to the module and the control
+// tools, which may change them while the engine runs.
+static void copy_xdp_risk(struct nanonet_xdp_config *to, const struct nanonet_xdp_config *from) {
+    to->killed = from->killed;
+    to->max_order_quantity = from->max_order_quantity;
+    to->interval_ns = from->interval_ns;
+    to->tolerance_ns = from->tolerance_ns;
+}
+
+static void *queue_loop(void *arg) {
+    struct xsk_queue *q = arg;
+    struct xdp_desc *rx_descs = q->rx.descs;
+    struct xdp_desc *tx_descs = q->tx.descs;
+    uint64_t *comp_descs = q->comp.descs;
+    cpu_set_t cpus;
+    uint32_t n, i, out_len, sent;
+    uint64_t start, elapsed;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(q->cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        fprintf(stderr, "Warning: failed to pin queue %d to CPU %d\n", q->queue_id, q->cpu);
+    }
+
+    while (!stop_requested) {
+        // Frames the driver finished sending go back to the free list.
+        n = ring_cons_avail(&q->comp);
+        for (i = 0; i < n; i++) {
+            q->free_frames[q->free_count++] = comp_descs[q->comp.cached_cons++ & q->comp.mask] & ~(uint64_t)(FRAME_SIZE - 1);
+        }
+        if (n) {
+            ring_cons_release(&q->comp);
+            q->stats.tx_completed += n;
+        }
+
+        refill(q);
+        if (ring_needs_wakeup(&q->fill)) {
+            recvfrom(q->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+        }
+
+        n = ring_cons_avail(&q->rx);
+        if (n == 0) {
+            continue;
+        }
+        if (n > BATCH_SIZE) {
+            n = BATCH_SIZE;
+        }
+
+        sent = 0;
+        for (i = 0; i < n; i++) {
+            const struct xdp_desc *desc = &rx_descs[q->rx.cached_cons++ & q->rx.mask];
+
+            q->stats.rx_frames++;
+            start = now_ns(CLOCK_MONOTONIC);
+            out_len = process_frame(q, desc->addr, desc->len);
+
+            if (out_len && ring_prod_free(&q->tx, 1) > 0) {
+                struct xdp_desc *tx = &tx_descs[q->tx.cached_prod++ & q->tx.mask];
+
+                tx->addr = desc->addr;
+                tx->len = out_len;
+                tx->options = 0;
+                sent++;
+            } else {
+                if (out_len) {
+                    q->stats.tx_ring_full++;
+                }
+                q->free_frames[q->free_count++] = desc->addr & ~(uint64_t)(FRAME_SIZE - 1);
+            }
+
+            elapsed = now_ns(CLOCK_MONOTONIC) - start;
+            q->stats.total_process_time_ns += elapsed;
+            if (elapsed < q->stats.min_process_time_ns) {
+                q->stats.min_process_time_ns = elapsed;
+            }
+            if (elapsed > q->stats.max_process_time_ns) {
+                q->stats.max_process_time_ns = elapsed;
+            }
+        }
+        ring_cons_release(&q->rx);
+
+        if (sent) {
+            ring_prod_submit(&q->tx);
+            q->stats.responses_sent += sent;
+            if (ring_needs_wakeup(&q->tx)) {
+                sendto(q->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void handle_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void print_stats(struct xsk_queue *queues) {
+    int i;
+
+    printf("\n%-6s %-5s %-12s %-12s %-12s %-12s %-10s %-10s %-10s %-10s\n", "Queue", "CPU", "RX", "Processed",
+           "Bypassed", "Orders", "Errors", "Min(ns)", "Avg(ns)", "Max(ns)");
+    for (i = 0; i < engine.num_queues; i++) {
+        struct engine_stats *s = &queues[i].stats;
+
+        printf("%-6d %-5d %-12llu %-12llu %-12llu %-12llu %-10llu %-10llu %-10llu %-10llu\n",
+               queues[i].queue_id, queues[i].cpu,
+               (unsigned long long)s->rx_frames, (unsigned long long)s->packets_processed,
+               (unsigned long long)s->packets_bypassed, (unsigned long long)s->responses_sent,
+               (unsigned long long)(s->errors + s->tx_ring_full),
+               (unsigned long long)(s->rx_frames ? s->min_process_time_ns : 0),
+               (unsigned long long)(s->rx_frames ? s->total_process_time_ns / s->rx_frames : 0),
+               (unsigned long long)s->max_process_time_ns);
+    }
+}
+
+void print_usage(const char *program_name) {
+    printf("Usage: %s -i <ifname> -t <ip> -p <port> [options]\n", program_name);
+    printf("Options:\n");
+    printf("  -i <ifname>      Interface with src/nanonet_xdp.bpf.o attached\n");
+    printf("  -t <ip>          Target IP address (market data destination)\n");
+    printf("  -p <port>        Target UDP port\n");
+    printf("  -m <group>       Also accept ticks sent to this multicast group\n");
+    printf("  -r <ip>          Source IP of orders (default: target IP)\n");
+    printf("  -R <port>        Source port of orders (default: 9999)\n");
+    printf("  -q <count>       Number of queues, one busy-polling thread each (default: 1)\n");
+    printf("  -Q <queue>       First queue id (default: 0)\n");
+    printf("  -c <cpu>         CPU for the first queue; queue n runs on cpu + n (default: 0)\n");
+    printf("  -z               Require zero-copy mode (default: copy mode, works on veth)\n");
+    printf("  -b               Enable socket busy polling (SO_PREFER_BUSY_POLL)\n");
+    printf("\nExample:\n");
+    printf("  ip link set dev eth0 xdpdrv obj src/nanonet_xdp.bpf.o sec xdp\n");
+    printf("  %s -i eth0 -t 192.168.1.100 -p 8080 -q 4 -c 2 -z -b\n", program_name);
+}
+
+int main(int argc, char *argv[]) {
+    struct nanonet_xdp_config saved_cfg;
+    struct xsk_queue *queues;
+    uint32_t key = 0;
+    int cfg_fd, opt, i, ret = 0;
+
+    memset(&engine, 0, sizeof(engine));
+    engine.num_queues = 1;
+    engine.xdp.protocol = NANONET_IPPROTO_UDP;
+    engine.xdp.response_port = htons(9999);
+
+    while ((opt = getopt(argc, argv, "i:t:p:m:r:R:q:Q:c:zbh")) != -1) {
+        switch (opt) {
+            case 'i': engine.ifname = optarg; break;
+            case 't': inet_pton(AF_INET, optarg, &engine.xdp.target_ip); break;
+            case 'p': engine.xdp.target_port = htons(atoi(optarg)); break;
+            case 'm':
+                engine.xdp.multicast = 1;
+                inet_pton(AF_INET, optarg, &engine.xdp.multicast_group);
+                break;
+            case 'r': inet_pton(AF_INET, optarg, &engine.xdp.response_ip); break;
+            case 'R': engine.xdp.response_port = htons(atoi(optarg)); break;
+            case 'q': engine.num_queues = atoi(optarg); break;
+            case 'Q': engine.first_queue = atoi(optarg); break;
+            case 'c': engine.first_cpu = atoi(optarg); break;
+            case 'z': engine.zerocopy = 1; break;
+            case 'b': engine.busy_poll = 1; break;
+            default:
+                print_usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!engine.ifname || !engine.xdp.target_ip || !engine.xdp.target_port ||
+        engine.num_queues < 1 || engine.first_queue + engine.num_queues > NANONET_XSK_MAX_QUEUES) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (!engine.xdp.response_ip) {
+        engine.xdp.response_ip = engine.xdp.target_ip;
+    }
+
+    engine.ifindex = if_nametoindex(engine.ifname);
+    if (!engine.ifindex || nanonet_if_mac(engine.ifname, engine.xdp.h_source) < 0) {
+        fprintf(stderr, "Unknown interface: %s\n", engine.ifname);
+        return 1;
+    }
+
+    queues = calloc(engine.num_queues, sizeof(*queues));
+    if (!queues) {
+        perror("Failed to allocate queues");
+        return 1;
+    }
+
+    for (i = 0; i < engine.num_queues; i++) {
+        queues[i].fd = -1;
+        queues[i].queue_id = engine.first_queue + i;
+        queues[i].cpu = engine.first_cpu + i;
+        if (xsk_queue_setup(&queues[i]) < 0) {
+            ret = 1;
+            goto out;
+        }
+    }
+
+    // Point the XDP program at the sockets; restore its config on exit.
+    cfg_fd = open_pinned_map("nanonet_xdp_cfg");
+    if (cfg_fd < 0 || bpf_map_lookup(cfg_fd, &key, &saved_cfg) < 0) {
+        ret = 1;
+        goto out;
+    }
+    engine.xdp.enabled = 1;
+    engine.xdp.xsk = 1;
+    copy_xdp_risk(&engine.xdp, &saved_cfg);
+    if (bpf_map_update(cfg_fd, &key, &engine.xdp) < 0) {
+        perror("Failed to update XDP config map");
+        close(cfg_fd);
+        ret = 1;
+        goto out;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    printf("NanoNet AF_XDP engine on %s: %d queue(s) from queue %d, CPUs %d-%d, %s mode\n",
+           engine.ifname, engine.num_queues, engine.first_queue, engine.first_cpu,
+           engine.first_cpu + engine.num_queues - 1, engine.zerocopy ? "zero-copy" : "copy");
+
+    for (i = 0; i < engine.num_queues; i++) {
+        if (pthread_create(&queues[i].thread, NULL, queue_loop, &queues[i]) != 0) {
+            perror("Failed to start queue thread");
+            stop_requested = 1;
+            engine.num_queues = i;
+            ret = 1;
+            break;
+        }
+    }
+    for (i = 0; i < engine.num_queues; i++) {
+        pthread_join(queues[i].thread, NULL);
+    }
+
+    if (bpf_map_lookup(cfg_fd, &key, &engine.xdp) == 0) {
+        copy_xdp_risk(&saved_cfg, &engine.xdp);
+    }
+    bpf_map_update(cfg_fd, &key, &saved_cfg);
+    close(cfg_fd);
+    print_stats(queues);
+
+out:
+    for (i = 0; i < engine.num_queues; i++) {
+        xsk_queue_teardown(&queues[i]);
+    }
+    free(queues);
+    return ret;
+}
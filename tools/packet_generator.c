@@ -2,34 +2,99 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <endian.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <time.h>
 
+#define PACKET_COUNT 1000
+#define MAX_BUNDLE 64
+#define MSG_TICK 'T'
+
 struct market_data {
     char symbol[8];
     uint32_t price;
     uint32_t quantity;
     uint64_t timestamp;
-} __packed;
+} __attribute__((packed));
+
+// MoldUDP64 header; every message follows as a big-endian length + body
+struct moldudp64_hdr {
+    char session[10];
+    uint64_t seq;
+    uint16_t msg_count;
+} __attribute__((packed));
+
+struct bundle_msg {
+    uint16_t len;
+    uint8_t type;
+    struct market_data tick;
+} __attribute__((packed));
 
 void print_usage(const char *program_name) {
-    printf("Usage: %s <ip> <port> <protocol> [multicast <group>]\n", program_name);
+    printf("Usage: %s <ip> <port> <protocol> [multicast <group>] [bundle <n>] [ab <ip>]\n", program_name);
+    printf("  bundle <n>  Send MoldUDP64 packets of n ITCH-style tick messages (udp, n <= %d)\n", MAX_BUNDLE);
+    printf("  ab <ip>     Also send every packet to <ip> on the same port, as line B of an A/B feed\n");
     printf("Example: %s 192.168.1.100 8080 udp multicast 239.1.1.1\n", program_name);
+    printf("         %s 239.1.1.2 8081 udp bundle 16 ab 239.1.2.2\n", program_name);
+}
+
+static void fill_tick(struct market_data *tick, uint64_t timestamp) {
+    // Host byte order, as the module reads it
+    memcpy(tick->symbol, "AAPL    ", 8);
+    tick->price = 9999;    // Below threshold to trigger order
+    tick->quantity = 1000;
+    tick->timestamp = timestamp;
 }
 
 int main(int argc, char *argv[]) {
     int sock;
     struct sockaddr_in dest_addr;
-    struct market_data packet;
+    struct sockaddr_in line_b_addr;
+    unsigned char buf[sizeof(struct moldudp64_hdr) + MAX_BUNDLE * sizeof(struct bundle_msg)];
+    struct moldudp64_hdr *hdr = (struct moldudp64_hdr *)buf;
+    struct bundle_msg *msgs = (struct bundle_msg *)(hdr + 1);
+    size_t len;
     int multicast = 0;
+    int bundle = 0;
+    int line_b = 0;
+    char session[11];
+    uint64_t seq = 1;
     struct in_addr multicast_group;
+    struct in_addr line_b_ip;
+    int i, j;
 
-    if (argc < 4 || (strcmp(argv[3], "multicast") == 0 && argc != 5)) {
+    if (argc < 4) {
         print_usage(argv[0]);
         return 1;
     }
 
+    for (i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "multicast") == 0 && i + 1 < argc) {
+            if (inet_aton(argv[++i], &multicast_group) == 0) {
+                printf("Invalid multicast group: %s\n", argv[i]);
+                return 1;
+            }
+            multicast = 1;
+        } else if (strcmp(argv[i], "bundle") == 0 && i + 1 < argc) {
+            bundle = atoi(argv[++i]);
+            if (bundle < 1 || bundle > MAX_BUNDLE) {
+                printf("Invalid bundle size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "ab") == 0 && i + 1 < argc) {
+            if (inet_aton(argv[++i], &line_b_ip) == 0) {
+                printf("Invalid line B address: %s\n", argv[i]);
+                return 1;
+            }
+            line_b = 1;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
     if (strcmp(argv[3], "tcp") == 0) {
         sock = socket(AF_INET, SOCK_STREAM, 0);
     } else if (strcmp(argv[3], "udp") == 0) {
@@ -43,6 +108,12 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if ((multicast || bundle || line_b) && strcmp(argv[3], "udp") != 0) {
+        printf("multicast, bundle and ab require udp\n");
+        close(sock);
+        return 1;
+    }
+
     memset(&dest_addr, 0, sizeof(dest_addr));
     dest_addr.sin_family = AF_INET;
     dest_addr.sin_port = htons(atoi(argv[2]));
@@ -52,13 +123,7 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    if (argc == 5 && strcmp(argv[3], "udp") == 0 && strcmp(argv[4], "multicast") == 0) {
-        multicast = 1;
-        if (inet_aton(argv[5], &multicast_group) == 0) {
-            printf("Invalid multicast group: %s\n", argv[5]);
-            close(sock);
-            return 1;
-        }
+    if (multicast) {
         struct ip_mreq mreq;
         mreq.imr_multiaddr = multicast_group;
         mreq.imr_interface.s_addr = INADDR_ANY;
@@ -70,6 +135,11 @@ int main(int argc, char *argv[]) {
         dest_addr.sin_addr = multicast_group;
     }
 
+    if (line_b) {
+        line_b_addr = dest_addr;
+        line_b_addr.sin_addr = line_b_ip;
+    }
+
     if (strcmp(argv[3], "tcp") == 0) {
         if (connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
             perror("Failed to connect");
@@ -78,21 +148,39 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    strncpy(packet.symbol, "AAPL    ", 8);
-    packet.price = htonl(9999); // Below threshold to trigger order
-    packet.quantity = htonl(1000);
-    packet.timestamp = htobe64(time(NULL) * 1000000000ULL);
+    // A new session per run, so receivers restart sequence tracking
+    snprintf(session, sizeof(session), "%010lu", (unsigned long)time(NULL) % 10000000000UL);
+    memcpy(hdr->session, session, sizeof(hdr->session));
+
+    for (i = 0; i < PACKET_COUNT; i++) {
+        uint64_t timestamp = time(NULL) * 1000000000ULL + i * 1000000ULL;
+
+        if (bundle) {
+            hdr->seq = htobe64(seq);
+            hdr->msg_count = htons(bundle);
+            for (j = 0; j < bundle; j++) {
+                msgs[j].len = htons(1 + sizeof(struct market_data));
+                msgs[j].type = MSG_TICK;
+                fill_tick(&msgs[j].tick, timestamp + j);
+            }
+            seq += bundle;
+            len = sizeof(*hdr) + bundle * sizeof(struct bundle_msg);
+        } else {
+            fill_tick((struct market_data *)buf, timestamp);
+            len = sizeof(struct market_data);
+        }
 
-    for (int i = 0; i < 1000; i++) {
-        packet.timestamp = htobe64(time(NULL) * 1000000000ULL + i * 1000000);
         if (strcmp(argv[3], "udp") == 0) {
-            if (sendto(sock, &packet, sizeof(packet), 0,
-                       (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
+            if (sendto(sock, buf, len, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
                 perror("Failed to send packet");
                 break;
             }
+            if (line_b && sendto(sock, buf, len, 0, (struct sockaddr *)&line_b_addr, sizeof(line_b_addr)) < 0) {
+                perror("Failed to send packet on line B");
+                break;
+            }
         } else {
-            if (send(sock, &packet, sizeof(packet), 0) < 0) {
+            if (send(sock, buf, len, 0) < 0) {
                 perror("Failed to send packet");
                 break;
             }
@@ -102,4 +190,4 @@ int main(int argc, char *argv[]) {
 
     close(sock);
     return 0;
-}
\ No newline at end of file
+}